@@ -0,0 +1,53 @@
+#!/bin/sh
+# 静态请求的分配次数回归检查，服务器需以分配统计模式编译: make server http_load ALLOC_PROFILE=1
+# 分别压测缓存命中的小文件与由工作线程发送的大文件，预热后按 /metrics 的差值计算每个请求的平均分配次数
+# 在仓库根目录运行，平均分配次数超过 ALLOC_MAX(默认0)时返回1
+# 环境变量 PORT 指定端口(默认9190)，DURATION 指定每项压测秒数(默认3)，SERVER_ARGS 指定服务器的其他参数
+
+PORT=${PORT:-9190}
+DURATION=${DURATION:-3}
+ALLOC_MAX=${ALLOC_MAX:-0}
+SERVER_ARGS=${SERVER_ARGS:-"-k 1 -c 1"}
+
+if [ ! -x ./server ] || [ ! -x ./http_load ]; then
+    echo "run 'make server http_load ALLOC_PROFILE=1' first" >&2
+    exit 1
+fi
+
+# 输出 kind 类请求的 请求数 与 分配次数
+snapshot() {
+    curl -s "http://127.0.0.1:$PORT/metrics" | awk -v kind="$1" '
+        $1 == "webserver_alloc_requests_total{kind=\"" kind "\"}" { n = $2 }
+        $1 == "webserver_request_allocs_total{kind=\"" kind "\"}" { a = $2 }
+        END { if (n == "") exit 1; print n, a }'
+}
+
+./server -p "$PORT" $SERVER_ARGS > /dev/null 2>&1 &
+pid=$!
+trap 'kill $pid 2> /dev/null; wait $pid 2> /dev/null' EXIT
+sleep 1
+
+if ! snapshot static > /dev/null; then
+    echo "server has no allocation metrics, rebuild with ALLOC_PROFILE=1" >&2
+    exit 1
+fi
+
+status=0
+for pair in cached:/judge.html static:/test1.jpg; do
+    kind=${pair%%:*}
+    url=${pair#*:}
+    # 预热：线程缓冲区、指标分片与文件缓存在首次使用时分配
+    ./http_load -p "$PORT" -c 8 -d 1 -u "$url" -m static:1 > /dev/null
+    before=$(snapshot "$kind")
+    ./http_load -p "$PORT" -c 8 -d "$DURATION" -u "$url" -m static:1 > /dev/null
+    after=$(snapshot "$kind")
+    echo "$before $after" | awk -v kind="$kind" -v url="$url" -v max="$ALLOC_MAX" '{
+        n = $3 - $1
+        a = $4 - $2
+        avg = n > 0 ? a / n : 0
+        printf "%-8s %-12s requests=%d allocs=%d allocs_per_request=%.3f\n", kind, url, n, a, avg
+        exit (n == 0 || avg > max) ? 1 : 0
+    }' || status=1
+done
+[ $status -eq 0 ] && echo "PASS" || echo "FAIL: allocations per request above $ALLOC_MAX"
+exit $status
@@ -0,0 +1,100 @@
+#ifndef _HTTP_CLIENT_H
+#define _HTTP_CLIENT_H
+
+/**
+ *      压测客户端共用的响应解析与延迟统计
+ *   http_load 与 replay 使用
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "../metrics/metrics.h"
+
+static inline long long now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+// 解析 in 中从 pos 开始的一个响应，完整时返回状态码并设置响应长度，不完整返回-1
+// 服务器的响应总是带 Content-Length
+static inline int parse_response(const std::string &in, size_t pos, size_t &total)
+{
+    size_t end = in.find("\r\n\r\n", pos);
+    if(std::string::npos == end)
+        return -1;
+    const char *head = in.c_str() + pos;
+    int status = strncmp(head, "HTTP/1.", 7) == 0 ? atoi(head + 9) : 0;
+    long long length = 0;
+    const char *cl = strcasestr(head, "Content-Length:");
+    if(cl && cl < in.c_str() + end)
+        length = atoll(cl + 15);
+    total = end + 4 + length - pos;
+    if(in.size() - pos < total)
+        return -1;
+    return status;
+}
+
+// 与 /metrics 相同的对数线性分桶，分位数为所在桶的上界
+struct latency_hist
+{
+    std::vector<long long> hist;
+    long long count;
+    long long sum;
+    long long max;
+
+    latency_hist() : hist(metrics_shard::BUCKETS, 0), count(0), sum(0), max(0) {}
+
+    void record(long long us)
+    {
+        if(us < 0)
+            us = 0;
+        ++hist[metrics::bucket_of(us)];
+        ++count;
+        sum += us;
+        if(us > max)
+            max = us;
+    }
+
+    void merge(const latency_hist &other)
+    {
+        for(size_t i = 0; i < hist.size(); ++i)
+            hist[i] += other.hist[i];
+        count += other.count;
+        sum += other.sum;
+        max = std::max(max, other.max);
+    }
+
+    long long quantile(double q) const
+    {
+        long long rank = (long long)(q * count);
+        if(rank >= count)
+            rank = count - 1;
+        long long seen = 0;
+        for(int j = 0; j < (int)hist.size(); ++j)
+        {
+            seen += hist[j];
+            if(seen > rank)
+                return std::min(metrics::bucket_upper(j), max);
+        }
+        return max;
+    }
+
+    // 输出 "latency_us":{...}
+    void print_json() const
+    {
+        printf("\"latency_us\":{");
+        if(count > 0)
+            printf("\"mean\":%.1f,\"p50\":%lld,\"p90\":%lld,\"p99\":%lld,\"p999\":%lld,\"max\":%lld",
+                   (double)sum / count, quantile(0.5), quantile(0.9), quantile(0.99), quantile(0.999), max);
+        printf("}");
+    }
+};
+
+#endif
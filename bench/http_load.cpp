@@ -0,0 +1,540 @@
+/**
+ *      HTTP压测客户端
+ *   每个线程一个epoll，非阻塞地维护 -c/-t 个连接，结束时输出一行JSON报告
+ *   1. 闭环模式：每个连接保持 -P 个在途请求，收到响应后立即补发，延迟从发送时算起
+ *   2. 开环模式(-r)：按固定速率排定每个请求的计划发送时间，没有空闲连接时请求顺延，
+ *      延迟从计划时间算起，包含在客户端等待的时间，不会因服务器变慢而少记延迟(coordinated omission)
+ *   3. 请求混合 -m static:8,login:1,register:1，按权重轮流发送；
+ *      登录使用启动时注册的用户，注册每次使用新用户名
+ *   4. 非长连接时每个连接只发一个请求，收到响应后重新连接；流水线深度只在长连接时生效，
+ *      服务器不支持流水线时多出的请求会按超时计
+ *   延迟直方图与 /metrics 使用相同的对数线性分桶，分位数为所在桶的上界
+ *
+ *   用法: ./http_load [-a 地址] [-p 端口] [-c 连接数] [-t 线程数] [-d 秒] [-k 0|1 长连接] [-P 流水线深度]
+ *                     [-m 请求混合] [-r 每秒请求数, 0为闭环] [-u 静态文件路径] [-T 超时ms] [-l 报告标签]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <thread>
+#include <vector>
+#include "http_client.h"
+
+enum REQUEST_KIND
+{
+    KIND_STATIC = 0,
+    KIND_LOGIN,
+    KIND_REGISTER,
+    KIND_NUM
+};
+
+static const char *kind_name[] = { "static", "login", "register" };
+
+struct load_config
+{
+    sockaddr_in addr;
+    int connections;
+    int threads;
+    int seconds;
+    bool keepalive;
+    int pipeline;
+    double rate;                // 每秒请求数，0为闭环
+    std::string url;
+    int timeout_ms;
+    std::string label;
+    std::vector<int> mix;       // 按权重展开的请求类型，轮流发送
+};
+
+struct load_conn
+{
+    int fd;
+    bool connecting;
+    std::string out;                // 待发送数据
+    size_t out_off;
+    std::string in;                 // 已收到未解析的数据
+    std::deque<long long> starts;   // 在途请求的开始时间(us)，按发送顺序
+    long long active_us;            // 最近一次收发的时间，用于超时判断
+    int sent;                       // 当前连接上已发送的请求数
+};
+
+struct load_worker
+{
+    int id;
+    int nconn;
+    double rate;
+    long long requests;
+    latency_hist latency;
+    long long kinds[KIND_NUM];
+    long long errors;               // 状态码>=400或连接在响应前被关闭
+    long long timeouts;
+    long long connect_errors;
+    long long unsent;               // 开环模式结束时计划时间已到但还没有发出的请求
+    long long bytes;
+    unsigned long long seq;
+
+    load_worker() : id(0), nconn(0), rate(0), requests(0), errors(0),
+                    timeouts(0), connect_errors(0), unsent(0), bytes(0), seq(0)
+    {
+        memset(kinds, 0, sizeof(kinds));
+    }
+};
+
+static load_config g_cfg;
+
+static bool parse_mix(const char *text, std::vector<int> &mix)
+{
+    mix.clear();
+    std::string s(text);
+    size_t pos = 0;
+    while(pos <= s.size())
+    {
+        size_t end = s.find(',', pos);
+        if(std::string::npos == end)
+            end = s.size();
+        std::string item = s.substr(pos, end - pos);
+        size_t colon = item.find(':');
+        std::string name = item.substr(0, colon);
+        int weight = std::string::npos == colon ? 1 : atoi(item.c_str() + colon + 1);
+        int kind = -1;
+        for(int i = 0; i < KIND_NUM; ++i)
+            if(name == kind_name[i])
+                kind = i;
+        if(kind < 0 || weight < 0)
+            return false;
+        for(int i = 0; i < weight; ++i)
+            mix.push_back(kind);
+        pos = end + 1;
+    }
+    return !mix.empty();
+}
+
+static void build_request(load_worker &w, std::string &out)
+{
+    int kind = g_cfg.mix[w.seq % g_cfg.mix.size()];
+    const char *conn = g_cfg.keepalive ? "keep-alive" : "close";
+    char body[128];
+    char head[512];
+    int n;
+    if(KIND_STATIC == kind)
+    {
+        n = snprintf(head, sizeof(head), "GET %s HTTP/1.1\r\nHost: localhost\r\nConnection: %s\r\n\r\n",
+                     g_cfg.url.c_str(), conn);
+        out.append(head, n);
+    }
+    else
+    {
+        int len;
+        if(KIND_LOGIN == kind)
+            len = snprintf(body, sizeof(body), "user=bench&password=bench");
+        else
+            len = snprintf(body, sizeof(body), "user=b%d_%d_%llu&password=bench", getpid(), w.id, w.seq);
+        n = snprintf(head, sizeof(head), "POST /%cCGISQL.cgi HTTP/1.1\r\nHost: localhost\r\nConnection: %s\r\n"
+                     "Content-Length: %d\r\n\r\n", KIND_LOGIN == kind ? '2' : '3', conn, len);
+        out.append(head, n);
+        out.append(body, len);
+    }
+    ++w.kinds[kind];
+    ++w.seq;
+}
+
+static bool open_conn(int epollfd, load_conn &c)
+{
+    c.fd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if(c.fd < 0)
+        return false;
+    int flag = 1;
+    setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    c.connecting = true;
+    c.out.clear();
+    c.out_off = 0;
+    c.in.clear();
+    c.sent = 0;
+    c.active_us = now_us();
+    if(connect(c.fd, (sockaddr *)&g_cfg.addr, sizeof(g_cfg.addr)) < 0 && errno != EINPROGRESS)
+    {
+        close(c.fd);
+        c.fd = -1;
+        return false;
+    }
+    epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP;
+    ev.data.ptr = &c;
+    epoll_ctl(epollfd, EPOLL_CTL_ADD, c.fd, &ev);
+    return true;
+}
+
+// 关闭连接，在途请求按 lost 计数，开环模式的计划时间不保留
+static void close_conn(int epollfd, load_conn &c, long long &lost)
+{
+    if(c.fd >= 0)
+    {
+        epoll_ctl(epollfd, EPOLL_CTL_DEL, c.fd, 0);
+        close(c.fd);
+        c.fd = -1;
+    }
+    lost += c.starts.size();
+    c.starts.clear();
+}
+
+// 连接可以再发送一个请求，连接建立前不分配请求，建立连接的耗时不计入延迟
+static bool can_send(const load_conn &c)
+{
+    if(c.fd < 0 || c.connecting)
+        return false;
+    if(!g_cfg.keepalive)
+        return 0 == c.sent;
+    return (int)c.starts.size() < g_cfg.pipeline;
+}
+
+static void flush_out(load_conn &c)
+{
+    while(c.out_off < c.out.size())
+    {
+        ssize_t n = send(c.fd, c.out.data() + c.out_off, c.out.size() - c.out_off, MSG_NOSIGNAL);
+        if(n <= 0)
+            break;
+        c.out_off += n;
+    }
+    if(c.out_off == c.out.size())
+    {
+        c.out.clear();
+        c.out_off = 0;
+    }
+}
+
+static void send_request(load_worker &w, load_conn &c, long long start)
+{
+    build_request(w, c.out);
+    c.starts.push_back(start);
+    ++c.sent;
+    c.active_us = now_us();
+    flush_out(c);
+}
+
+// 解析收到的完整响应，返回false表示需要关闭连接
+static bool parse_responses(load_worker &w, load_conn &c)
+{
+    size_t pos = 0;
+    while(!c.starts.empty())
+    {
+        size_t total;
+        int status = parse_response(c.in, pos, total);
+        if(status < 0)
+            break;
+
+        w.latency.record(now_us() - c.starts.front());
+        ++w.requests;
+        c.starts.pop_front();
+        w.bytes += total;
+        if(status < 200 || status >= 400)
+            ++w.errors;
+        pos += total;
+    }
+    c.in.erase(0, pos);
+    return g_cfg.keepalive;
+}
+
+static void run_worker(load_worker *w)
+{
+    int epollfd = epoll_create(5);
+    std::vector<load_conn> conns(w->nconn);
+    for(size_t i = 0; i < conns.size(); ++i)
+    {
+        conns[i].fd = -1;
+        if(!open_conn(epollfd, conns[i]))
+            ++w->connect_errors;
+    }
+
+    bool open_loop = w->rate > 0;
+    long long t0 = now_us();
+    long long end = t0 + g_cfg.seconds * 1000000LL;
+    long long timeout_us = g_cfg.timeout_ms * 1000LL;
+    long long scheduled = 0;        // 开环模式已发出的计划请求数
+    long long last_check = t0;
+    size_t next = 0;
+    epoll_event events[256];
+
+    // 开环模式用 timerfd 在下一个计划时间唤醒，精度不受 epoll_wait 毫秒超时的限制
+    int timerfd = -1;
+    if(open_loop)
+    {
+        timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = NULL;
+        epoll_ctl(epollfd, EPOLL_CTL_ADD, timerfd, &ev);
+    }
+    while(true)
+    {
+        long long now = now_us();
+        if(now >= end)
+            break;
+
+        if(open_loop)
+        {
+            // 计划时间已到的请求依次分配给有空位的连接，没有空位时留到下一轮，计划时间不变
+            long long due = (long long)((now - t0) * w->rate / 1000000.0) + 1;
+            bool blocked = false;
+            while(scheduled < due)
+            {
+                size_t k = 0;
+                for(; k < conns.size() && !can_send(conns[(next + k) % conns.size()]); ++k)
+                    ;
+                if(k == conns.size())
+                {
+                    blocked = true;
+                    break;
+                }
+                load_conn &c = conns[(next + k) % conns.size()];
+                next = (next + k + 1) % conns.size();
+                send_request(*w, c, t0 + (long long)(scheduled * 1000000.0 / w->rate));
+                ++scheduled;
+            }
+            // 没有空闲连接时等收到响应再发送
+            if(!blocked)
+            {
+                long long at = t0 + (long long)(scheduled * 1000000.0 / w->rate);
+                struct itimerspec its;
+                memset(&its, 0, sizeof(its));
+                clock_gettime(CLOCK_MONOTONIC, &its.it_value);
+                long long ns = its.it_value.tv_nsec + (at - now) * 1000;
+                its.it_value.tv_sec += ns / 1000000000;
+                its.it_value.tv_nsec = ns % 1000000000;
+                timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+            }
+        }
+
+        int n = epoll_wait(epollfd, events, 256, 10);
+        now = now_us();
+        for(int i = 0; i < n; ++i)
+        {
+            if(NULL == events[i].data.ptr)
+            {
+                // 计划时间已到，下一轮循环发送
+                uint64_t expirations;
+                ssize_t r = read(timerfd, &expirations, sizeof(expirations));
+                (void)r;
+                continue;
+            }
+            load_conn &c = *(load_conn *)events[i].data.ptr;
+            if(c.fd < 0)
+                continue;
+            if(c.connecting && (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+            {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                if(err)
+                {
+                    ++w->connect_errors;
+                    close_conn(epollfd, c, w->errors);
+                    continue;
+                }
+                c.connecting = false;
+                epoll_event ev;
+                ev.events = EPOLLIN | EPOLLRDHUP;
+                ev.data.ptr = &c;
+                epoll_ctl(epollfd, EPOLL_CTL_MOD, c.fd, &ev);
+            }
+
+            bool alive = true;
+            if(events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            {
+                char buf[16384];
+                while(true)
+                {
+                    ssize_t r = recv(c.fd, buf, sizeof(buf), 0);
+                    if(r > 0)
+                    {
+                        c.in.append(buf, r);
+                        continue;
+                    }
+                    if(0 == r || (errno != EAGAIN && errno != EWOULDBLOCK))
+                        alive = false;
+                    break;
+                }
+                c.active_us = now;
+                if(!parse_responses(*w, c) && c.starts.empty())
+                    alive = false;
+            }
+            if(!alive)
+            {
+                close_conn(epollfd, c, w->errors);
+                if(!open_conn(epollfd, c))
+                    ++w->connect_errors;
+            }
+            else if(!c.out.empty())
+            {
+                flush_out(c);
+            }
+        }
+
+        // 闭环模式：每个连接补满在途请求
+        if(!open_loop)
+        {
+            for(size_t i = 0; i < conns.size(); ++i)
+                while(can_send(conns[i]))
+                    send_request(*w, conns[i], now_us());
+        }
+
+        // 超时的连接重新建立
+        if(now - last_check >= 10000)
+        {
+            last_check = now;
+            for(size_t i = 0; i < conns.size(); ++i)
+            {
+                load_conn &c = conns[i];
+                if(c.fd >= 0 && (!c.starts.empty() || c.connecting) && now - c.active_us >= timeout_us)
+                {
+                    close_conn(epollfd, c, w->timeouts);
+                    if(!open_conn(epollfd, c))
+                        ++w->connect_errors;
+                }
+                else if(c.fd < 0 && open_conn(epollfd, c) == false)
+                {
+                    ++w->connect_errors;
+                }
+            }
+        }
+    }
+
+    if(open_loop)
+        w->unsent = (long long)((now_us() - t0) * w->rate / 1000000.0) - scheduled;
+    for(size_t i = 0; i < conns.size(); ++i)
+    {
+        long long unfinished = 0;
+        close_conn(epollfd, conns[i], unfinished);
+    }
+    if(timerfd >= 0)
+        close(timerfd);
+    close(epollfd);
+}
+
+// 启动前用一个阻塞连接注册登录请求使用的用户，用户已存在时忽略
+static void register_login_user()
+{
+    int fd = socket(PF_INET, SOCK_STREAM, 0);
+    if(fd < 0)
+        return;
+    struct timeval tv = { 2, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    if(0 == connect(fd, (sockaddr *)&g_cfg.addr, sizeof(g_cfg.addr)))
+    {
+        const char *req = "POST /3CGISQL.cgi HTTP/1.1\r\nHost: localhost\r\nContent-Length: 25\r\n\r\n"
+                          "user=bench&password=bench";
+        send(fd, req, strlen(req), MSG_NOSIGNAL);
+        char buf[4096];
+        while(recv(fd, buf, sizeof(buf), 0) > 0)
+            ;
+    }
+    close(fd);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *host = "127.0.0.1";
+    int port = 9006;
+    g_cfg.connections = 50;
+    g_cfg.threads = 1;
+    g_cfg.seconds = 10;
+    g_cfg.keepalive = true;
+    g_cfg.pipeline = 1;
+    g_cfg.rate = 0;
+    g_cfg.url = "/judge.html";
+    g_cfg.timeout_ms = 2000;
+    const char *mix = "static";
+    int opt;
+    while((opt = getopt(argc, argv, "a:p:c:t:d:k:P:m:r:u:T:l:")) != -1)
+    {
+        switch(opt)
+        {
+        case 'a': host = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 'c': g_cfg.connections = atoi(optarg); break;
+        case 't': g_cfg.threads = atoi(optarg); break;
+        case 'd': g_cfg.seconds = atoi(optarg); break;
+        case 'k': g_cfg.keepalive = atoi(optarg) != 0; break;
+        case 'P': g_cfg.pipeline = atoi(optarg); break;
+        case 'm': mix = optarg; break;
+        case 'r': g_cfg.rate = atof(optarg); break;
+        case 'u': g_cfg.url = optarg; break;
+        case 'T': g_cfg.timeout_ms = atoi(optarg); break;
+        case 'l': g_cfg.label = optarg; break;
+        default: break;
+        }
+    }
+    if(!parse_mix(mix, g_cfg.mix))
+    {
+        printf("bad request mix: %s\n", mix);
+        return 1;
+    }
+    g_cfg.threads = std::max(1, std::min(g_cfg.threads, g_cfg.connections));
+    g_cfg.pipeline = std::max(1, g_cfg.pipeline);
+
+    bzero(&g_cfg.addr, sizeof(g_cfg.addr));
+    g_cfg.addr.sin_family = AF_INET;
+    g_cfg.addr.sin_port = htons(port);
+    if(inet_pton(AF_INET, host, &g_cfg.addr.sin_addr) != 1)
+    {
+        printf("bad address: %s\n", host);
+        return 1;
+    }
+
+    if(std::find(g_cfg.mix.begin(), g_cfg.mix.end(), (int)KIND_LOGIN) != g_cfg.mix.end())
+        register_login_user();
+
+    std::vector<load_worker> workers(g_cfg.threads);
+    std::vector<std::thread> threads;
+    long long start = now_us();
+    for(int i = 0; i < g_cfg.threads; ++i)
+    {
+        workers[i].id = i;
+        workers[i].nconn = g_cfg.connections / g_cfg.threads + (i < g_cfg.connections % g_cfg.threads ? 1 : 0);
+        workers[i].rate = g_cfg.rate / g_cfg.threads;
+        threads.emplace_back(run_worker, &workers[i]);
+    }
+    for(size_t i = 0; i < threads.size(); ++i)
+        threads[i].join();
+    double secs = (now_us() - start) / 1e6;
+
+    load_worker sum;
+    for(size_t i = 0; i < workers.size(); ++i)
+    {
+        const load_worker &w = workers[i];
+        sum.latency.merge(w.latency);
+        for(int j = 0; j < KIND_NUM; ++j)
+            sum.kinds[j] += w.kinds[j];
+        sum.requests += w.requests;
+        sum.errors += w.errors;
+        sum.timeouts += w.timeouts;
+        sum.connect_errors += w.connect_errors;
+        sum.unsent += w.unsent;
+        sum.bytes += w.bytes;
+    }
+
+    printf("{\"label\":\"%s\",\"mode\":\"%s\",\"connections\":%d,\"threads\":%d,\"keepalive\":%d,\"pipeline\":%d,"
+           "\"rate\":%.0f,\"seconds\":%.2f,\"mix\":\"%s\",\"sent\":{\"static\":%lld,\"login\":%lld,\"register\":%lld},"
+           "\"requests\":%lld,\"rps\":%.1f,\"errors\":%lld,\"timeouts\":%lld,\"connect_errors\":%lld,\"unsent\":%lld,"
+           "\"bytes\":%lld,",
+           g_cfg.label.c_str(), g_cfg.rate > 0 ? "open" : "closed", g_cfg.connections, g_cfg.threads,
+           g_cfg.keepalive ? 1 : 0, g_cfg.pipeline, g_cfg.rate, secs, mix,
+           sum.kinds[KIND_STATIC], sum.kinds[KIND_LOGIN], sum.kinds[KIND_REGISTER],
+           sum.requests, sum.requests / secs, sum.errors, sum.timeouts, sum.connect_errors, sum.unsent, sum.bytes);
+    sum.latency.print_json();
+    printf("}\n");
+    return 0;
+}
@@ -0,0 +1,104 @@
+/**
+ *      日志写入吞吐测试
+ *   每个线程连续写入固定条数的日志，统计每线程每秒写入条数，线程数从1倍增到 -t
+ *   另外统计低于当前级别(被跳过)的日志调用耗时，参数中带有 inet_ntoa
+ *   -g 使用二进制格式，结束时输出写入的文件大小
+ *
+ *   用法: ./log_bench [-t 最大线程数] [-n 每线程日志条数] [-q 异步缓冲区条数, 0为同步] [-f 日志文件] [-g]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "../log/log.h"
+
+typedef std::chrono::steady_clock bench_clock;
+
+static int m_close_log = 0;
+
+static void log_lines(int id, int lines, const sockaddr_in *addr)
+{
+    for(int i = 0; i < lines; ++i)
+    {
+        LOG_INFO("bench thread %d client(%s) request %d done", id, inet_ntoa(addr->sin_addr), i);
+    }
+}
+
+static void run_bench(int threads, int lines, const char *mode, const sockaddr_in *addr)
+{
+    long long dropped = Log::get_instance()->dropped();
+    bench_clock::time_point start = bench_clock::now();
+
+    std::vector<std::thread> workers;
+    for(int i = 0; i < threads; ++i)
+        workers.emplace_back(log_lines, i, lines, addr);
+    for(size_t i = 0; i < workers.size(); ++i)
+        workers[i].join();
+
+    double secs = std::chrono::duration<double>(bench_clock::now() - start).count();
+    printf("{\"mode\":\"%s\",\"threads\":%d,\"lines\":%lld,\"lines_per_sec_per_thread\":%.0f,\"dropped\":%lld}\n",
+           mode, threads, (long long)threads * lines, lines / secs, Log::get_instance()->dropped() - dropped);
+}
+
+int main(int argc, char *argv[])
+{
+    int max_threads = 8, lines = 200000, queue = 800;
+    const char *file = "./LogBench";
+    bool binary = false;
+    int opt;
+    while((opt = getopt(argc, argv, "t:n:q:f:g")) != -1)
+    {
+        switch(opt)
+        {
+        case 't': max_threads = atoi(optarg); break;
+        case 'n': lines = atoi(optarg); break;
+        case 'q': queue = atoi(optarg); break;
+        case 'f': file = optarg; break;
+        case 'g': binary = true; break;
+        default: break;
+        }
+    }
+
+    if(!Log::get_instance()->init(file, 0, 2000, 100000000, queue, binary))
+    {
+        printf("open log file %s failed\n", file);
+        return 1;
+    }
+
+    sockaddr_in addr;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    const char *mode = binary ? (queue > 0 ? "async-binary" : "sync-binary") : (queue > 0 ? "async" : "sync");
+    for(int threads = 1; threads <= max_threads; threads *= 2)
+        run_bench(threads, lines, mode, &addr);
+
+    // 被跳过的日志：只有级别判断，参数不会被求值
+    Log::get_instance()->set_level(2);
+    bench_clock::time_point start = bench_clock::now();
+    log_lines(0, lines * 10, &addr);
+    double ns = std::chrono::duration<double, std::nano>(bench_clock::now() - start).count();
+    printf("{\"mode\":\"disabled\",\"threads\":1,\"lines\":%d,\"ns_per_call\":%.2f}\n", lines * 10, ns / (lines * 10));
+
+    // 等写线程写完后统计文件大小，写入的日志文件名带有日期前缀
+    Log::get_instance()->flush();
+    usleep(300000);
+    time_t t = time(NULL);
+    struct tm my_tm;
+    localtime_r(&t, &my_tm);
+    const char *p = strrchr(file, '/');
+    char path[256];
+    if(p)
+        snprintf(path, sizeof(path), "%.*s%d_%02d_%02d_%s", (int)(p - file + 1), file,
+                 my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday, p + 1);
+    else
+        snprintf(path, sizeof(path), "%d_%02d_%02d_%s", my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday, file);
+    struct stat st;
+    if(0 == stat(path, &st))
+        printf("{\"file\":\"%s\",\"bytes\":%lld}\n", path, (long long)st.st_size);
+    return 0;
+}
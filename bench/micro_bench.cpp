@@ -0,0 +1,289 @@
+/**
+ *      核心组件微基准测试
+ *   parser  http_conn::process_read 解析一组典型请求，do_request 走缓存命中分支，不访问磁盘
+ *   timer   time_wheel 在 1万~100万个定时器下的 add / adjust / tick
+ *   queue   block_queue 在 1~32 对生产者/消费者线程下的 push/pop
+ *   log     Log::write_log 同步与异步模式
+ *   每项重复 -r 次取最快一次，每项输出一行JSON，字段固定：
+ *      {"suite":..., "case":..., "n":规模或线程数, "ops":操作数, "ns_per_op":..., "mops":...}
+ *   用 bench/micro_compare.sh 对比两次输出
+ *
+ *   用法: ./micro_bench [-s parser,timer,queue,log] [-r 重复次数] [-q 缩小规模]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include <memory>
+#include "../http/http_conn.h"
+#include "../timer/time_wheel.h"
+#include "../log/block_queue.h"
+#include "../log/log.h"
+
+static int g_repeat = 3;
+static bool g_quick = false;
+
+static long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void report(const char *suite, const char *name, long long n, long long ops, long long ns)
+{
+    double per = ops > 0 ? (double)ns / ops : 0;
+    printf("{\"suite\":\"%s\",\"case\":\"%s\",\"n\":%lld,\"ops\":%lld,\"ns_per_op\":%.2f,\"mops\":%.3f}\n",
+           suite, name, n, ops, per, per > 0 ? 1000.0 / per : 0);
+    fflush(stdout);
+}
+
+// 重复执行取最快一次，fn 返回本次耗时(ns)
+template<typename F>
+static long long best_of(F fn)
+{
+    long long best = -1;
+    for(int i = 0; i < g_repeat; ++i)
+    {
+        long long ns = fn();
+        if(best < 0 || ns < best)
+            best = ns;
+    }
+    return best;
+}
+
+/* 解析器 */
+struct http_conn_bench
+{
+    static long long run(http_conn &c, const std::shared_ptr<file_cache::entry> &hit, const std::string &req,
+                         int iterations, bool parse)
+    {
+        long long start = now_ns();
+        for(int i = 0; i < iterations; ++i)
+        {
+            c.init();
+            c.m_cached = hit;
+            memcpy(c.m_read_buf, req.data(), req.size());
+            c.m_read_idx = req.size();
+            if(parse && c.process_read() != http_conn::FILE_REQUEST)
+            {
+                printf("parse failed: %s\n", req.c_str());
+                exit(1);
+            }
+        }
+        return now_ns() - start;
+    }
+
+    static void prepare(http_conn &c)
+    {
+        c.m_close_log = 1;
+        c.m_file_address = 0;
+    }
+};
+
+static void bench_parser()
+{
+    static const struct
+    {
+        const char *name;
+        const char *text;
+    } corpus[] = {
+        { "get_minimal", "GET / HTTP/1.1\r\n\r\n" },
+        { "get_keepalive", "GET /judge.html HTTP/1.1\r\nHost: 127.0.0.1:9006\r\nConnection: keep-alive\r\n\r\n" },
+        { "get_browser", "GET /picture.html HTTP/1.1\r\nHost: 127.0.0.1:9006\r\nConnection: keep-alive\r\n"
+                         "Cache-Control: max-age=0\r\nUpgrade-Insecure-Requests: 1\r\n"
+                         "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0 Safari/537.36\r\n"
+                         "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+                         "Referer: http://127.0.0.1:9006/\r\nAccept-Encoding: gzip, deflate, br\r\n"
+                         "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n\r\n" },
+        { "post_login", "POST /2CGISQL.cgi HTTP/1.1\r\nHost: 127.0.0.1:9006\r\nConnection: keep-alive\r\n"
+                        "Content-Type: application/x-www-form-urlencoded\r\nContent-Length: 25\r\n\r\n"
+                        "user=bench&password=bench" },
+    };
+
+    int iterations = g_quick ? 20000 : 200000;
+    std::unique_ptr<http_conn> c(new http_conn);
+    http_conn_bench::prepare(*c);
+    std::shared_ptr<file_cache::entry> hit(new file_cache::entry);
+    hit->data.assign(1024, 'x');
+    hit->mtime = 0;
+
+    // 每次解析前重置连接并复制请求，单独测出这部分开销
+    std::string req(corpus[2].text);
+    long long ns = best_of([&]() { return http_conn_bench::run(*c, hit, req, iterations, false); });
+    report("parser", "reset_only", req.size(), iterations, ns);
+
+    for(size_t i = 0; i < sizeof(corpus) / sizeof(corpus[0]); ++i)
+    {
+        req = corpus[i].text;
+        ns = best_of([&]() { return http_conn_bench::run(*c, hit, req, iterations, true); });
+        report("parser", corpus[i].name, req.size(), iterations, ns);
+    }
+}
+
+/* 时间轮 */
+static void bench_cb(client_data *)
+{
+}
+
+static void bench_timer()
+{
+    int sizes[] = { 10000, 100000, 1000000 };
+    int count = g_quick ? 2 : 3;
+    for(int s = 0; s < count; ++s)
+    {
+        int n = sizes[s];
+        std::vector<client_data> users(n);
+        std::vector<tw_timer *> timers(n);
+        long long add = -1, adjust = -1, tick = -1;
+        for(int r = 0; r < g_repeat; ++r)
+        {
+            time_wheel wheel;
+            long long start = now_ns();
+            for(int i = 0; i < n; ++i)
+            {
+                tw_timer *t = new tw_timer(0, 3);
+                t->cb_func = bench_cb;
+                t->data_user = &users[i];
+                users[i].timer = t;
+                timers[i] = t;
+                wheel.add_timer(t);
+            }
+            long long t1 = now_ns();
+            for(int i = 0; i < n; ++i)
+                wheel.adjust_timer(timers[i]);
+            long long t2 = now_ns();
+            // 转满一圈，所有定时器到期并删除
+            for(int i = 0; i < 128; ++i)
+                wheel.tick();
+            long long t3 = now_ns();
+            if(wheel.size() != 0)
+            {
+                printf("timer wheel not empty: %d\n", wheel.size());
+                exit(1);
+            }
+
+            if(add < 0 || t1 - start < add)
+                add = t1 - start;
+            if(adjust < 0 || t2 - t1 < adjust)
+                adjust = t2 - t1;
+            if(tick < 0 || t3 - t2 < tick)
+                tick = t3 - t2;
+        }
+        report("timer", "add", n, n, add);
+        report("timer", "adjust", n, n, adjust);
+        report("timer", "tick_expire", n, n, tick);
+    }
+}
+
+/* 阻塞队列 */
+static long long queue_round(int pairs, int items)
+{
+    block_queue<int> q(1024);
+    int per = items / pairs;
+    std::vector<std::thread> threads;
+    long long start = now_ns();
+    for(int i = 0; i < pairs; ++i)
+    {
+        threads.emplace_back([&q, per]() {
+            for(int k = 0; k < per; ++k)
+                q.push(k);
+        });
+        threads.emplace_back([&q, per]() {
+            int v;
+            for(int k = 0; k < per; ++k)
+                q.pop(v);
+        });
+    }
+    for(size_t i = 0; i < threads.size(); ++i)
+        threads[i].join();
+    return now_ns() - start;
+}
+
+static void bench_queue()
+{
+    int items = g_quick ? 200000 : 2000000;
+    for(int pairs = 1; pairs <= 32; pairs *= 2)
+    {
+        int total = items / pairs * pairs;
+        long long ns = best_of([&]() { return queue_round(pairs, total); });
+        report("queue", "push_pop", pairs, total, ns);
+    }
+}
+
+/* 日志：同步模式使用主日志实例，异步模式使用访问日志实例 */
+static int m_close_log = 0;
+
+static long long log_round(Log *log, int lines)
+{
+    static const char *format = "bench client(%s) request %d done %lld";
+    static const int id = Log::get_instance()->register_format(LOG_LEVEL_INFO, LOG_MODULE_SERVER, format);
+    static const int access_id = Log::get_access_instance()->register_format(LOG_LEVEL_INFO, LOG_MODULE_SERVER, format);
+    int fid = log == Log::get_instance() ? id : access_id;
+    long long start = now_ns();
+    for(int i = 0; i < lines; ++i)
+        log->write_log(LOG_LEVEL_INFO, fid, format, "127.0.0.1", i, (long long)i * 7);
+    return now_ns() - start;
+}
+
+static void bench_log()
+{
+    int lines = g_quick ? 50000 : 500000;
+    Log *sync_log = Log::get_instance();
+    Log *async_log = Log::get_access_instance();
+    if(!sync_log->init("./MicroBenchSync", 0, 2000, 100000000, 0) ||
+       !async_log->init("./MicroBenchAsync", 0, 2000, 100000000, 800))
+    {
+        printf("open log file failed\n");
+        return;
+    }
+
+    long long ns = best_of([&]() { return log_round(sync_log, lines); });
+    report("log", "sync", 1, lines, ns);
+    long long dropped = async_log->dropped();
+    ns = best_of([&]() { return log_round(async_log, lines); });
+    report("log", "async", 1, lines, ns);
+    if(async_log->dropped() != dropped)
+        printf("{\"suite\":\"log\",\"case\":\"async_dropped\",\"n\":1,\"ops\":%lld,\"ns_per_op\":0,\"mops\":0}\n",
+               async_log->dropped() - dropped);
+
+    // 低于当前级别的调用只有级别判断
+    sync_log->set_level(LOG_LEVEL_WARN);
+    long long start = now_ns();
+    for(int i = 0; i < lines * 10; ++i)
+    {
+        LOG_INFO("bench client(%s) request %d done", "127.0.0.1", i);
+    }
+    report("log", "disabled", 1, lines * 10LL, now_ns() - start);
+}
+
+int main(int argc, char *argv[])
+{
+    std::string suites = "parser,timer,queue,log";
+    int opt;
+    while((opt = getopt(argc, argv, "s:r:q")) != -1)
+    {
+        switch(opt)
+        {
+        case 's': suites = optarg; break;
+        case 'r': g_repeat = atoi(optarg) > 0 ? atoi(optarg) : 1; break;
+        case 'q': g_quick = true; break;
+        default: break;
+        }
+    }
+
+    if(suites.find("parser") != std::string::npos)
+        bench_parser();
+    if(suites.find("timer") != std::string::npos)
+        bench_timer();
+    if(suites.find("queue") != std::string::npos)
+        bench_queue();
+    if(suites.find("log") != std::string::npos)
+        bench_log();
+    return 0;
+}
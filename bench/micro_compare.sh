@@ -0,0 +1,46 @@
+#!/bin/sh
+# 对比两次 micro_bench 的输出，按 suite/case/n 匹配，列出 ns_per_op 的变化
+# 用法: ./bench/micro_compare.sh 旧结果 新结果 [阈值百分比, 默认5]
+# 变慢超过阈值的项标记为 SLOWER，有这样的项时返回1
+
+if [ $# -lt 2 ]; then
+    echo "usage: $0 old.json new.json [threshold%]" >&2
+    exit 2
+fi
+
+awk -v threshold="${3:-5}" '
+function field(line, name,    re, s) {
+    re = "\"" name "\":(\"[^\"]*\"|[-0-9.]+)"
+    if (!match(line, re))
+        return ""
+    s = substr(line, RSTART + length(name) + 3, RLENGTH - length(name) - 3)
+    gsub(/"/, "", s)
+    return s
+}
+/"suite"/ {
+    key = field($0, "suite") "/" field($0, "case") "/" field($0, "n")
+    ns = field($0, "ns_per_op")
+    if (FNR == NR) {
+        old[key] = ns
+    } else if (key in old) {
+        order[++count] = key
+        cur[key] = ns
+    }
+}
+END {
+    slower = 0
+    printf "%-32s %12s %12s %9s\n", "benchmark", "old ns/op", "new ns/op", "change"
+    for (i = 1; i <= count; ++i) {
+        key = order[i]
+        change = old[key] > 0 ? (cur[key] - old[key]) * 100 / old[key] : 0
+        mark = ""
+        if (change > threshold) {
+            mark = "  SLOWER"
+            slower = 1
+        } else if (change < -threshold) {
+            mark = "  faster"
+        }
+        printf "%-32s %12.2f %12.2f %+8.1f%%%s\n", key, old[key], cur[key], change, mark
+    }
+    exit slower
+}' "$1" "$2"
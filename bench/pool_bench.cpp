@@ -0,0 +1,159 @@
+/**
+ *      线程池任务分发延迟测试
+ *   对比 所有工作线程共享一个block_queue的线程池 与 工作窃取线程池
+ *   生产者按固定速率(或全速)提交任务，记录静态任务 提交 -> 工作线程开始处理 的延迟
+ *   -d 指定数据库任务的比例，数据库任务处理时阻塞 -s 微秒，用于观察数据库变慢时静态任务的延迟
+ *
+ *   用法: ./pool_bench [-t 线程数] [-n 任务数] [-r 每秒任务数, 0为全速] [-d 数据库任务百分比] [-s 数据库任务耗时us]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "../threadpool/threadpool.h"
+#include "../log/block_queue.h"
+
+typedef std::chrono::steady_clock bench_clock;
+
+static std::atomic<int> g_done(0);
+static int g_db_us = 2000;
+
+/* 模拟 http_conn 的任务接口 */
+struct bench_task
+{
+    int m_state;
+    int improv;
+    int timer_flag;
+    sockaddr_in m_address;
+    bench_clock::time_point m_enqueue;
+    long long m_enqueue_time;
+    long long m_queue_us;
+    uint64_t m_trace_id;
+    long long m_latency_ns;
+    int m_lane;
+
+    int lane() { return m_lane; }
+    bool read_once() { return true; }
+    bool write() { return true; }
+    sockaddr_in *get_address() { return &m_address; }
+    void process()
+    {
+        m_latency_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock::now() - m_enqueue).count();
+        if(LANE_DB == m_lane)
+            std::this_thread::sleep_for(std::chrono::microseconds(g_db_us));
+        g_done.fetch_add(1, std::memory_order_release);
+    }
+};
+
+/* 共享队列线程池：所有工作线程从同一个block_queue取任务 */
+class legacy_pool
+{
+public:
+    legacy_pool(int thread_number) : m_stop(false)
+    {
+        for(int i = 0; i < thread_number; ++i)
+            m_threads.emplace_back([this] { run(); });
+    }
+    ~legacy_pool()
+    {
+        m_stop = true;
+        m_queue.clear();
+        for(size_t i = 0; i < m_threads.size(); ++i)
+            m_threads[i].join();
+    }
+    bool append_p(bench_task *task)
+    {
+        return m_queue.push(task);
+    }
+
+private:
+    void run()
+    {
+        while(!m_stop)
+        {
+            bench_task *task;
+            if(m_queue.pop(task))
+                task->process();
+        }
+    }
+
+    std::atomic<bool> m_stop;
+    block_queue<bench_task *> m_queue;
+    std::vector<std::thread> m_threads;
+};
+
+template<typename POOL>
+static void run_bench(const char *name, POOL &pool, std::vector<bench_task> &tasks, int rate)
+{
+    g_done.store(0);
+    long long interval_ns = rate > 0 ? 1000000000LL / rate : 0;
+    bench_clock::time_point start = bench_clock::now();
+    bench_clock::time_point next = start;
+
+    for(size_t i = 0; i < tasks.size(); ++i)
+    {
+        if(interval_ns > 0)
+        {
+            next += std::chrono::nanoseconds(interval_ns);
+            while(bench_clock::now() < next)
+                ;
+        }
+        tasks[i].m_enqueue = bench_clock::now();
+        pool.append_p(&tasks[i]);
+    }
+    while(g_done.load(std::memory_order_acquire) < (int)tasks.size())
+        std::this_thread::yield();
+    double secs = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+    std::vector<long long> lat;
+    lat.reserve(tasks.size());
+    for(size_t i = 0; i < tasks.size(); ++i)
+    {
+        if(LANE_STATIC == tasks[i].m_lane)
+            lat.push_back(tasks[i].m_latency_ns);
+    }
+    std::sort(lat.begin(), lat.end());
+    size_t n = lat.size();
+
+    printf("{\"pool\":\"%s\",\"tasks\":%zu,\"rate\":%d,\"throughput\":%.0f,"
+           "\"p50_ns\":%lld,\"p99_ns\":%lld,\"p999_ns\":%lld,\"max_ns\":%lld}\n",
+           name, n, rate, tasks.size() / secs, lat[n / 2], lat[n * 99 / 100], lat[n * 999 / 1000], lat[n - 1]);
+}
+
+int main(int argc, char *argv[])
+{
+    int thread_num = 8, task_num = 200000, rate = 200000, db_percent = 0;
+    int opt;
+    while((opt = getopt(argc, argv, "t:n:r:d:s:")) != -1)
+    {
+        switch(opt)
+        {
+        case 't': thread_num = atoi(optarg); break;
+        case 'n': task_num = atoi(optarg); break;
+        case 'r': rate = atoi(optarg); break;
+        case 'd': db_percent = atoi(optarg); break;
+        case 's': g_db_us = atoi(optarg); break;
+        default: break;
+        }
+    }
+
+    std::vector<bench_task> tasks(task_num);
+    for(int i = 0; i < task_num; ++i)
+        tasks[i].m_lane = i % 100 < db_percent ? LANE_DB : LANE_STATIC;
+    {
+        legacy_pool pool(thread_num);
+        run_bench("block_queue", pool, tasks, rate);
+    }
+    {
+        threadpool<bench_task> pool(0, NULL, thread_num, task_num, 1);
+        run_bench("work_steal", pool, tasks, rate);
+    }
+    return 0;
+}
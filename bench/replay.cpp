@@ -0,0 +1,541 @@
+/**
+ *      流量重放
+ *   读取服务器 -i 录制的流量文件，按连接还原请求流，对本地服务器重新发送并统计延迟
+ *   1. 每个录制连接对应一个重放连接，按录制时的建立时间连接，
+ *      请求按录制中最后一个字节到达的时间发送，一个请求分多次到达时合并为一次发送
+ *   2. -s 倍速：1 为原速，N 为N倍速(时间间隔缩小为1/N)，0 为最快速度：
+ *      最多 -c 个连接同时重放，每个请求在上一个响应到达后立即发送
+ *   3. 同一连接上的请求等上一个响应到达后才发送，延迟从计划发送时间算起，
+ *      服务器变慢造成的等待计入延迟(coordinated omission)；最快速度时从实际发送算起
+ *   4. 连接在还有请求未发送时被关闭或超时，剩余请求计为 lost
+ *   输出一行JSON报告
+ *
+ *   用法: ./replay -f 录制文件 [-a 地址] [-p 端口] [-s 倍速] [-c 最快速度时的并发连接数] [-t 线程数] [-T 超时ms] [-l 报告标签]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <map>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+#include "http_client.h"
+#include "../http/traffic_capture.h"
+
+struct replay_request
+{
+    long long at_us;            // 相对录制开始的发送时间
+    std::string data;
+};
+
+struct replay_conn
+{
+    long long open_us;          // 相对录制开始的建立时间
+    std::vector<replay_request> requests;
+
+    // 重放状态
+    int fd;
+    bool connecting;
+    bool done;
+    size_t next;                // 下一个要发送的请求
+    bool inflight;
+    long long start_us;         // 在途请求的延迟起点
+    long long active_us;
+    std::string out;
+    size_t out_off;
+    std::string in;
+};
+
+struct replay_config
+{
+    sockaddr_in addr;
+    double speed;
+    int concurrency;
+    int timeout_ms;
+};
+
+struct replay_worker
+{
+    std::vector<replay_conn *> conns;
+    latency_hist latency;
+    long long requests;
+    long long errors;
+    long long lost;
+    long long timeouts;
+    long long connect_errors;
+    long long bytes;
+
+    replay_worker() : requests(0), errors(0), lost(0), timeouts(0), connect_errors(0), bytes(0) {}
+};
+
+static replay_config g_cfg;
+
+static bool get_varint(FILE *fp, uint64_t &v)
+{
+    v = 0;
+    for(int shift = 0; shift < 64; shift += 7)
+    {
+        int c = fgetc(fp);
+        if(EOF == c)
+            return false;
+        v |= (uint64_t)(c & 0x7f) << shift;
+        if(!(c & 0x80))
+            return true;
+    }
+    return false;
+}
+
+// 请求在 buf 中的长度，不完整返回0
+static size_t request_length(const std::string &buf, size_t pos)
+{
+    size_t end = buf.find("\r\n\r\n", pos);
+    if(std::string::npos == end)
+        return 0;
+    size_t length = 0;
+    for(size_t line = buf.find("\r\n", pos); line < end; line = buf.find("\r\n", line + 2))
+    {
+        if(0 == strncasecmp(buf.c_str() + line + 2, "Content-length:", 15))
+            length = atol(buf.c_str() + line + 17);
+    }
+    size_t total = end + 4 + length - pos;
+    return buf.size() - pos >= total ? total : 0;
+}
+
+// 读取录制文件并按连接切分请求，incomplete 为录制结束时未收完的请求数
+static bool load_capture(const char *path, std::vector<replay_conn *> &conns, long long &incomplete)
+{
+    FILE *fp = fopen(path, "rb");
+    if(!fp)
+        return false;
+    char magic[CAPTURE_MAGIC_LEN];
+    uint64_t wall;
+    if(fread(magic, 1, sizeof(magic), fp) != sizeof(magic) || memcmp(magic, CAPTURE_MAGIC, CAPTURE_MAGIC_LEN) != 0 ||
+       fgetc(fp) != traffic_capture::VERSION || !get_varint(fp, wall))
+    {
+        fclose(fp);
+        return false;
+    }
+
+    struct pending
+    {
+        replay_conn *conn;
+        std::string buf;        // 还未切分出完整请求的数据
+    };
+    std::map<uint64_t, pending> open;
+    long long now = 0;
+    int type;
+    while((type = fgetc(fp)) != EOF)
+    {
+        uint64_t id, delta, len = 0;
+        if(!get_varint(fp, id) || !get_varint(fp, delta))
+            break;
+        now += delta;
+        if(traffic_capture::RECORD_OPEN == type)
+        {
+            replay_conn *c = new replay_conn;
+            c->open_us = now;
+            conns.push_back(c);
+            open[id].conn = c;
+            open[id].buf.clear();
+        }
+        else if(traffic_capture::RECORD_DATA == type)
+        {
+            if(!get_varint(fp, len))
+                break;
+            std::string data(len, '\0');
+            if(fread(&data[0], 1, len, fp) != len)
+                break;
+            std::map<uint64_t, pending>::iterator it = open.find(id);
+            if(it == open.end())
+                continue;
+            pending &p = it->second;
+            p.buf += data;
+            size_t n;
+            while((n = request_length(p.buf, 0)) > 0)
+            {
+                replay_request r;
+                r.at_us = now;
+                r.data = p.buf.substr(0, n);
+                p.conn->requests.push_back(r);
+                p.buf.erase(0, n);
+            }
+        }
+        else if(traffic_capture::RECORD_CLOSE == type)
+        {
+            std::map<uint64_t, pending>::iterator it = open.find(id);
+            if(it != open.end())
+            {
+                incomplete += it->second.buf.empty() ? 0 : 1;
+                open.erase(it);
+            }
+        }
+        else
+        {
+            break;
+        }
+    }
+    for(std::map<uint64_t, pending>::iterator it = open.begin(); it != open.end(); ++it)
+        incomplete += it->second.buf.empty() ? 0 : 1;
+    fclose(fp);
+    return true;
+}
+
+static bool connect_conn(int epollfd, replay_conn &c)
+{
+    c.fd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if(c.fd < 0)
+        return false;
+    int flag = 1;
+    setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    if(connect(c.fd, (sockaddr *)&g_cfg.addr, sizeof(g_cfg.addr)) < 0 && errno != EINPROGRESS)
+    {
+        close(c.fd);
+        c.fd = -1;
+        return false;
+    }
+    c.connecting = true;
+    c.active_us = now_us();
+    epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP;
+    ev.data.ptr = &c;
+    epoll_ctl(epollfd, EPOLL_CTL_ADD, c.fd, &ev);
+    return true;
+}
+
+static void finish_conn(int epollfd, replay_worker &w, replay_conn &c, long long &reason)
+{
+    if(c.fd >= 0)
+    {
+        epoll_ctl(epollfd, EPOLL_CTL_DEL, c.fd, 0);
+        close(c.fd);
+        c.fd = -1;
+    }
+    if(c.inflight || c.next < c.requests.size())
+    {
+        reason += c.inflight ? 1 : 0;
+        w.lost += c.requests.size() - c.next;
+    }
+    c.inflight = false;
+    c.done = true;
+}
+
+static void flush_out(replay_conn &c)
+{
+    while(c.out_off < c.out.size())
+    {
+        ssize_t n = send(c.fd, c.out.data() + c.out_off, c.out.size() - c.out_off, MSG_NOSIGNAL);
+        if(n <= 0)
+            break;
+        c.out_off += n;
+    }
+    if(c.out_off == c.out.size())
+    {
+        c.out.clear();
+        c.out_off = 0;
+    }
+}
+
+static void run_worker(replay_worker *w)
+{
+    typedef std::pair<long long, replay_conn *> event;
+    std::priority_queue<event, std::vector<event>, std::greater<event> > timers;     // 待建立的连接与待发送的请求
+    bool fastest = g_cfg.speed <= 0;
+    int epollfd = epoll_create(5);
+    int timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    epoll_event tev;
+    tev.events = EPOLLIN;
+    tev.data.ptr = NULL;
+    epoll_ctl(epollfd, EPOLL_CTL_ADD, timerfd, &tev);
+
+    long long t0 = now_us();
+    size_t next_open = 0, live = 0, finished = 0;
+    // 录制时间换算为重放时间
+    auto scaled = [&](long long at) { return fastest ? t0 : t0 + (long long)(at / g_cfg.speed); };
+
+    // 连接建立后或收到响应后安排下一个请求，时间未到时放入定时器
+    auto schedule = [&](replay_conn &c, long long now) {
+        if(c.next >= c.requests.size())
+        {
+            finish_conn(epollfd, *w, c, w->errors);
+            --live;
+            ++finished;
+            return;
+        }
+        long long at = scaled(c.requests[c.next].at_us);
+        if(at > now)
+        {
+            timers.push(event(at, &c));
+            return;
+        }
+        c.start_us = fastest ? now : at;
+        c.out += c.requests[c.next].data;
+        ++c.next;
+        c.inflight = true;
+        c.active_us = now;
+        flush_out(c);
+    };
+
+    epoll_event events[256];
+    long long last_check = t0;
+    while(finished < w->conns.size())
+    {
+        long long now = now_us();
+        // 按时间建立连接，最快速度时限制并发数
+        while(next_open < w->conns.size() && (fastest ? (int)live < g_cfg.concurrency : scaled(w->conns[next_open]->open_us) <= now))
+        {
+            replay_conn &c = *w->conns[next_open++];
+            ++live;
+            if(!connect_conn(epollfd, c))
+            {
+                ++w->connect_errors;
+                finish_conn(epollfd, *w, c, w->errors);
+                --live;
+                ++finished;
+            }
+        }
+        while(!timers.empty() && timers.top().first <= now)
+        {
+            replay_conn &c = *timers.top().second;
+            timers.pop();
+            if(!c.done)
+                schedule(c, now);
+        }
+
+        long long wake = timers.empty() ? -1 : timers.top().first;
+        if(!fastest && next_open < w->conns.size())
+        {
+            long long at = scaled(w->conns[next_open]->open_us);
+            wake = wake < 0 ? at : std::min(wake, at);
+        }
+        int timeout = 10;
+        if(wake >= 0 && wake <= now_us())
+            timeout = 0;
+        else if(wake > now)
+        {
+            struct itimerspec its;
+            memset(&its, 0, sizeof(its));
+            clock_gettime(CLOCK_MONOTONIC, &its.it_value);
+            long long ns = its.it_value.tv_nsec + (wake - now) * 1000;
+            its.it_value.tv_sec += ns / 1000000000;
+            its.it_value.tv_nsec = ns % 1000000000;
+            timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+        }
+
+        int n = epoll_wait(epollfd, events, 256, timeout);
+        now = now_us();
+        for(int i = 0; i < n; ++i)
+        {
+            if(NULL == events[i].data.ptr)
+            {
+                uint64_t expirations;
+                ssize_t r = read(timerfd, &expirations, sizeof(expirations));
+                (void)r;
+                continue;
+            }
+            replay_conn &c = *(replay_conn *)events[i].data.ptr;
+            if(c.fd < 0)
+                continue;
+            if(c.connecting && (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+            {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                if(err)
+                {
+                    ++w->connect_errors;
+                    finish_conn(epollfd, *w, c, w->errors);
+                    --live;
+                    ++finished;
+                    continue;
+                }
+                c.connecting = false;
+                epoll_event ev;
+                ev.events = EPOLLIN | EPOLLRDHUP;
+                ev.data.ptr = &c;
+                epoll_ctl(epollfd, EPOLL_CTL_MOD, c.fd, &ev);
+                schedule(c, now);
+                if(c.done)
+                    continue;
+            }
+
+            bool alive = true;
+            if(events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            {
+                char buf[16384];
+                while(true)
+                {
+                    ssize_t r = recv(c.fd, buf, sizeof(buf), 0);
+                    if(r > 0)
+                    {
+                        c.in.append(buf, r);
+                        continue;
+                    }
+                    if(0 == r || (errno != EAGAIN && errno != EWOULDBLOCK))
+                        alive = false;
+                    break;
+                }
+                c.active_us = now;
+                size_t total;
+                int status;
+                if(c.inflight && (status = parse_response(c.in, 0, total)) >= 0)
+                {
+                    w->latency.record(now - c.start_us);
+                    ++w->requests;
+                    w->bytes += total;
+                    if(status < 200 || status >= 400)
+                        ++w->errors;
+                    c.in.erase(0, total);
+                    c.inflight = false;
+                    // 服务器关闭了连接但后面还有请求时，剩余请求计为丢失
+                    if(alive || c.next >= c.requests.size())
+                    {
+                        schedule(c, now);
+                        continue;
+                    }
+                }
+            }
+            if(!alive)
+            {
+                finish_conn(epollfd, *w, c, w->errors);
+                --live;
+                ++finished;
+            }
+            else if(!c.out.empty())
+            {
+                flush_out(c);
+            }
+        }
+
+        if(now - last_check >= 10000)
+        {
+            last_check = now;
+            for(size_t i = 0; i < next_open; ++i)
+            {
+                replay_conn &c = *w->conns[i];
+                if(!c.done && (c.inflight || c.connecting) && now - c.active_us >= g_cfg.timeout_ms * 1000LL)
+                {
+                    finish_conn(epollfd, *w, c, w->timeouts);
+                    --live;
+                    ++finished;
+                }
+            }
+        }
+    }
+    close(timerfd);
+    close(epollfd);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *file = NULL;
+    const char *host = "127.0.0.1";
+    const char *label = "";
+    int port = 9006;
+    int threads = 1;
+    g_cfg.speed = 1;
+    g_cfg.concurrency = 64;
+    g_cfg.timeout_ms = 5000;
+    int opt;
+    while((opt = getopt(argc, argv, "f:a:p:s:c:t:T:l:")) != -1)
+    {
+        switch(opt)
+        {
+        case 'f': file = optarg; break;
+        case 'a': host = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 's': g_cfg.speed = atof(optarg); break;
+        case 'c': g_cfg.concurrency = atoi(optarg) > 0 ? atoi(optarg) : 1; break;
+        case 't': threads = atoi(optarg) > 0 ? atoi(optarg) : 1; break;
+        case 'T': g_cfg.timeout_ms = atoi(optarg); break;
+        case 'l': label = optarg; break;
+        default: break;
+        }
+    }
+    if(!file)
+    {
+        printf("usage: %s -f capture_file [-a host] [-p port] [-s speed] [-c concurrency] [-t threads] [-T timeout_ms] [-l label]\n", argv[0]);
+        return 1;
+    }
+
+    bzero(&g_cfg.addr, sizeof(g_cfg.addr));
+    g_cfg.addr.sin_family = AF_INET;
+    g_cfg.addr.sin_port = htons(port);
+    if(inet_pton(AF_INET, host, &g_cfg.addr.sin_addr) != 1)
+    {
+        printf("bad address: %s\n", host);
+        return 1;
+    }
+
+    std::vector<replay_conn *> conns;
+    long long incomplete = 0;
+    if(!load_capture(file, conns, incomplete))
+    {
+        printf("bad capture file: %s\n", file);
+        return 1;
+    }
+    long long captured = 0, span = 0;
+    for(size_t i = 0; i < conns.size(); ++i)
+    {
+        replay_conn *c = conns[i];
+        c->fd = -1;
+        c->connecting = false;
+        c->done = false;
+        c->next = 0;
+        c->inflight = false;
+        c->out_off = 0;
+        captured += c->requests.size();
+        if(!c->requests.empty())
+            span = std::max(span, c->requests.back().at_us);
+    }
+
+    // 连接按建立顺序轮流分给各线程，每个线程内仍按时间顺序
+    std::vector<replay_worker> workers(threads);
+    for(size_t i = 0; i < conns.size(); ++i)
+        workers[i % threads].conns.push_back(conns[i]);
+    if(g_cfg.concurrency < threads)
+        g_cfg.concurrency = threads;
+    g_cfg.concurrency /= threads;
+
+    long long start = now_us();
+    std::vector<std::thread> pool;
+    for(int i = 0; i < threads; ++i)
+        pool.emplace_back(run_worker, &workers[i]);
+    for(size_t i = 0; i < pool.size(); ++i)
+        pool[i].join();
+    double secs = (now_us() - start) / 1e6;
+
+    replay_worker sum;
+    for(size_t i = 0; i < workers.size(); ++i)
+    {
+        sum.latency.merge(workers[i].latency);
+        sum.requests += workers[i].requests;
+        sum.errors += workers[i].errors;
+        sum.lost += workers[i].lost;
+        sum.timeouts += workers[i].timeouts;
+        sum.connect_errors += workers[i].connect_errors;
+        sum.bytes += workers[i].bytes;
+    }
+
+    printf("{\"label\":\"%s\",\"file\":\"%s\",\"speed\":%g,\"connections\":%zu,\"captured_requests\":%lld,"
+           "\"incomplete\":%lld,\"captured_seconds\":%.2f,\"seconds\":%.2f,\"requests\":%lld,\"rps\":%.1f,"
+           "\"errors\":%lld,\"timeouts\":%lld,\"lost\":%lld,\"connect_errors\":%lld,\"bytes\":%lld,",
+           label, file, g_cfg.speed, conns.size(), captured, incomplete, span / 1e6, secs, sum.requests,
+           sum.requests / secs, sum.errors, sum.timeouts, sum.lost, sum.connect_errors, sum.bytes);
+    sum.latency.print_json();
+    printf("}\n");
+
+    for(size_t i = 0; i < conns.size(); ++i)
+        delete conns[i];
+    return 0;
+}
@@ -0,0 +1,30 @@
+#!/bin/sh
+# 依次以 TRIGMode 0-3 x actor_model 0-1 启动服务器并用 http_load 压测，输出 JSON 数组
+# 在仓库根目录运行，参数原样传给 http_load，例如: ./bench/sweep.sh -c 100 -d 5 -m static:8,login:1,register:1
+# 环境变量 PORT 指定端口(默认9180)，SERVER_ARGS 指定服务器的其他参数(默认使用KV存储并关闭日志)
+
+PORT=${PORT:-9180}
+SERVER_ARGS=${SERVER_ARGS:-"-k 1 -c 1"}
+
+if [ ! -x ./server ] || [ ! -x ./http_load ]; then
+    echo "run 'make bench' first" >&2
+    exit 1
+fi
+
+echo "["
+first=1
+for trig in 0 1 2 3; do
+    for actor in 0 1; do
+        ./server -p "$PORT" -m "$trig" -a "$actor" $SERVER_ARGS > /dev/null 2>&1 &
+        pid=$!
+        sleep 1
+        out=$(./http_load -p "$PORT" -l "trig=$trig,actor=$actor" "$@")
+        kill "$pid" 2> /dev/null
+        wait "$pid" 2> /dev/null
+        [ $first -eq 1 ] || echo ","
+        first=0
+        printf "%s" "$out"
+    done
+done
+echo
+echo "]"
@@ -26,17 +26,67 @@ Config::Config()
     //线程池内的线程数量,默认8
     thread_num = 8;
 
+    //线程池最大线程数量,默认0,即不扩容
+    max_thread_num = 0;
+
     //关闭日志,默认不关闭
     close_log = 0;
 
     //并发模型,默认是proactor
     actor_model = 0;
+
+    //用户存储后端,默认MySQL, 1 为嵌入式KV存储
+    store_mode = 0;
+
+    //CPU绑定,默认不绑定,格式如 "0-3,8"
+    reactor_cpus = "";
+    worker_cpus = "";
+
+    //网卡名,默认不按中断放置工作线程
+    nic_name = "";
+
+    //性能计数模式,默认关闭,开启时退出前输出CPU迁移与缓存未命中统计
+    perf_mode = 0;
+
+    //日志级别,默认info,可按模块设置,如 "warn,http=error,sql=info"
+    log_level = "info";
+
+    //日志格式,默认0文本,1二进制,用 log_decode 还原
+    log_format = 0;
+
+    //切分下来的日志文件的gzip压缩级别,默认1,0不压缩
+    log_compress = 1;
+
+    //日志文件保留的总大小(MB)与天数,默认0不限制
+    log_keep_mb = 0;
+    log_keep_days = 0;
+
+    //访问日志采样间隔,默认每100个请求记录一个,0只记录错误与慢请求
+    access_sample = 100;
+
+    //慢请求阈值(ms),默认100,慢请求总是记录
+    access_slow_ms = 100;
+
+    //同一路径与状态码的访问日志每个线程每秒最多记录条数,默认10,0不限流
+    access_rate = 10;
+
+    //流量录制文件,默认不录制,录制的流量用 bench/replay 重放
+    capture_file = "";
+
+    //请求追踪抽样间隔,默认0关闭,N为平均每N个请求随机追踪一个,记录用 /trace 导出
+    trace_interval = 0;
+
+    //追踪的请求超过该耗时(ms)时写入 TraceSlow.json,默认100,0不写入
+    trace_slow_ms = 100;
+
+    //静态文件的 Cache-Control max-age(秒),默认3600,0为每次都需用 ETag/Last-Modified 验证
+    cache_max_age = 3600;
 }
 
 void Config::parse_arg(int argc, char*argv[])
 {
     int opt;
-    const char *str = "p:l:m:o:s:t:c:a:";
+    const char *str = "p:l:m:o:s:t:x:c:a:k:r:w:n:b:v:f:z:g:e:u:y:j:i:q:d:h:";
     while ( (opt = getopt(argc, argv, str)) != -1 )
     {
         switch (opt)
@@ -71,6 +121,11 @@ void Config::parse_arg(int argc, char*argv[])
             thread_num = atoi(optarg);
             break;
         }
+        case 'x':
+        {
+            max_thread_num = atoi(optarg);
+            break;
+        }
         case 'c':
         {
             close_log = atoi(optarg);
@@ -81,6 +136,91 @@ void Config::parse_arg(int argc, char*argv[])
             actor_model = atoi(optarg);
             break;
         }
+        case 'k':
+        {
+            store_mode = atoi(optarg);
+            break;
+        }
+        case 'r':
+        {
+            reactor_cpus = optarg;
+            break;
+        }
+        case 'w':
+        {
+            worker_cpus = optarg;
+            break;
+        }
+        case 'n':
+        {
+            nic_name = optarg;
+            break;
+        }
+        case 'b':
+        {
+            perf_mode = atoi(optarg);
+            break;
+        }
+        case 'v':
+        {
+            log_level = optarg;
+            break;
+        }
+        case 'f':
+        {
+            log_format = atoi(optarg);
+            break;
+        }
+        case 'z':
+        {
+            log_compress = atoi(optarg);
+            break;
+        }
+        case 'g':
+        {
+            log_keep_mb = atoi(optarg);
+            break;
+        }
+        case 'e':
+        {
+            log_keep_days = atoi(optarg);
+            break;
+        }
+        case 'u':
+        {
+            access_sample = atoi(optarg);
+            break;
+        }
+        case 'y':
+        {
+            access_slow_ms = atoi(optarg);
+            break;
+        }
+        case 'j':
+        {
+            access_rate = atoi(optarg);
+            break;
+        }
+        case 'i':
+        {
+            capture_file = optarg;
+            break;
+        }
+        case 'q':
+        {
+            trace_interval = atoi(optarg);
+            break;
+        }
+        case 'd':
+        {
+            trace_slow_ms = atoi(optarg);
+            break;
+        }
+        case 'h':
+        {
+            cache_max_age = atoi(optarg);
+            break;
+        }
         default:
             break;
         }
@@ -37,11 +37,57 @@ public:
     //线程池内的线程数量
     int thread_num;
 
+    //线程池可扩容到的最大线程数量
+    int max_thread_num;
+
     //是否关闭日志
     int close_log;
 
     //并发模型选择
     int actor_model;
+
+    //用户存储后端
+    int store_mode;
+
+    //事件循环线程绑定的CPU列表
+    string reactor_cpus;
+
+    //工作线程绑定的CPU列表
+    string worker_cpus;
+
+    //按该网卡接收队列中断的CPU放置工作线程
+    string nic_name;
+
+    //性能计数模式
+    int perf_mode;
+
+    //日志级别
+    string log_level;
+
+    //日志格式
+    int log_format;
+
+    //日志压缩级别
+    int log_compress;
+
+    //日志保留的总大小(MB)与天数
+    int log_keep_mb;
+    int log_keep_days;
+
+    //访问日志采样间隔、慢请求阈值(ms)与限流速率
+    int access_sample;
+    int access_slow_ms;
+    int access_rate;
+
+    //流量录制文件
+    string capture_file;
+
+    //请求追踪抽样间隔与慢请求阈值(ms)
+    int trace_interval;
+    int trace_slow_ms;
+
+    //静态文件的缓存有效期(秒)
+    int cache_max_age;
 };
 
 #endif
@@ -0,0 +1,162 @@
+#include "file_cache.h"
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef USE_BROTLI
+#include <brotli/encode.h>
+#endif
+
+static long long now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+std::shared_ptr<file_cache::entry> file_cache::find(const char *url, size_t len)
+{
+    std::shared_ptr<entry> f;
+    std::string key(url, len);
+    m_lock.lock();
+    std::unordered_map<std::string, std::shared_ptr<entry>>::iterator it = m_entries.find(key);
+    if(it != m_entries.end())
+        f = it->second;
+    m_lock.unlock();
+
+    if(f && now_us() - f->checked.load(std::memory_order_relaxed) >= CHECK_INTERVAL_US)
+        f.reset();
+    return f;
+}
+
+// 读取不早于原文件的预压缩文件
+static bool read_sidecar(const char *path, const char *suffix, const struct stat &orig, std::string &out)
+{
+    std::string name = std::string(path) + suffix;
+    struct stat st;
+    if(stat(name.c_str(), &st) < 0 || !S_ISREG(st.st_mode) || st.st_mtime < orig.st_mtime ||
+       st.st_size <= 0 || st.st_size > file_cache::MAX_FILE_SIZE)
+        return false;
+    int fd = open(name.c_str(), O_RDONLY);
+    if(fd < 0)
+        return false;
+    out.resize(st.st_size);
+    ssize_t n = read(fd, &out[0], st.st_size);
+    close(fd);
+    if(n != st.st_size)
+        out.clear();
+    return !out.empty();
+}
+
+static bool gzip_compress(const char *data, size_t len, std::string &out)
+{
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    // windowBits 加16输出gzip格式
+    if(deflateInit2(&zs, 6, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+    out.resize(deflateBound(&zs, len));
+    zs.next_in = (Bytef *)data;
+    zs.avail_in = len;
+    zs.next_out = (Bytef *)&out[0];
+    zs.avail_out = out.size();
+    int ret = deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    return Z_STREAM_END == ret;
+}
+
+#ifdef USE_BROTLI
+static bool brotli_compress(const char *data, size_t len, std::string &out)
+{
+    size_t size = BrotliEncoderMaxCompressedSize(len);
+    if(0 == size)
+        return false;
+    out.resize(size);
+    if(!BrotliEncoderCompress(9, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, len, (const uint8_t *)data,
+                              &size, (uint8_t *)&out[0]))
+        return false;
+    out.resize(size);
+    return true;
+}
+#endif
+
+std::shared_ptr<file_cache::entry> file_cache::touch(const char *url, const struct stat &st)
+{
+    std::shared_ptr<entry> f;
+    std::string key(url);
+    m_lock.lock();
+    std::unordered_map<std::string, std::shared_ptr<entry>>::iterator it = m_entries.find(key);
+    if(it != m_entries.end() && it->second->mtime == st.st_mtime && it->second->ino == st.st_ino &&
+       (off_t)it->second->data.size() == st.st_size)
+    {
+        f = it->second;
+        f->checked.store(now_us(), std::memory_order_relaxed);
+    }
+    m_lock.unlock();
+    return f;
+}
+
+void file_cache::put(const char *url, const char *path, const struct stat &st, const char *data, const char *type, bool compress)
+{
+    if(st.st_size <= 0 || st.st_size > MAX_FILE_SIZE)
+        return;
+
+    if(touch(url, st))
+        return;
+    std::string key(url);
+
+    // 放不下时不复制也不压缩，按替换旧条目后的大小估计
+    m_lock.lock();
+    std::unordered_map<std::string, std::shared_ptr<entry>>::iterator it = m_entries.find(key);
+    size_t old = it != m_entries.end() ? it->second->bytes() : 0;
+    bool full = m_total - old + st.st_size > MAX_TOTAL_SIZE;
+    m_lock.unlock();
+    if(full)
+        return;
+
+    // 在锁外复制文件内容，避免阻塞事件循环的查找
+    std::shared_ptr<entry> f(new entry);
+    f->data.assign(data, st.st_size);
+    f->mtime = st.st_mtime;
+    f->ino = st.st_ino;
+    f->type = type;
+    f->vary = compress;
+    f->checked.store(now_us());
+
+    // 压缩在工作线程中完成，条目发布后不再修改
+    if(compress && st.st_size >= MIN_COMPRESS_SIZE)
+    {
+        std::string &gz = f->encoded[ENCODING_GZIP];
+        if(!read_sidecar(path, ".gz", st, gz) && !gzip_compress(data, st.st_size, gz))
+            gz.clear();
+        std::string &br = f->encoded[ENCODING_BR];
+        if(!read_sidecar(path, ".br", st, br))
+        {
+#ifdef USE_BROTLI
+            if(!brotli_compress(data, st.st_size, br))
+                br.clear();
+#endif
+        }
+        for(int i = ENCODING_GZIP; i < ENCODING_NUM; ++i)
+        {
+            if(f->encoded[i].size() >= (size_t)st.st_size)
+                std::string().swap(f->encoded[i]);
+        }
+    }
+
+    m_lock.lock();
+    // 文件已变化时替换旧条目，旧内容由正在发送的连接持有，发送完后释放
+    it = m_entries.find(key);
+    if(it != m_entries.end())
+    {
+        m_total -= it->second->bytes();
+        m_entries.erase(it);
+    }
+    if(m_total + f->bytes() <= MAX_TOTAL_SIZE)
+    {
+        m_entries[key] = f;
+        m_total += f->bytes();
+    }
+    m_lock.unlock();
+}
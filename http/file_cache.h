@@ -0,0 +1,75 @@
+#ifndef _FILE_CACHE_H
+#define _FILE_CACHE_H
+
+/**
+ *      静态文件缓存
+ *   以请求行中的url为键缓存小文件内容，供事件循环直接写回，不经过线程池
+ *   工作线程正常处理GET请求时写入或刷新缓存；超过 CHECK_INTERVAL_US 未刷新的条目视为未命中，
+ *   由工作线程重新stat确认，事件循环上不做磁盘I/O
+ *   可压缩类型的条目同时保存 gzip 与 br 编码的内容，在工作线程写入时生成并随条目复用：
+ *   优先读取不早于原文件的 .gz/.br 预压缩文件，没有时即时压缩(br 需以 BROTLI=1 编译)，
+ *   压缩后不变小的编码不保存
+*/
+
+#include <sys/stat.h>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <unordered_map>
+#include <time.h>
+#include "../lock/locker.h"
+
+enum CONTENT_ENCODING
+{
+    ENCODING_IDENTITY = 0,
+    ENCODING_GZIP,
+    ENCODING_BR,
+    ENCODING_NUM
+};
+
+class file_cache
+{
+public:
+    struct entry
+    {
+        std::string data;                   // 文件内容
+        std::string encoded[ENCODING_NUM];  // 各编码的内容，空表示没有，[ENCODING_IDENTITY] 不使用
+        const char *type;                   // Content-Type，字符串常量
+        bool vary;                          // 可压缩类型，响应带 Vary: Accept-Encoding
+        time_t mtime;                       // 文件修改时间
+        ino_t ino;                          // 文件inode，与大小、修改时间一起生成ETag
+        std::atomic<long long> checked;     // 上次确认文件未变化的时间(us)
+
+        entry() : type(NULL), vary(false), mtime(0), ino(0), checked(0) {}
+        size_t bytes() const { return data.size() + encoded[ENCODING_GZIP].size() + encoded[ENCODING_BR].size(); }
+    };
+
+    static const off_t MAX_FILE_SIZE = 64 * 1024;           // 超过该大小的文件不缓存
+    static const size_t MAX_TOTAL_SIZE = 32 * 1024 * 1024;  // 缓存总大小上限
+    static const long long CHECK_INTERVAL_US = 1000000;     // 条目有效期
+    static const off_t MIN_COMPRESS_SIZE = 256;             // 小于该大小的文件不压缩
+
+    static file_cache *get_instance()
+    {
+        static file_cache instance;
+        return &instance;
+    }
+
+    // 命中且在有效期内返回条目，否则返回空
+    std::shared_ptr<entry> find(const char *url, size_t len);
+    // 工作线程读入文件后调用，文件未变化时只刷新确认时间
+    // path 为文件路径，用于查找预压缩文件；compress 为true时生成压缩编码
+    void put(const char *url, const char *path, const struct stat &st, const char *data, const char *type, bool compress);
+    // 条目与 st 描述的文件一致时刷新确认时间并返回条目，有效期已过也可使用，否则返回空
+    // 工作线程 stat 后调用，缓存条目仍可用时不需要重新读入文件
+    std::shared_ptr<entry> touch(const char *url, const struct stat &st);
+
+private:
+    file_cache() : m_total(0), m_lock("file_cache") {}
+
+    std::unordered_map<std::string, std::shared_ptr<entry>> m_entries;
+    size_t m_total;             // 已缓存的文件总大小
+    locker m_lock;
+};
+
+#endif
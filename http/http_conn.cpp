@@ -4,6 +4,42 @@
 
 /* 定义http响应的一些状态信息 */
 const char *ok_200_title = "OK";
+const char *partial_206_title = "Partial Content";
+const char *not_modified_304_title = "Not Modified";
+const char *error_416_title = "Range Not Satisfiable";
+const char *byteranges_boundary = "webserver-byteranges-7d3f9a61c2e4";
+const char *encoding_name[] = { "identity", "gzip", "br" };
+const char *encoding_suffix[] = { "", ".gz", ".br" };
+
+//扩展名与 Content-Type，compress 表示可压缩的文本类型
+static const struct
+{
+    const char *ext;
+    const char *type;
+    bool compress;
+} mime_types[] = {
+    { "html", "text/html; charset=utf-8", true },
+    { "htm", "text/html; charset=utf-8", true },
+    { "css", "text/css", true },
+    { "js", "application/javascript", true },
+    { "json", "application/json", true },
+    { "txt", "text/plain; charset=utf-8", true },
+    { "md", "text/plain; charset=utf-8", true },
+    { "xml", "application/xml", true },
+    { "svg", "image/svg+xml", true },
+    { "ico", "image/x-icon", true },
+    { "jpg", "image/jpeg", false },
+    { "jpeg", "image/jpeg", false },
+    { "png", "image/png", false },
+    { "gif", "image/gif", false },
+    { "webp", "image/webp", false },
+    { "mp4", "video/mp4", false },
+    { "webm", "video/webm", false },
+    { "mp3", "audio/mpeg", false },
+    { "pdf", "application/pdf", false },
+    { "woff2", "font/woff2", false },
+    { "wasm", "application/wasm", true },
+};
 const char *error_400_title = "Bad Request";
 const char *error_400_form = "Your request has bad syntax or is inherently impossible to staisfy.\n";
 const char *error_403_title = "Forbidden";
@@ -13,37 +49,11 @@ const char *error_404_form = "The requested file was not found on this server.\n
 const char *error_500_title = "Internal Error";
 const char *error_500_form = "There was an unusual problem serving the request file.\n";
 
-locker m_lock;
-std::map<std::string, std::string> users;
-
-void http_conn::initmysql_result(sqlconnection_pool *connpool)
+static long long now_us()
 {
-    // 取出一个数据库连接
-    MYSQL *mysql = NULL;
-    sqlconnectionRAII mysqlconn(&mysql, connpool);
-
-    // 在user表中检索username, passwd数据， 浏览器端输入
-    if(mysql_query(mysql, "SELECT username,passwd FROM user"))
-    {
-        LOG_ERROR("SELECT error:%s\n", mysql_error(mysql));
-    }
-
-    // 从表中检索完整结果集
-    MYSQL_RES *result = mysql_store_result(mysql);
-
-    // 返回结果集列数
-    int num_fields = mysql_num_fields(result);
-
-    //返回所有字段结构的数组
-    MYSQL_FIELD *fields = mysql_fetch_fields(result);
-
-    //从结果集中获取下一行，将对应的用户名和密码，存入map中
-    while (MYSQL_ROW row = mysql_fetch_row(result))
-    {
-        std::string temp1(row[0]);
-        std::string temp2(row[1]);
-        users[temp1] = temp2;
-    }
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
 }
 
 //对文件描述符设置非阻塞
@@ -93,8 +103,10 @@ void modfd(int epollfd, int fd, int ev, int TRIGMode)
     epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event);
 }
 
-int http_conn::m_user_count = 0;
+std::atomic<int> http_conn::m_user_count(0);
 int http_conn::m_epollfd = -1;
+user_store *http_conn::m_store = NULL;
+int http_conn::m_max_age = 3600;
 
 //关闭连接， 关闭一个连接，用户数减1
 void http_conn::close_conn(bool real_close)
@@ -105,6 +117,14 @@ void http_conn::close_conn(bool real_close)
         removefd(m_epollfd, m_sockfd);
         m_sockfd = -1;
         m_user_count--;
+        traffic_capture::get_instance()->close_conn(m_capture_id);
+        m_capture_id = 0;
+    }
+    //发送中途关闭连接时 unmap 不会被调用
+    if(m_file_fd >= 0)
+    {
+        close(m_file_fd);
+        m_file_fd = -1;
     }
 }
 
@@ -117,6 +137,7 @@ void http_conn::init(int sockfd, const sockaddr_in &addr, char *root, int TRIGMo
 
     addfd(m_epollfd, sockfd, true, m_TRIGMode);
     m_user_count++;
+    m_capture_id = traffic_capture::get_instance()->open_conn();
 
     //当浏览器出现连接重置时，可能是网站根目录出错或http响应格式出错或者访问的文件中内容完全为空
     doc_root = root;
@@ -134,7 +155,6 @@ void http_conn::init(int sockfd, const sockaddr_in &addr, char *root, int TRIGMo
 //check_state默认为分析请求行状态
 void http_conn::init()
 {
-    mysql = NULL;
     bytes_to_send = 0;
     bytes_have_send = 0;
     m_check_state = CHECK_STATE_REQUESTLINE;
@@ -144,18 +164,53 @@ void http_conn::init()
     m_version = 0;
     m_content_length = 0;
     m_host = 0;
+    m_if_none_match = 0;
+    m_if_modified_since = 0;
+    m_range = 0;
+    m_if_range = 0;
+    m_accept_encoding = 0;
+    m_content_type = NULL;
+    m_vary = false;
+    m_encoding = ENCODING_IDENTITY;
+    m_range_count = 0;
+    m_seg_count = 0;
+    m_seg_idx = 0;
+    if(m_file_fd >= 0)
+    {
+        close(m_file_fd);
+        m_file_fd = -1;
+    }
     m_start_line = 0;
     m_checked_idx = 0;
     m_read_idx = 0;
     m_write_idx = 0;
     cgi = 0;
     m_state = 0;
+    m_status = 0;
+    m_start_us = 0;
+    m_queue_us = 0;
+    memset(m_stage_us, 0, sizeof(m_stage_us));
+    m_eagain = 0;
+    m_alloc.count = 0;
+    m_alloc.bytes = 0;
+    m_trace_id = 0;
+    if(m_cached)
+    {
+        m_cached.reset();
+        m_file_address = 0;
+    }
+    if(!m_dynamic.empty())
+    {
+        m_dynamic.clear();
+        m_file_address = 0;
+    }
     timer_flag = 0;
     improv = 0;
 
     memset(m_read_buf, '\0', READ_BUFFER_SIZE);
     memset(m_write_buf, '\0', WRITE_BUFFER_SIZE);
     memset(m_real_file, '\0', FILENAME_LEN);
+    m_cache_key[0] = '\0';
 }
 
 //从状态机，用于分析出一行内容
@@ -192,6 +247,25 @@ http_conn::LINE_STATE http_conn::parse_line()
     return LINE_OPEN;
 }
 
+//在解析前按请求行粗略分类，登录、注册走数据库车道，/metrics 与 /trace 走管理车道
+int http_conn::lane()
+{
+    const char *url;
+    if(m_read_idx > 5 && 0 == strncasecmp(m_read_buf, "POST ", 5))
+        url = m_read_buf + 5;
+    else if(m_read_idx > 4 && 0 == strncasecmp(m_read_buf, "GET ", 4))
+        url = m_read_buf + 4;
+    else
+        return LANE_STATIC;
+
+    long left = m_read_idx - (url - m_read_buf);
+    if(url == m_read_buf + 5 && left >= 2 && '/' == url[0] && ('2' == url[1] || '3' == url[1]))
+        return LANE_DB;
+    if((left >= 8 && 0 == strncmp(url, "/metrics", 8)) || (left >= 6 && 0 == strncmp(url, "/trace", 6)))
+        return LANE_ADMIN;
+    return LANE_STATIC;
+}
+
 //循环读取客户数据，直到无数据可读或对方关闭连接
 //非阻塞ET工作模式下，需要一次性将数据读完
 bool http_conn::read_once()
@@ -200,7 +274,14 @@ bool http_conn::read_once()
     {
         return false;
     }
+    alloc_request alloc(m_alloc);
     int bytes_read = 0;
+    long long start = now_us();
+    if (0 == m_read_idx)
+    {
+        m_start_us = start;
+        m_trace_id = tracer::begin();
+    }
 
     //LT读取数据
     if (0 == m_TRIGMode)
@@ -212,8 +293,13 @@ bool http_conn::read_once()
         {
             return false;
         }
+        traffic_capture::get_instance()->data(m_capture_id, m_read_buf + m_read_idx - bytes_read, bytes_read);
 
-        LOG_INFO("client(%s) read %d : ",inet_ntoa(get_address()->sin_addr), m_read_idx);
+        LOG_DEBUG("client(%s) read %d : ",inet_ntoa(get_address()->sin_addr), m_read_idx);
+        long long end = now_us();
+        m_stage_us[STAGE_READ] += end - start;
+        metrics::observe(STAGE_READ, end - start);
+        tracer::span(m_trace_id, "read", start, end);
         return true;
     }
     //ET读数据
@@ -232,8 +318,13 @@ bool http_conn::read_once()
             {
                 return false;
             }
+            traffic_capture::get_instance()->data(m_capture_id, m_read_buf + m_read_idx, bytes_read);
             m_read_idx += bytes_read;
         }
+        long long end = now_us();
+        m_stage_us[STAGE_READ] += end - start;
+        metrics::observe(STAGE_READ, end - start);
+        tracer::span(m_trace_id, "read", start, end);
         return true;
     }
 }
@@ -281,6 +372,8 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
 
     if (!m_url || m_url[0] != '/')
         return BAD_REQUEST;
+    if (strlen(m_url) < FILENAME_LEN)
+        strcpy(m_cache_key, m_url);
     //当url为/时，显示判断界面
     if (strlen(m_url) == 1)
         strcat(m_url, "judge.html");
@@ -321,9 +414,39 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text)
         text += strspn(text, " \t");
         m_host = text;
     }
+    else if (strncasecmp(text, "If-None-Match:", 14) == 0)
+    {
+        text += 14;
+        text += strspn(text, " \t");
+        m_if_none_match = text;
+    }
+    else if (strncasecmp(text, "If-Modified-Since:", 18) == 0)
+    {
+        text += 18;
+        text += strspn(text, " \t");
+        m_if_modified_since = text;
+    }
+    else if (strncasecmp(text, "Accept-Encoding:", 16) == 0)
+    {
+        text += 16;
+        text += strspn(text, " \t");
+        m_accept_encoding = text;
+    }
+    else if (strncasecmp(text, "Range:", 6) == 0)
+    {
+        text += 6;
+        text += strspn(text, " \t");
+        m_range = text;
+    }
+    else if (strncasecmp(text, "If-Range:", 9) == 0)
+    {
+        text += 9;
+        text += strspn(text, " \t");
+        m_if_range = text;
+    }
     else
     {
-        LOG_INFO("oop!unknow header: %s", text);
+        LOG_DEBUG("oop!unknow header: %s", text);
     }
     return NO_REQUEST;
 }
@@ -346,12 +469,13 @@ http_conn::HTTP_CODE http_conn::process_read()
     LINE_STATE line_status = LINE_OK;
     HTTP_CODE ret = NO_REQUEST;
     char *text = 0;
-    LOG_INFO("client(%s) Process Read : \n %s", inet_ntoa(get_address()->sin_addr), m_read_buf);
+    long long start = now_us();
+    LOG_DEBUG("client(%s) Process Read : \n %s", inet_ntoa(get_address()->sin_addr), m_read_buf);
     while ((m_check_state == CHECK_STATE_CONTENT && line_status == LINE_OK) || ((line_status = parse_line()) == LINE_OK))
     {
         text = get_line();
         m_start_line = m_checked_idx;
-        LOG_INFO("%s", text);
+        LOG_DEBUG("%s", text);
         switch (m_check_state)
         {
         case CHECK_STATE_REQUESTLINE:
@@ -368,7 +492,7 @@ http_conn::HTTP_CODE http_conn::process_read()
                 return BAD_REQUEST;
             else if (ret == GET_REQUEST)
             {
-                return do_request();
+                return timed_request(start);
             }
             break;
         }
@@ -376,7 +500,7 @@ http_conn::HTTP_CODE http_conn::process_read()
         {
             ret = parse_content(text);
             if (ret == GET_REQUEST)
-                return do_request();
+                return timed_request(start);
             line_status = LINE_OPEN;
             break;
         }
@@ -385,11 +509,51 @@ http_conn::HTTP_CODE http_conn::process_read()
         }
     }
 
+    m_stage_us[STAGE_PARSE] += now_us() - start;
     return NO_REQUEST;
 }
 
+http_conn::HTTP_CODE http_conn::timed_request(long long parse_start)
+{
+    long long start = now_us();
+    m_stage_us[STAGE_PARSE] += start - parse_start;
+    metrics::observe(STAGE_PARSE, m_stage_us[STAGE_PARSE]);
+    tracer::span(m_trace_id, "parse", parse_start, start);
+
+    // 数据库连接池与用户存储按线程当前编号记录
+    trace_scope scope(m_trace_id);
+    HTTP_CODE ret = do_request();
+    long long end = now_us();
+    m_stage_us[STAGE_HANDLER] = end - start;
+    metrics::observe(STAGE_HANDLER, end - start);
+    tracer::span(m_trace_id, "handler", start, end);
+    return ret;
+}
+
 http_conn::HTTP_CODE http_conn::do_request()
 {
+    //事件循环已确认缓存命中，直接使用缓存内容
+    if (m_cached)
+        return cached_request();
+
+    //运行指标与追踪记录由当前线程生成，不进入文件缓存
+    if (GET == m_method && 0 == strcmp(m_url, "/metrics"))
+    {
+        m_dynamic = metrics::get_instance()->render();
+        m_dynamic_type = "text/plain; version=0.0.4";
+        m_file_address = const_cast<char *>(m_dynamic.data());
+        m_file_stat.st_size = m_dynamic.size();
+        return FILE_REQUEST;
+    }
+    if (GET == m_method && 0 == strcmp(m_url, "/trace"))
+    {
+        m_dynamic = tracer::get_instance()->render();
+        m_dynamic_type = "application/json";
+        m_file_address = const_cast<char *>(m_dynamic.data());
+        m_file_stat.st_size = m_dynamic.size();
+        return FILE_REQUEST;
+    }
+
     strcpy(m_real_file, doc_root);
     int len = strlen(doc_root);
     //printf("m_url:%s\n", m_url);
@@ -402,11 +566,8 @@ http_conn::HTTP_CODE http_conn::do_request()
         //根据标志判断是登录检测还是注册检测
         char flag = m_url[1];
 
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/");
-        strcat(m_url_real, m_url + 2);
-        strncpy(m_real_file + len, m_url_real, FILENAME_LEN - len - 1);
-        free(m_url_real);
+        m_real_file[len] = '/';
+        strncpy(m_real_file + len + 1, m_url + 2, FILENAME_LEN - len - 2);
 
         //将用户名和密码提取出来
         //user=123&passwd=123
@@ -423,36 +584,29 @@ http_conn::HTTP_CODE http_conn::do_request()
 
         if (*(p + 1) == '3')
         {
-            //如果是注册，先检测数据库中是否有重名的
-            //没有重名的，进行增加数据
-            char *sql_insert = (char *)malloc(sizeof(char) * 200);
-            strcpy(sql_insert, "INSERT INTO user(username, passwd) VALUES(");
-            strcat(sql_insert, "'");
-            strcat(sql_insert, name);
-            strcat(sql_insert, "', '");
-            strcat(sql_insert, password);
-            strcat(sql_insert, "')");
-
-            if (users.find(name) == users.end())
-            {
-                m_lock.lock();
-                int res = mysql_query(mysql, sql_insert);
-                users.insert(std::pair<std::string, std::string>(name, password));
-                m_lock.unlock();
-
-                if (!res)
-                    strcpy(m_url, "/log.html");
-                else
-                    strcpy(m_url, "/registerError.html");
-            }
+            //如果是注册，由存储后端检测是否重名并写入
+            long long db_start = now_us();
+            bool ok = m_store->regist(name, password);
+            long long db_end = now_us();
+            m_stage_us[STAGE_DB] += db_end - db_start;
+            metrics::observe(STAGE_DB, db_end - db_start);
+            tracer::span(m_trace_id, "db_regist", db_start, db_end);
+            if (ok)
+                strcpy(m_url, "/log.html");
             else
                 strcpy(m_url, "/registerError.html");
         }
         //如果是登录，直接判断
-        //若浏览器端输入的用户名和密码在表中可以查找到，返回1，否则返回0
+        //若浏览器端输入的用户名和密码在存储中可以查找到，返回1，否则返回0
         else if (*(p + 1) == '2')
         {
-            if (users.find(name) != users.end() && users[name] == password)
+            long long db_start = now_us();
+            bool ok = m_store->login(name, password);
+            long long db_end = now_us();
+            m_stage_us[STAGE_DB] += db_end - db_start;
+            metrics::observe(STAGE_DB, db_end - db_start);
+            tracer::span(m_trace_id, "db_login", db_start, db_end);
+            if (ok)
                 strcpy(m_url, "/welcome.html");
             else
                 strcpy(m_url, "/logError.html");
@@ -461,43 +615,23 @@ http_conn::HTTP_CODE http_conn::do_request()
 
     if (*(p + 1) == '0')
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/register.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-
-        free(m_url_real);
+        strcpy(m_real_file + len, "/register.html");
     }
     else if (*(p + 1) == '1')
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/log.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-
-        free(m_url_real);
+        strcpy(m_real_file + len, "/log.html");
     }
     else if (*(p + 1) == '5')
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/picture.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-
-        free(m_url_real);
+        strcpy(m_real_file + len, "/picture.html");
     }
     else if (*(p + 1) == '6')
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/video.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-
-        free(m_url_real);
+        strcpy(m_real_file + len, "/video.html");
     }
     else if (*(p + 1) == '7')
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/fans.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-
-        free(m_url_real);
+        strcpy(m_real_file + len, "/fans.html");
     }
     else
         strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
@@ -511,23 +645,192 @@ http_conn::HTTP_CODE http_conn::do_request()
     if (S_ISDIR(m_file_stat.st_mode))
         return BAD_REQUEST;
 
+    //缓存条目与文件一致时直接使用，有效期已过也不重新读入文件，条目中已有各编码的内容
+    set_content_type();
+    bool cacheable = 0 == cgi && m_cache_key[0] && m_file_stat.st_size > 0 && m_file_stat.st_size <= file_cache::MAX_FILE_SIZE;
+    if (cacheable && (m_cached = file_cache::get_instance()->touch(m_cache_key, m_file_stat)))
+        return cached_request();
+
+    //没有可用的条目时按 Accept-Encoding 选择预压缩文件，先按文件属性判断 304 与区间，再打开文件
+    struct stat orig = m_file_stat;
+    int path_len = strlen(m_real_file);
+    int accepted = m_vary ? accepted_encodings() : 0;
+    if (accepted)
+        use_sidecar(accepted);
+
+    //客户端缓存仍有效时不打开文件
+    if (not_modified())
+        return NOT_MODIFIED;
+
+    //区间请求不映射文件，发送时从请求的偏移处 sendfile
+    HTTP_CODE range = check_range();
+    if (RANGE_NOT_SATISFIABLE == range)
+        return range;
+    if (PARTIAL_CONTENT == range)
+    {
+        m_file_fd = open(m_real_file, O_RDONLY);
+        return m_file_fd < 0 ? NO_RESOURCE : PARTIAL_CONTENT;
+    }
+
+    //静态GET请求的小文件放入缓存，之后由事件循环直接写回，本次也从新条目中选择编码发送
+    if (cacheable && cache_file(orig, path_len))
+        return cached_request();
+
+    //未能放入缓存时发送选择的文件
     int fd = open(m_real_file, O_RDONLY);
     m_file_address = (char *)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
     close(fd);
     return FILE_REQUEST;
 }
 
+//读入原文件放入缓存，压缩编码由 put 读入预压缩文件或即时生成；m_real_file 的前 len 个字符为原文件路径
+bool http_conn::cache_file(const struct stat &st, int len)
+{
+    char path[FILENAME_LEN];
+    memcpy(path, m_real_file, len);
+    path[len] = '\0';
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    char *data = (char *)mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (MAP_FAILED == data)
+        return false;
+    file_cache::get_instance()->put(m_cache_key, path, st, data, m_content_type, m_vary);
+    munmap(data, st.st_size);
+    m_cached = file_cache::get_instance()->touch(m_cache_key, st);
+    return m_cached != NULL;
+}
+
+http_conn::HTTP_CODE http_conn::cached_request()
+{
+    m_content_type = m_cached->type;
+    m_vary = m_cached->vary;
+    int accepted = m_vary ? accepted_encodings() : 0;
+    const std::string *body = &m_cached->data;
+    m_encoding = ENCODING_IDENTITY;
+    //br 优先于 gzip
+    for (int i = ENCODING_NUM - 1; i > ENCODING_IDENTITY; --i)
+    {
+        if ((accepted & (1 << i)) && !m_cached->encoded[i].empty())
+        {
+            body = &m_cached->encoded[i];
+            m_encoding = i;
+            break;
+        }
+    }
+    m_file_stat.st_size = body->size();
+    m_file_stat.st_mtime = m_cached->mtime;
+    m_file_stat.st_ino = m_cached->ino;
+    if (not_modified())
+        return NOT_MODIFIED;
+    m_file_address = const_cast<char *>(body->data());
+    //缓存内容的区间直接从内存发送
+    return check_range();
+}
+
+void http_conn::set_content_type()
+{
+    m_content_type = "application/octet-stream";
+    m_vary = false;
+    const char *dot = strrchr(m_real_file, '.');
+    if (!dot || strchr(dot, '/'))
+        return;
+    for (size_t i = 0; i < sizeof(mime_types) / sizeof(mime_types[0]); ++i)
+    {
+        if (0 == strcasecmp(dot + 1, mime_types[i].ext))
+        {
+            m_content_type = mime_types[i].type;
+            m_vary = mime_types[i].compress && !cgi;
+            return;
+        }
+    }
+}
+
+//q=0 表示不接受，* 表示未列出的编码都可接受
+int http_conn::accepted_encodings()
+{
+    int mask = 0;
+    const char *p = m_accept_encoding;
+    while (p && *p)
+    {
+        p += strspn(p, " \t,");
+        int len = strcspn(p, " \t;,");
+        const char *next = p + len + strcspn(p + len, ",");
+        bool refused = false;
+        for (const char *q = p + len; q < next && (q = strchr(q, ';')) && q < next;)
+        {
+            q += 1 + strspn(q + 1, " \t");
+            if (('q' == q[0] || 'Q' == q[0]) && '=' == q[1])
+                refused = atof(q + 2) <= 0;
+        }
+        if (!refused)
+        {
+            if (4 == len && 0 == strncasecmp(p, "gzip", 4))
+                mask |= 1 << ENCODING_GZIP;
+            else if (2 == len && 0 == strncasecmp(p, "br", 2))
+                mask |= 1 << ENCODING_BR;
+            else if (1 == len && '*' == *p)
+                mask |= (1 << ENCODING_GZIP) | (1 << ENCODING_BR);
+        }
+        p = next;
+    }
+    return mask;
+}
+
+//预压缩文件不早于原文件时才使用，br 优先于 gzip
+bool http_conn::use_sidecar(int accepted)
+{
+    int len = strlen(m_real_file);
+    if (len + 4 > FILENAME_LEN)
+        return false;
+    for (int i = ENCODING_NUM - 1; i > ENCODING_IDENTITY; --i)
+    {
+        if (!(accepted & (1 << i)))
+            continue;
+        struct stat st;
+        strcpy(m_real_file + len, encoding_suffix[i]);
+        if (0 == stat(m_real_file, &st) && S_ISREG(st.st_mode) && (st.st_mode & S_IROTH) && st.st_mtime >= m_file_stat.st_mtime)
+        {
+            //ETag 与 Last-Modified 同缓存条目一样取原文件的 inode 与修改时间，只有大小取预压缩文件
+            st.st_ino = m_file_stat.st_ino;
+            st.st_mtime = m_file_stat.st_mtime;
+            m_file_stat = st;
+            m_encoding = i;
+            return true;
+        }
+        m_real_file[len] = '\0';
+    }
+    return false;
+}
+
 void http_conn::unmap()
 {
-    if (m_file_address)
+    if (m_cached)
+    {
+        m_cached.reset();
+        m_file_address = 0;
+    }
+    else if (!m_dynamic.empty())
+    {
+        m_dynamic.clear();
+        m_file_address = 0;
+    }
+    else if (m_file_address)
     {
         munmap(m_file_address, m_file_stat.st_size);
         m_file_address = 0;
     }
+    if (m_file_fd >= 0)
+    {
+        close(m_file_fd);
+        m_file_fd = -1;
+    }
 }
 
 bool http_conn::write()
 {
+    alloc_request alloc(m_alloc);
     int temp = 0;
     if(0 == bytes_to_send)
     {
@@ -536,24 +839,43 @@ bool http_conn::write()
         return true;
     }
 
+    long long start = now_us();
     while(1)
     {
-        temp = writev(m_sockfd, m_iv, 2);
+        if(m_seg_count > 0)
+            temp = send_segments();
+        else
+            temp = writev(m_sockfd, m_iv, m_iv_count);
 
         if(temp < 0)
         {
             if(errno == EAGAIN)
             {
+                // 发送缓冲区满，每次 write 调用各记录一段，段间空隙即等待 EPOLLOUT 的时间
+                long long end = now_us();
+                m_stage_us[STAGE_WRITE] += end - start;
+                tracer::span(m_trace_id, "write", start, end);
+                ++m_eagain;
+                if(access_log::get_instance()->slow_enabled())
+                    m_tcp_blocked.capture(m_sockfd);
                 modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
                 return true;
             }
+            long long end = now_us();
+            m_stage_us[STAGE_WRITE] += end - start;
+            tracer::span(m_trace_id, "write", start, end);
+            finish_request(bytes_have_send);
             unmap();
             return false;
         }
         
         bytes_have_send += temp;
         bytes_to_send -= temp;
-        if(bytes_to_send >= m_iv[0].iov_len)
+        if(m_seg_count > 0)
+        {
+            //分段发送在 send_segments 中推进
+        }
+        else if(bytes_to_send >= m_iv[0].iov_len)
         {
             m_iv[0].iov_len = 0;
             m_iv[1].iov_base = m_file_address + (bytes_have_send - m_write_idx);
@@ -567,6 +889,11 @@ bool http_conn::write()
 
         if(bytes_to_send <= 0)
         {
+            long long end = now_us();
+            m_stage_us[STAGE_WRITE] += end - start;
+            metrics::observe(STAGE_WRITE, m_stage_us[STAGE_WRITE]);
+            tracer::span(m_trace_id, "write", start, end);
+            finish_request(bytes_have_send);
             unmap();
             modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
 
@@ -595,7 +922,7 @@ bool http_conn::add_response(const char *format, ...)
     m_write_idx += len;
     va_end(arg_list);
 
-    LOG_INFO("request:%s", m_write_buf);
+    LOG_DEBUG("request:%s", m_write_buf);
 
     return true;
 }
@@ -618,7 +945,14 @@ bool http_conn::add_content_length(int content_len)
 
 bool http_conn::add_content_type()
 {
-    return add_response("Content-Type:%s\r\n", "text/html");
+    return !m_content_type || add_response("Content-Type:%s\r\n", m_content_type);
+}
+
+bool http_conn::add_encoding_headers()
+{
+    if (ENCODING_IDENTITY != m_encoding && !add_response("Content-Encoding:%s\r\n", encoding_name[m_encoding]))
+        return false;
+    return !m_vary || add_response("Vary:Accept-Encoding\r\n");
 }
 
 bool http_conn::add_linger()
@@ -636,8 +970,245 @@ bool http_conn::add_content(const char *content)
     return add_response("%s", content);
 }
 
+//HTTP日期格式，不依赖locale
+static void http_date(time_t t, char *buf, int size)
+{
+    static const char *days[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+    static const char *months[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    snprintf(buf, size, "%s, %02d %s %d %02d:%02d:%02d GMT", days[tm.tm_wday], tm.tm_mday, months[tm.tm_mon],
+             tm.tm_year + 1900, tm.tm_hour, tm.tm_min, tm.tm_sec);
+}
+
+//由原文件的 inode、修改时间与发送内容的大小生成，文件被替换或修改后都会变化；各编码是不同的表示，带编码后缀
+void http_conn::make_etag(char *buf, int size)
+{
+    snprintf(buf, size, "\"%lx-%llx-%llx%s%s\"", (unsigned long)m_file_stat.st_ino,
+             (unsigned long long)m_file_stat.st_size, (unsigned long long)m_file_stat.st_mtime,
+             ENCODING_IDENTITY == m_encoding ? "" : "-", ENCODING_IDENTITY == m_encoding ? "" : encoding_name[m_encoding]);
+}
+
+bool http_conn::add_cache_headers()
+{
+    char etag[64], modified[32], expires[32];
+    make_etag(etag, sizeof(etag));
+    http_date(m_file_stat.st_mtime, modified, sizeof(modified));
+    http_date(time(NULL) + m_max_age, expires, sizeof(expires));
+    bool ok = add_response("ETag:%s\r\nLast-Modified:%s\r\n", etag, modified);
+    if (m_max_age > 0)
+        ok = ok && add_response("Cache-Control:public, max-age=%d\r\n", m_max_age);
+    else
+        ok = ok && add_response("Cache-Control:no-cache\r\n");
+    return ok && add_response("Expires:%s\r\nAccept-Ranges:bytes\r\n", expires);
+}
+
+//按 RFC 7233 解析 Range: bytes=a-b,c-,-n
+//格式错误、区间过多或 If-Range 不匹配时忽略 Range 发送整个文件，没有可满足的区间时返回 416
+http_conn::HTTP_CODE http_conn::check_range()
+{
+    if (!m_range || GET != m_method || cgi || strncasecmp(m_range, "bytes=", 6) != 0)
+        return FILE_REQUEST;
+
+    //If-Range 为强ETag或与 Last-Modified 相同的日期时才发送区间
+    if (m_if_range)
+    {
+        if ('"' == m_if_range[0] || 0 == strncmp(m_if_range, "W/", 2))
+        {
+            char etag[64];
+            make_etag(etag, sizeof(etag));
+            if (strcmp(m_if_range, etag) != 0)
+                return FILE_REQUEST;
+        }
+        else
+        {
+            struct tm tm;
+            memset(&tm, 0, sizeof(tm));
+            if (!strptime(m_if_range, "%a, %d %b %Y %H:%M:%S GMT", &tm) || timegm(&tm) != m_file_stat.st_mtime)
+                return FILE_REQUEST;
+        }
+    }
+
+    long long size = m_file_stat.st_size;
+    const char *p = m_range + 6;
+    m_range_count = 0;
+    int specs = 0;
+    while (*p)
+    {
+        p += strspn(p, " \t");
+        long long first = -1, last = -1;
+        char *end;
+        if (isdigit((unsigned char)*p))
+        {
+            first = strtoll(p, &end, 10);
+            p = end;
+        }
+        if ('-' != *p++)
+            return FILE_REQUEST;
+        if (isdigit((unsigned char)*p))
+        {
+            last = strtoll(p, &end, 10);
+            p = end;
+        }
+        p += strspn(p, " \t");
+        if (*p && ',' != *p++)
+            return FILE_REQUEST;
+        if ((first < 0 && last < 0) || (first >= 0 && last >= 0 && last < first) || ++specs > MAX_RANGES)
+            return FILE_REQUEST;
+
+        //后缀区间 -n 为最后n个字节
+        if (first < 0)
+        {
+            if (0 == last)
+                continue;
+            first = last >= size ? 0 : size - last;
+            last = size - 1;
+        }
+        if (first >= size)
+            continue;
+        if (last < 0 || last >= size)
+            last = size - 1;
+        m_ranges[m_range_count][0] = first;
+        m_ranges[m_range_count][1] = last;
+        ++m_range_count;
+    }
+    if (0 == specs)
+        return FILE_REQUEST;
+    return m_range_count > 0 ? PARTIAL_CONTENT : RANGE_NOT_SATISFIABLE;
+}
+
+bool http_conn::add_ranges()
+{
+    //只有 check_range 返回 PARTIAL_CONTENT 时才有区间，否则不能发送只有分隔符的响应体
+    if (m_range_count <= 0)
+        return false;
+    long long size = m_file_stat.st_size;
+    m_seg_count = 1;
+    m_seg_idx = 0;
+    long long body = 0;
+    if (1 == m_range_count)
+    {
+        add_content_type();
+        add_response("Content-Range:bytes %lld-%lld/%lld\r\n", (long long)m_ranges[0][0], (long long)m_ranges[0][1], size);
+        body = m_ranges[0][1] - m_ranges[0][0] + 1;
+        send_segment &s = m_segs[m_seg_count++];
+        s.buf = m_cached ? m_file_address + m_ranges[0][0] : NULL;
+        s.offset = m_ranges[0][0];
+        s.len = body;
+    }
+    else
+    {
+        //每个区间前是分隔头，最后是结束分隔，都放在 m_part_buf 中
+        add_response("Content-Type:multipart/byteranges; boundary=%s\r\n", byteranges_boundary);
+        int used = 0;
+        for (int i = 0; i < m_range_count; ++i)
+        {
+            int n = snprintf(m_part_buf + used, sizeof(m_part_buf) - used, "%s--%s\r\n%s%s%sContent-Range:bytes %lld-%lld/%lld\r\n\r\n",
+                             i ? "\r\n" : "", byteranges_boundary, m_content_type ? "Content-Type:" : "",
+                             m_content_type ? m_content_type : "", m_content_type ? "\r\n" : "",
+                             (long long)m_ranges[i][0], (long long)m_ranges[i][1], size);
+            send_segment &h = m_segs[m_seg_count++];
+            h.buf = m_part_buf + used;
+            h.len = n;
+            used += n;
+            send_segment &s = m_segs[m_seg_count++];
+            s.buf = m_cached ? m_file_address + m_ranges[i][0] : NULL;
+            s.offset = m_ranges[i][0];
+            s.len = m_ranges[i][1] - m_ranges[i][0] + 1;
+            body += n + s.len;
+        }
+        int n = snprintf(m_part_buf + used, sizeof(m_part_buf) - used, "\r\n--%s--\r\n", byteranges_boundary);
+        send_segment &t = m_segs[m_seg_count++];
+        t.buf = m_part_buf + used;
+        t.len = n;
+        body += n;
+    }
+    if (!add_response("Content-Length:%lld\r\n", body) || !add_linger() || !add_blank_line())
+    {
+        m_seg_count = 0;
+        return false;
+    }
+    m_segs[0].buf = m_write_buf;
+    m_segs[0].len = m_write_idx;
+    bytes_to_send = m_write_idx + body;
+    return true;
+}
+
+//每次调用发送一个分段的一部分，内存分段后面还有内容时带 MSG_MORE，与后续的文件内容合并成满的报文
+int http_conn::send_segments()
+{
+    send_segment &s = m_segs[m_seg_idx];
+    ssize_t n;
+    if (s.buf)
+        n = send(m_sockfd, s.buf, s.len, m_seg_idx + 1 < m_seg_count ? MSG_MORE : 0);
+    else
+    {
+        n = sendfile(m_sockfd, m_file_fd, &s.offset, s.len);
+        //文件在发送期间被截断
+        if (0 == n)
+        {
+            errno = EIO;
+            return -1;
+        }
+    }
+    if (n < 0)
+        return -1;
+    if (s.buf)
+        s.buf += n;
+    s.len -= n;
+    if (0 == s.len)
+        ++m_seg_idx;
+    return n;
+}
+
+//If-None-Match 存在时只按它判断，否则按 If-Modified-Since 判断，只用于GET静态文件
+bool http_conn::not_modified()
+{
+    if (GET != m_method || cgi)
+        return false;
+
+    if (m_if_none_match)
+    {
+        char etag[64];
+        make_etag(etag, sizeof(etag));
+        int len = strlen(etag);
+        //逗号分隔的列表，弱比较，忽略 W/ 前缀
+        const char *p = m_if_none_match;
+        while (*p)
+        {
+            p += strspn(p, " \t,");
+            if ('*' == *p)
+                return true;
+            if (0 == strncmp(p, "W/", 2))
+                p += 2;
+            if (0 == strncmp(p, etag, len) && (p[len] == '\0' || p[len] == ',' || p[len] == ' ' || p[len] == '\t'))
+                return true;
+            p += strcspn(p, ",");
+        }
+        return false;
+    }
+
+    if (m_if_modified_since)
+    {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        const char *end = strptime(m_if_modified_since, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+        if (!end)
+            return false;
+        //晚于当前时间的日期无效，按 RFC 7232 忽略
+        time_t since = timegm(&tm);
+        if (since > time(NULL))
+            return false;
+        return m_file_stat.st_mtime <= since;
+    }
+    return false;
+}
+
 bool http_conn::process_write(HTTP_CODE ret)
 {
+    // 访问日志记录的状态码，找不到文件时不发送响应直接关闭连接
+    m_status = INTERNAL_ERROR == ret ? 500 : (FORBIDDEN_REQUEST == ret ? 403 : (FILE_REQUEST == ret ? 200 :
+               (NOT_MODIFIED == ret ? 304 : (PARTIAL_CONTENT == ret ? 206 : (RANGE_NOT_SATISFIABLE == ret ? 416 : 404)))));
     switch (ret)
     {
         case INTERNAL_ERROR:
@@ -667,6 +1238,15 @@ bool http_conn::process_write(HTTP_CODE ret)
         case FILE_REQUEST:
         {
             add_status_line(200, ok_200_title);
+            if (!m_dynamic.empty())
+                add_response("Content-Type:%s\r\n", m_dynamic_type);
+            else
+            {
+                add_content_type();
+                add_encoding_headers();
+                if (!cgi)
+                    add_cache_headers();
+            }
             if (m_file_stat.st_size != 0)
             {
                 add_headers(m_file_stat.st_size);
@@ -685,6 +1265,32 @@ bool http_conn::process_write(HTTP_CODE ret)
                 if (!add_content(ok_string))
                     return false;
             }
+            break;
+        }
+        case PARTIAL_CONTENT:
+        {
+            add_status_line(206, partial_206_title);
+            add_cache_headers();
+            add_encoding_headers();
+            return add_ranges();
+        }
+        case RANGE_NOT_SATISFIABLE:
+        {
+            add_status_line(416, error_416_title);
+            add_response("Content-Range:bytes */%lld\r\n", (long long)m_file_stat.st_size);
+            if (!add_headers(0))
+                return false;
+            break;
+        }
+        case NOT_MODIFIED:
+        {
+            //304 没有响应体
+            add_status_line(304, not_modified_304_title);
+            add_cache_headers();
+            add_encoding_headers();
+            if (!add_linger() || !add_blank_line())
+                return false;
+            break;
         }
         default:
             return false;
@@ -696,9 +1302,92 @@ bool http_conn::process_write(HTTP_CODE ret)
     return true;
 }
 
+void http_conn::finish_request(long long bytes)
+{
+    if (0 == m_start_us)
+        return;
+    long long end = now_us();
+    long long total = end - m_start_us;
+    tracer::span(m_trace_id, "request", m_start_us, end);
+    tracer::end(m_trace_id, total);
+    m_start_us = 0;
+    metrics::observe(STAGE_TOTAL, total);
+    metrics::count(COUNTER_REQUESTS);
+    if (m_status >= 400)
+        metrics::count(COUNTER_ERRORS);
+    metrics::count(COUNTER_BYTES_SENT, bytes);
+    access_log *alog = access_log::get_instance();
+    alog->record(POST == m_method ? "POST" : "GET", m_cache_key[0] ? m_cache_key : "-",
+                 m_status, bytes, m_stage_us[STAGE_DB], total);
+    if (alog->is_slow(total))
+        log_slow(bytes, total);
+
+    int kind = m_cached ? ALLOC_REQ_CACHED : !m_dynamic.empty() ? ALLOC_REQ_ADMIN : cgi ? ALLOC_REQ_CGI : ALLOC_REQ_STATIC;
+    alloc_profile::request_done(kind, m_alloc);
+    m_alloc.count = 0;
+    m_alloc.bytes = 0;
+}
+
+void http_conn::log_slow(long long bytes, long long total)
+{
+    slow_record r;
+    r.method = POST == m_method ? "POST" : "GET";
+    r.path = m_cache_key[0] ? m_cache_key : "-";
+    r.status = m_status;
+    r.bytes = bytes;
+    r.total_us = total;
+    r.read_us = m_stage_us[STAGE_READ];
+    r.queue_us = m_queue_us;
+    r.parse_us = m_stage_us[STAGE_PARSE];
+    r.handler_us = m_stage_us[STAGE_HANDLER];
+    r.db_us = m_stage_us[STAGE_DB];
+    r.write_us = m_stage_us[STAGE_WRITE];
+    r.eagain = m_eagain;
+    if (m_eagain > 0)
+        r.blocked = m_tcp_blocked;
+    r.done.capture(m_sockfd);
+    access_log::get_instance()->record_slow(r);
+}
+
+bool http_conn::serve_cached(bool &alive)
+{
+    // 只处理新的GET请求，请求头不完整时交给工作线程
+    if (m_check_state != CHECK_STATE_REQUESTLINE || m_read_idx >= READ_BUFFER_SIZE ||
+        m_read_idx < 4 || strncmp(m_read_buf, "GET ", 4) != 0)
+        return false;
+
+    const char *url = m_read_buf + 4;
+    const char *end = strchr(url, ' ');
+    if (!end || url[0] != '/' || !strstr(end, "\r\n\r\n"))
+        return false;
+
+    alloc_request alloc(m_alloc);
+    m_cached = file_cache::get_instance()->find(url, end - url);
+    if (!m_cached)
+        return false;
+    metrics::count(COUNTER_CACHE_HITS);
+
+    alive = true;
+    HTTP_CODE read_ret = process_read();
+    if (read_ret == NO_REQUEST)
+    {
+        modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
+        return true;
+    }
+    if (!process_write(read_ret))
+    {
+        finish_request(0);
+        alive = false;
+        return true;
+    }
+    alive = write();
+    return true;
+}
+
 void http_conn::process()
 {
-    LOG_INFO("client(%s) Processing", inet_ntoa(get_address()->sin_addr));
+    alloc_request alloc(m_alloc);
+    LOG_DEBUG("client(%s) Processing", inet_ntoa(get_address()->sin_addr));
     HTTP_CODE read_ret = process_read();
     if(read_ret == NO_REQUEST)
     {
@@ -708,8 +1397,9 @@ void http_conn::process()
     bool write_ret = process_write(read_ret);
     if(!write_ret)
     {
+        finish_request(0);
         close_conn();
     }
     modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
-    LOG_INFO("client(%s) Process Sucessfule", inet_ntoa(get_address()->sin_addr));
+    LOG_DEBUG("client(%s) Process Sucessfule", inet_ntoa(get_address()->sin_addr));
 }
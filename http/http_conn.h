@@ -20,12 +20,22 @@
 #include <errno.h>
 #include <sys/wait.h>
 #include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <ctype.h>
 #include <map>
+#include <atomic>
 
 #include "../log/log.h"
+#include "../log/access_log.h"
+#include "../metrics/metrics.h"
+#include "../metrics/trace.h"
+#include "../metrics/alloc_profile.h"
 #include "../mysql/sql_connection_pool.h"
 #include "../threadpool/threadpool.h"
 #include "../lock/locker.h"
+#include "../storage/user_store.h"
+#include "file_cache.h"
+#include "traffic_capture.h"
 
 /**
  *       HTTP连接处理类，通过主从状态机封装http连接类
@@ -40,6 +50,7 @@ public:
     static const int FILENAME_LEN = 200;                    // 请求文件完整名字最大长度
     static const int READ_BUFFER_SIZE = 2048;               // 读缓冲区大小
     static const int WRITE_BUFFER_SIZE = 1024;              // 写缓冲区大小
+    static const int MAX_RANGES = 8;                        // Range 请求最多的区间数，超过时发送整个文件
 
     enum METHOD             // HTTP请求方法
     {
@@ -69,6 +80,9 @@ public:
         NO_RESOURCE,
         FORBIDDEN_REQUEST,
         FILE_REQUEST,
+        NOT_MODIFIED,
+        PARTIAL_CONTENT,
+        RANGE_NOT_SATISFIABLE,
         INTERNAL_ERROR,
         CLOSED_CONNECTION  
     };
@@ -81,7 +95,7 @@ public:
     };
 
 public:
-    http_conn() {}
+    http_conn() : m_file_fd(-1) {}
     ~http_conn() {}
 
 public:
@@ -90,15 +104,19 @@ public:
     void process();
     bool read_once();
     bool write();
+    // 缓存命中的静态GET请求在当前线程直接解析并写回，未命中返回false且不改变连接状态
+    // 命中时 alive 为false表示需要关闭连接
+    bool serve_cached(bool &alive);
+    int lane();                 // 按请求行分道，只查看读缓冲区不改变解析状态
     sockaddr_in* get_address()
     {
         return &m_address;
     }
-    void initmysql_result(sqlconnection_pool *connPool);
-    int timer_flag;
-    int improv;                 // 标志，标识是否已经对连接进行过处理， 1 处理过  0 未处理
+    std::atomic<int> timer_flag;
+    std::atomic<int> improv;    // 标志，标识是否已经对连接进行过处理， 1 处理过  0 未处理
 
 private:
+    friend struct http_conn_bench;      // bench/micro_bench.cpp 直接驱动解析状态机
     void init();
     HTTP_CODE process_read();
     bool process_write(HTTP_CODE ret);
@@ -106,6 +124,7 @@ private:
     HTTP_CODE parse_headers(char *text);
     HTTP_CODE parse_content(char *text);
     HTTP_CODE do_request();
+    HTTP_CODE timed_request(long long parse_start);     // 记录解析与处理耗时后调用 do_request
     char *get_line() { return m_read_buf + m_start_line; };
 
     LINE_STATE parse_line();
@@ -118,12 +137,30 @@ private:
     bool add_content_length(int content_length);
     bool add_linger();
     bool add_blank_line();
+    bool add_cache_headers();           // ETag、Last-Modified、Cache-Control、Expires 与 Accept-Ranges
+    void make_etag(char *buf, int size);
+    bool not_modified();                // 按 If-None-Match / If-Modified-Since 判断客户端缓存是否仍有效
+    HTTP_CODE cached_request();         // 从缓存条目中按 Accept-Encoding 选择内容
+    bool cache_file(const struct stat &st, int len);   // 读入原文件放入缓存，成功时 m_cached 为新条目
+    void set_content_type();            // 按 m_real_file 的扩展名确定 Content-Type 与是否可压缩
+    int accepted_encodings();           // Accept-Encoding 中可接受的编码，按位表示
+    bool use_sidecar(int accepted);     // 改为发送 .br/.gz 预压缩文件
+    bool add_encoding_headers();        // Content-Encoding 与 Vary
+    HTTP_CODE check_range();            // 解析 Range，返回 PARTIAL_CONTENT、RANGE_NOT_SATISFIABLE 或 FILE_REQUEST(发送整个文件)
+    bool add_ranges();                  // 206 响应头与各分段，多区间时为 multipart/byteranges
+    int send_segments();                // 发送当前分段，返回值与 errno 同 writev
+    void finish_request(long long bytes);   // 请求结束时记录指标并写访问日志
+    void log_slow(long long bytes, long long total);    // 写慢请求记录
 
 public:
     static int m_epollfd;
-    static int m_user_count;
-    MYSQL* mysql;
+    static std::atomic<int> m_user_count;
+    static user_store *m_store;     // 用户凭证存储
+    static int m_max_age;           // 静态文件的 Cache-Control max-age(秒)，0为每次都需验证
     int m_state;                // 读为0， 写为1
+    long long m_enqueue_time;   // 放入请求队列的时间(us)
+    long long m_queue_us;       // 本次请求在线程池中排队的总时间
+    uint64_t m_trace_id;        // 请求追踪编号，0表示未抽中
 
 private:
     int m_sockfd;
@@ -140,23 +177,60 @@ private:
     char *m_url;
     char *m_version;
     char *m_host;
+    char *m_if_none_match;
+    char *m_if_modified_since;
+    char *m_range;
+    char *m_if_range;
+    char *m_accept_encoding;
+    const char *m_content_type;         // 静态文件的 Content-Type，为空时不发送
+    bool m_vary;                        // 可压缩的静态文件，响应随 Accept-Encoding 变化
+    int m_encoding;                     // 发送内容的编码 CONTENT_ENCODING
     long m_content_length;
     bool m_linger;
     char *m_file_address;
+    std::shared_ptr<file_cache::entry> m_cached;    // 命中的缓存文件，非空时 m_file_address 指向缓存内容
+    std::string m_dynamic;                          // 动态生成的响应体(/metrics, /trace)，非空时 m_file_address 指向其内容
+    const char *m_dynamic_type;                     // 动态响应体的 Content-Type
+    char m_cache_key[FILENAME_LEN];                 // 请求行中原始的url, 作为缓存的键
     struct stat m_file_stat;
     struct iovec m_iv[2];
     int m_iv_count;
+
+    // Range 响应按分段发送：响应头、各区间的分隔头与内容、结束分隔
+    // buf 非空时发送内存，否则从 m_file_fd 的 offset 处 sendfile，发送时就地推进
+    struct send_segment
+    {
+        const char *buf;
+        off_t offset;
+        size_t len;
+    };
+    off_t m_ranges[MAX_RANGES][2];      // 请求的区间，闭区间
+    int m_range_count;
+    int m_file_fd;                      // Range 响应不映射文件，发送期间保持打开
+    send_segment m_segs[2 * MAX_RANGES + 2];
+    int m_seg_count;                    // 0表示不使用分段发送
+    int m_seg_idx;
+    char m_part_buf[MAX_RANGES * 192 + 64];     // multipart 的分隔头
     int cgi;                // 是否启动POST
     char *m_string;         // 存储请求头数据
 
     int bytes_to_send;
     int bytes_have_send;
 
+    int m_status;               // 响应状态码
+    long long m_start_us;       // 开始读取请求的时间，0表示请求已结束
+    long long m_stage_us[STAGE_NUM];    // 本次请求各阶段已用的耗时，解析与发送可能分多次
+    int m_eagain;               // 本次响应 write 遇到 EAGAIN 的次数
+    tcp_state m_tcp_blocked;    // 最后一次 EAGAIN 时的TCP状态，只在记录慢请求时采集
+    alloc_counter m_alloc;      // 本次请求的分配次数，只在分配统计模式下记录
+    uint64_t m_capture_id;      // 流量录制中的连接编号，0表示不录制
+
     char *doc_root;
 
     std::map<std::string, std::string> m_users;
     int m_TRIGMode;
     int m_close_log;
+    static const int m_log_module = LOG_MODULE_HTTP;
 
     char sql_user[100];
     char sql_passwd[100];
@@ -0,0 +1,107 @@
+#include "traffic_capture.h"
+#include <sys/time.h>
+#include <time.h>
+
+static long long now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+bool traffic_capture::init(const char *path)
+{
+    m_fp = fopen(path, "wb");
+    if(!m_fp)
+        return false;
+    setvbuf(m_fp, NULL, _IOFBF, 1 << 20);
+
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    fwrite(CAPTURE_MAGIC, 1, CAPTURE_MAGIC_LEN, m_fp);
+    fputc(VERSION, m_fp);
+    m_bytes = CAPTURE_MAGIC_LEN + 1;
+    put_varint(tv.tv_sec * 1000000ULL + tv.tv_usec);
+    m_last_us = now_us();
+    m_enabled = true;
+    return true;
+}
+
+traffic_capture::~traffic_capture()
+{
+    if(m_fp)
+        fclose(m_fp);
+}
+
+uint64_t traffic_capture::open_conn()
+{
+    if(!m_enabled)
+        return 0;
+    m_lock.lock();
+    uint64_t id = m_next_id++;
+    if(m_full)
+        id = 0;
+    else
+        put(RECORD_OPEN, id, NULL, 0);
+    m_lock.unlock();
+    return id;
+}
+
+void traffic_capture::data(uint64_t id, const char *buf, int len)
+{
+    if(0 == id || len <= 0)
+        return;
+    m_lock.lock();
+    if(!m_full)
+        put(RECORD_DATA, id, buf, len);
+    m_lock.unlock();
+}
+
+void traffic_capture::close_conn(uint64_t id)
+{
+    if(0 == id)
+        return;
+    m_lock.lock();
+    if(!m_full)
+        put(RECORD_CLOSE, id, NULL, 0);
+    m_lock.unlock();
+}
+
+void traffic_capture::put_varint(uint64_t v)
+{
+    unsigned char buf[10];
+    int n = 0;
+    do
+    {
+        buf[n] = v & 0x7f;
+        v >>= 7;
+        if(v)
+            buf[n] |= 0x80;
+        ++n;
+    } while(v);
+    fwrite(buf, 1, n, m_fp);
+    m_bytes += n;
+}
+
+// 调用者持有 m_lock，时间在锁内取得，文件中的记录按时间排列
+void traffic_capture::put(char type, uint64_t id, const char *buf, int len)
+{
+    if(m_bytes + len + 32 > MAX_BYTES)
+    {
+        m_full = true;
+        fflush(m_fp);
+        return;
+    }
+    long long now = now_us();
+    fputc(type, m_fp);
+    ++m_bytes;
+    put_varint(id);
+    put_varint(now - m_last_us);
+    m_last_us = now;
+    if(RECORD_DATA == type)
+    {
+        put_varint(len);
+        fwrite(buf, 1, len, m_fp);
+        m_bytes += len;
+    }
+}
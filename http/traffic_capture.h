@@ -0,0 +1,66 @@
+#ifndef _TRAFFIC_CAPTURE_H
+#define _TRAFFIC_CAPTURE_H
+
+/**
+ *      流量录制
+ *   记录每个连接收到的原始请求字节与到达时间，由 bench/replay 离线重放
+ *   文件格式，整数均为无符号LEB128变长编码：
+ *      文件头  "WSCAP" 版本(1字节) 录制开始时的系统时间(us)
+ *      记录    类型(1字节) 连接编号 距上一条记录的时间(us) [数据长度 数据]
+ *              类型 'O' 连接建立，'D' 收到数据，'C' 连接关闭，只有 'D' 带数据
+ *   所有线程写同一个文件，由互斥锁保护；未开启时 read_once 只多一次判断
+ *   文件达到大小上限后停止录制，已建立的连接不再记录数据
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include "../lock/locker.h"
+
+#define CAPTURE_MAGIC "WSCAP"
+#define CAPTURE_MAGIC_LEN 5
+
+class traffic_capture
+{
+public:
+    static const int VERSION = 1;
+    static const long long MAX_BYTES = 1LL << 30;      // 录制文件大小上限
+
+    enum RECORD_TYPE
+    {
+        RECORD_OPEN = 'O',
+        RECORD_DATA = 'D',
+        RECORD_CLOSE = 'C'
+    };
+
+    static traffic_capture *get_instance()
+    {
+        static traffic_capture instance;
+        return &instance;
+    }
+
+    bool init(const char *path);
+    bool enabled() { return m_enabled; }
+
+    // 新连接，返回连接编号，未录制时返回0
+    uint64_t open_conn();
+    void data(uint64_t id, const char *buf, int len);
+    void close_conn(uint64_t id);
+
+private:
+    traffic_capture() : m_enabled(false), m_full(false), m_fp(NULL), m_lock("capture"), m_next_id(1), m_last_us(0), m_bytes(0) {}
+    ~traffic_capture();
+
+    void put(char type, uint64_t id, const char *buf, int len);
+    void put_varint(uint64_t v);
+
+private:
+    bool m_enabled;
+    bool m_full;                // 已达到大小上限
+    FILE *m_fp;
+    locker m_lock;
+    uint64_t m_next_id;
+    long long m_last_us;        // 上一条记录的时间
+    long long m_bytes;          // 已写入的字节数
+};
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef _LOCK_PROFILE_H
+#define _LOCK_PROFILE_H
+
+/**
+ *      锁竞争统计
+ *   以 LOCK_PROFILE 宏编译(make LOCK_PROFILE=1)时，locker、sem、cond、parker 在构造时按名字登记，
+ *   同名同类型的实例合并统计：
+ *      acquires    获取次数，sem 为 wait 次数，cond 与 parker 为休眠次数
+ *      contended   需要等待的次数，互斥锁与信号量为 try 失败的次数
+ *      wait        等待时间之和与最大值
+ *      hold        持有时间之和与最大值，只有互斥锁统计，cond 等待期间不计入
+ *   未定义该宏时包装类不做任何统计，名字参数被忽略
+ *   统计结果由 /metrics 以 webserver_lock_* 指标输出
+*/
+
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+
+struct lock_stats
+{
+    char name[32];
+    const char *kind;                   // mutex / sem / cond / parker
+    std::atomic<long long> acquires;
+    std::atomic<long long> contended;
+    std::atomic<long long> wait_ns;
+    std::atomic<long long> wait_max_ns;
+    std::atomic<long long> hold_ns;
+    std::atomic<long long> hold_max_ns;
+
+    // wait_ns 小于0表示没有等待
+    void acquired(long long wait)
+    {
+        acquires.fetch_add(1, std::memory_order_relaxed);
+        if(wait < 0)
+            return;
+        contended.fetch_add(1, std::memory_order_relaxed);
+        wait_ns.fetch_add(wait, std::memory_order_relaxed);
+        update_max(wait_max_ns, wait);
+    }
+    void released(long long hold)
+    {
+        hold_ns.fetch_add(hold, std::memory_order_relaxed);
+        update_max(hold_max_ns, hold);
+    }
+
+    static void update_max(std::atomic<long long> &max, long long v)
+    {
+        long long cur = max.load(std::memory_order_relaxed);
+        while(v > cur && !max.compare_exchange_weak(cur, v, std::memory_order_relaxed))
+            ;
+    }
+};
+
+class lock_profile
+{
+public:
+    static const int MAX_LOCKS = 128;
+
+    // 按名字与类型查找统计项，没有时登记，登记满后都计入最后一项
+    static lock_stats *get(const char *name, const char *kind)
+    {
+        static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+        lock_stats *table = stats();
+        pthread_mutex_lock(&mutex);
+        int n = count().load(std::memory_order_relaxed);
+        lock_stats *s = NULL;
+        for(int i = 0; i < n && !s; ++i)
+        {
+            if(0 == strcmp(table[i].kind, kind) && 0 == strncmp(table[i].name, name, sizeof(table[i].name) - 1))
+                s = &table[i];
+        }
+        if(!s && n < MAX_LOCKS)
+        {
+            s = &table[n];
+            strncpy(s->name, n == MAX_LOCKS - 1 ? "overflow" : name, sizeof(s->name) - 1);
+            s->kind = kind;
+            count().store(n + 1, std::memory_order_release);
+        }
+        if(!s)
+            s = &table[MAX_LOCKS - 1];
+        pthread_mutex_unlock(&mutex);
+        return s;
+    }
+
+    // 已登记的统计项，只增不减
+    static lock_stats *stats()
+    {
+        static lock_stats table[MAX_LOCKS];
+        return table;
+    }
+    static std::atomic<int> &count()
+    {
+        static std::atomic<int> n(0);
+        return n;
+    }
+
+    static long long now_ns()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    }
+};
+
+#endif
@@ -4,12 +4,21 @@
 #include <exception>
 #include <pthread.h>
 #include <semaphore.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <atomic>
+#include "lock_profile.h"
 
 /**
  *  定义线程同步机制包装类
  *      信号量
  *      互斥锁
  *      条件变量
+ *      futex休眠器
+ *  构造时传入的名字用于 LOCK_PROFILE 模式下的竞争统计，见 lock_profile.h
 */
 
 /**
@@ -24,13 +33,21 @@ public:
         {
             throw std::exception();
         }
+#ifdef LOCK_PROFILE
+        m_stats = lock_profile::get("unnamed", "sem");
+#endif
     }
-    sem(int num)
+    sem(int num, const char *name = "unnamed")
     {
         if(sem_init(&m_sem, 0, num) != 0)
         {
             throw std::exception();
         }
+#ifdef LOCK_PROFILE
+        m_stats = lock_profile::get(name, "sem");
+#else
+        (void)name;
+#endif
     }
     ~sem()
     {
@@ -39,7 +56,19 @@ public:
 
     bool wait()
     {
+#ifdef LOCK_PROFILE
+        if(sem_trywait(&m_sem) == 0)
+        {
+            m_stats->acquired(-1);
+            return true;
+        }
+        long long start = lock_profile::now_ns();
+        bool ret = sem_wait(&m_sem) == 0;
+        m_stats->acquired(lock_profile::now_ns() - start);
+        return ret;
+#else
         return sem_wait(&m_sem) == 0;
+#endif
     }
     bool post()
     {
@@ -47,6 +76,9 @@ public:
     }
 private:
     sem_t m_sem;
+#ifdef LOCK_PROFILE
+    lock_stats *m_stats;
+#endif
 };
 
 /**
@@ -55,12 +87,18 @@ private:
 class locker
 {
 public:
-    locker()
+    explicit locker(const char *name = "unnamed")
     {
         if(pthread_mutex_init(&m_mutex, NULL) != 0)
         {
             throw std::exception();
         }
+#ifdef LOCK_PROFILE
+        m_stats = lock_profile::get(name, "mutex");
+        m_acquired = 0;
+#else
+        (void)name;
+#endif
     }
     ~locker()
     {
@@ -68,10 +106,28 @@ public:
     }
     bool lock()
     {
+#ifdef LOCK_PROFILE
+        // 先尝试加锁，失败才计时，无竞争时只多一次 trylock
+        long long wait = -1;
+        if(pthread_mutex_trylock(&m_mutex) != 0)
+        {
+            long long start = lock_profile::now_ns();
+            if(pthread_mutex_lock(&m_mutex) != 0)
+                return false;
+            wait = lock_profile::now_ns() - start;
+        }
+        m_acquired = lock_profile::now_ns();
+        m_stats->acquired(wait);
+        return true;
+#else
         return pthread_mutex_lock(&m_mutex) == 0;
+#endif
     }
     bool unlock()
     {
+#ifdef LOCK_PROFILE
+        m_stats->released(lock_profile::now_ns() - m_acquired);
+#endif
         return pthread_mutex_unlock(&m_mutex) == 0;
     }
     pthread_mutex_t *get()
@@ -81,7 +137,12 @@ public:
 
     }
 private:
+    friend class cond;
     pthread_mutex_t m_mutex;
+#ifdef LOCK_PROFILE
+    lock_stats *m_stats;
+    long long m_acquired;       // 加锁时间，持有锁时才会读写
+#endif
 };
 
 /**
@@ -90,12 +151,17 @@ private:
 class cond
 {
 public:
-    cond()
+    explicit cond(const char *name = "unnamed")
     {
         if(pthread_cond_init(&m_cond, NULL) != 0)
         {
             throw std::exception();
         }
+#ifdef LOCK_PROFILE
+        m_stats = lock_profile::get(name, "cond");
+#else
+        (void)name;
+#endif
     }
     ~cond()
     {
@@ -110,6 +176,21 @@ public:
         return ret == 0;
     }
 
+    /* 等待期间锁已释放，LOCK_PROFILE 模式下不计入 lock 的持有时间 */
+    bool wait(locker &lock)
+    {
+#ifdef LOCK_PROFILE
+        long long start = lock_profile::now_ns();
+        lock.m_stats->released(start - lock.m_acquired);
+        bool ret = wait(&lock.m_mutex);
+        lock.m_acquired = lock_profile::now_ns();
+        m_stats->acquired(lock.m_acquired - start);
+        return ret;
+#else
+        return wait(&lock.m_mutex);
+#endif
+    }
+
     bool signal()
     {
         return pthread_cond_signal(&m_cond) == 0;
@@ -130,7 +211,76 @@ public:
 
 private:
     pthread_cond_t m_cond;
+#ifdef LOCK_PROFILE
+    lock_stats *m_stats;
+#endif
 };
 
+/**
+ *  futex休眠器
+ *      空闲线程先自旋，再通过futex进入内核等待，唤醒只发生在确有等待者时
+ *      等待方: prepare_wait() -> 再次检查条件 -> wait() 或 cancel_wait()
+ *      通知方: 修改条件 -> notify()
+*/
+class parker
+{
+public:
+    explicit parker(const char *name = "unnamed") : m_epoch(0), m_waiters(0)
+    {
+#ifdef LOCK_PROFILE
+        m_stats = lock_profile::get(name, "parker");
+#else
+        (void)name;
+#endif
+    }
+
+    /* 登记为等待者并返回当前纪元，之后必须再检查一次条件，避免丢失唤醒 */
+    uint32_t prepare_wait()
+    {
+        m_waiters.fetch_add(1, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return m_epoch.load(std::memory_order_seq_cst);
+    }
+
+    void cancel_wait()
+    {
+        m_waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    /* 纪元未变化时休眠，被唤醒、纪元已变化或超时(timeout非空时)返回 */
+    void wait(uint32_t epoch, const struct timespec *timeout = NULL)
+    {
+#ifdef LOCK_PROFILE
+        long long start = lock_profile::now_ns();
+#endif
+        syscall(SYS_futex, (uint32_t *)&m_epoch, FUTEX_WAIT_PRIVATE, epoch, timeout, NULL, 0);
+        m_waiters.fetch_sub(1, std::memory_order_relaxed);
+#ifdef LOCK_PROFILE
+        m_stats->acquired(lock_profile::now_ns() - start);
+#endif
+    }
+
+    /* 唤醒至多n个等待者，没有等待者时不进入内核 */
+    void notify(int n)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(m_waiters.load(std::memory_order_seq_cst) == 0)
+            return;
+        m_epoch.fetch_add(1, std::memory_order_seq_cst);
+        syscall(SYS_futex, (uint32_t *)&m_epoch, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+    }
+
+    int waiters()
+    {
+        return m_waiters.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint32_t> m_epoch;      // 每次通知递增，futex等待的字
+    std::atomic<int> m_waiters;         // 登记的等待者数量
+#ifdef LOCK_PROFILE
+    lock_stats *m_stats;
+#endif
+};
 
 #endif
@@ -0,0 +1,142 @@
+#include "access_log.h"
+#include "log.h"
+#include <string.h>
+#include <time.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/sockios.h>
+
+// 线程私有的采样计数与令牌桶
+struct access_state
+{
+    static const int BUCKETS = 256;
+    struct bucket
+    {
+        uint64_t key;
+        double tokens;
+        long long last_us;
+        int suppressed;             // 上次写出后被丢弃的记录数
+    };
+
+    unsigned long long count;
+    bucket buckets[BUCKETS];
+
+    access_state() : count(0)
+    {
+        memset(buckets, 0, sizeof(buckets));
+    }
+};
+
+static thread_local access_state t_access;
+
+static long long now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static uint64_t record_key(int status, const char *path)
+{
+    // FNV-1a
+    uint64_t h = 1469598103934665603ULL ^ (uint64_t)status;
+    for(const char *p = path; *p; ++p)
+    {
+        h ^= (unsigned char)*p;
+        h *= 1099511628211ULL;
+    }
+    return h ? h : 1;
+}
+
+void access_log::init(int sample, int slow_ms, int rate)
+{
+    m_sample = sample > 0 ? sample : 0;
+    m_slow_us = slow_ms > 0 ? slow_ms * 1000LL : 0;
+    m_rate = rate > 0 ? rate : 0;
+    m_enabled = true;
+}
+
+void access_log::record(const char *method, const char *path, int status, long long bytes, long long db_us, long long total_us)
+{
+    if(!m_enabled)
+        return;
+
+    access_state &st = t_access;
+    bool always = status >= 400 || (m_slow_us > 0 && total_us >= m_slow_us);
+    if(!always && (0 == m_sample || st.count++ % m_sample != 0))
+        return;
+
+    int suppressed = 0;
+    if(m_rate > 0)
+    {
+        // 令牌桶容量为一秒的记录数，槽位被其他组占用时重新开始计数
+        uint64_t key = record_key(status, path);
+        access_state::bucket &b = st.buckets[key % access_state::BUCKETS];
+        long long now = now_us();
+        if(b.key != key)
+        {
+            b.key = key;
+            b.tokens = m_rate;
+            b.last_us = now;
+            b.suppressed = 0;
+        }
+        b.tokens += (now - b.last_us) * m_rate / 1000000.0;
+        if(b.tokens > m_rate)
+            b.tokens = m_rate;
+        b.last_us = now;
+        if(b.tokens < 1)
+        {
+            ++b.suppressed;
+            return;
+        }
+        b.tokens -= 1;
+        suppressed = b.suppressed;
+        b.suppressed = 0;
+    }
+
+    Log *log = Log::get_access_instance();
+    static const char *format = "%s %s %d %lld %lld %lld %d";
+    static const int id = log->register_format(LOG_LEVEL_INFO, LOG_MODULE_HTTP, format);
+    log->write_log(LOG_LEVEL_INFO, id, format, method, path, status, bytes, db_us, total_us, suppressed);
+}
+
+bool tcp_state::capture(int fd)
+{
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    valid = getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) == 0;
+    if(!valid)
+        return false;
+    rtt_us = info.tcpi_rtt;
+    rttvar_us = info.tcpi_rttvar;
+    retransmits = info.tcpi_retransmits;
+    total_retrans = info.tcpi_total_retrans;
+    cwnd = info.tcpi_snd_cwnd;
+    unacked = info.tcpi_unacked;
+    if(ioctl(fd, SIOCOUTQ, &send_queue) < 0)
+        send_queue = -1;
+    return true;
+}
+
+void access_log::record_slow(const slow_record &r)
+{
+    if(!m_enabled)
+        return;
+
+    // 没有 EAGAIN 时 blocked_* 为0
+    const tcp_state &b = r.blocked;
+    const tcp_state &d = r.done;
+    Log *log = Log::get_access_instance();
+    static const char *format = "slow %s %s status=%d bytes=%lld total_us=%lld "
+                                "read_us=%lld queue_us=%lld parse_us=%lld handler_us=%lld db_us=%lld write_us=%lld "
+                                "eagain=%d rtt_us=%u rttvar_us=%u retrans=%u total_retrans=%u cwnd=%u unacked=%u sndq=%d "
+                                "blocked_rtt_us=%u blocked_cwnd=%u blocked_unacked=%u blocked_sndq=%d";
+    static const int id = log->register_format(LOG_LEVEL_WARN, LOG_MODULE_HTTP, format);
+    log->write_log(LOG_LEVEL_WARN, id, format, r.method, r.path, r.status, r.bytes, r.total_us,
+                   r.read_us, r.queue_us, r.parse_us, r.handler_us, r.db_us, r.write_us,
+                   r.eagain, d.rtt_us, d.rttvar_us, d.retransmits, d.total_retrans, d.cwnd, d.unacked, d.send_queue,
+                   b.rtt_us, b.cwnd, b.unacked, b.send_queue);
+}
@@ -0,0 +1,83 @@
+#ifndef _ACCESS_LOG_H
+#define _ACCESS_LOG_H
+
+/**
+ *      访问日志
+ *   每个请求一条记录，写入单独的日志文件，经由异步日志的线程缓冲区写入，字段以空格分隔：
+ *      方法 路径 状态码 发送字节数 数据库耗时us 总耗时us 被限流的同类记录数
+ *   1. 采样：普通请求每N个记录一个；错误(状态码>=400)与慢请求总是记录
+ *   2. 限流：按 状态码+路径 分组的令牌桶，同类记录超过速率时丢弃并计数，计数随该组下一条记录写出
+ *   采样计数与令牌桶都是线程私有的，不加锁；同一组大量出错时也不会争用同一个桶，整体速率上限为 线程数 x 每组速率
+ *   3. 慢请求另外写一条 warn 级别的 slow 记录，不采样不限流，字段为 key=value：
+ *      各阶段耗时，以及 write 遇到 EAGAIN 时与响应结束时连接的内核TCP状态，用于区分慢在服务器还是网络
+*/
+
+#include <stdint.h>
+
+// 连接的内核TCP状态，来自 getsockopt(TCP_INFO) 与 ioctl(SIOCOUTQ)
+struct tcp_state
+{
+    bool valid;
+    uint32_t rtt_us;            // 平滑RTT
+    uint32_t rttvar_us;
+    uint32_t retransmits;       // 当前未确认数据的连续重传次数
+    uint32_t total_retrans;     // 连接累计重传的报文数
+    uint32_t cwnd;              // 拥塞窗口(报文数)
+    uint32_t unacked;           // 已发送未确认的报文数
+    int send_queue;             // 发送队列中的字节数，含未发送与未确认
+
+    tcp_state() : valid(false), rtt_us(0), rttvar_us(0), retransmits(0), total_retrans(0), cwnd(0), unacked(0), send_queue(0) {}
+    bool capture(int fd);
+};
+
+// 一条慢请求记录
+struct slow_record
+{
+    const char *method;
+    const char *path;
+    int status;
+    long long bytes;
+    long long total_us;
+    long long read_us;
+    long long queue_us;
+    long long parse_us;
+    long long handler_us;
+    long long db_us;
+    long long write_us;
+    int eagain;                 // write 遇到 EAGAIN 的次数
+    tcp_state blocked;          // 最后一次 EAGAIN 时的状态，eagain 为0时无效
+    tcp_state done;             // 响应结束时的状态
+};
+
+class access_log
+{
+public:
+    static access_log *get_instance()
+    {
+        static access_log instance;
+        return &instance;
+    }
+
+    // 采样间隔(0只记录错误与慢请求)、慢请求阈值(ms)、每个线程每组每秒记录数(0不限流)
+    void init(int sample, int slow_ms, int rate);
+    bool enabled() { return m_enabled; }
+
+    // 请求结束时由处理该请求的线程调用
+    void record(const char *method, const char *path, int status, long long bytes, long long db_us, long long total_us);
+
+    // 是否需要记录慢请求，为false时调用者不必采集TCP状态
+    bool slow_enabled() { return m_enabled && m_slow_us > 0; }
+    bool is_slow(long long total_us) { return slow_enabled() && total_us >= m_slow_us; }
+    void record_slow(const slow_record &r);
+
+private:
+    access_log() : m_enabled(false), m_sample(0), m_slow_us(0), m_rate(0) {}
+
+private:
+    bool m_enabled;
+    int m_sample;
+    long long m_slow_us;
+    int m_rate;
+};
+
+#endif
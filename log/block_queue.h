@@ -1,60 +1,76 @@
 #ifndef _BLOCK_QUEUE_H
 #define _BLOCK_QUEUE_H
 
-#include <iostream>
 #include <stdlib.h>
-#include <thread>
+#include <stdint.h>
+#include <time.h>
 #include <atomic>
-#include <queue>
-#include <mutex>
-#include <condition_variable>
+#include <memory>
+#include <utility>
 #include <chrono>
+#include <string>
 #include "../lock/locker.h"
 
 /**
- *    阻塞队列
- *    双缓冲队列： 一个生产者队列，一个消费者队列，消费者队列为空时，交换生产者与消费者队列
+ *    有界阻塞队列
+ *    无锁多生产者多消费者环形队列(Vyukov)：每个槽位带序号，生产者与消费者各自CAS推进位置
+ *       try_push / try_pop     非阻塞，队列满/空时立即返回false
+ *       push / pop             阻塞，队列满/空时通过futex休眠等待
+ *       push_batch / pop_batch 批量操作，一批只唤醒一次对端
+ *    容量严格等于 max_size，队列满时由调用者决定丢弃、回退或阻塞(背压)
 */
 
 template< typename T>
 class block_queue
 {
 public:
-    block_queue(int max_size = 1000) : m_size(0), nonblock(false)
+    // name 为 LOCK_PROFILE 模式下两个休眠器统计的名字前缀
+    block_queue(int max_size = 1000, const char *name = "queue")
+        : m_enqueue_pos(0), m_dequeue_pos(0), m_closed(false),
+          m_not_empty((std::string(name) + ".not_empty").c_str()), m_not_full((std::string(name) + ".not_full").c_str())
     {
         if(max_size <= 0)
         {
             exit(-1);
         }
-        m_max_size = 1000;
+        m_max_size = max_size;
+        m_cells.reset(new cell[m_max_size]);
+        for(int i = 0; i < m_max_size; ++i)
+        {
+            m_cells[i].seq.store(i, std::memory_order_relaxed);
+        }
     }
 
     ~block_queue() {}
 
+    // 关闭队列，唤醒所有阻塞的生产者与消费者
     void clear()
     {
-        std::lock_guard<std::mutex> lock(producerMutex);
-        nonblock = true;
-        not_empty.notify_all();
+        m_closed.store(true);
+        m_not_empty.notify(INT32_MAX);
+        m_not_full.notify(INT32_MAX);
     }
     
     // 判断是否队列已满
     bool full()
     {
-        int tmp = m_size.load(std::memory_order_seq_cst);
-        return tmp == m_max_size;
+        return size() >= m_max_size;
     }
 
     // 判断队列是否为空
     bool empty()
     {
-        return m_size.load(std::memory_order_seq_cst) == 0;
+        return size() <= 0;
     }
 
     int size()
     {
-        int tmp = m_size.load(std::memory_order_seq_cst);
-        return tmp;
+        size_t tail = m_enqueue_pos.load(std::memory_order_acquire);
+        size_t head = m_dequeue_pos.load(std::memory_order_acquire);
+        intptr_t n = (intptr_t)(tail - head);
+        if(n < 0)
+            return 0;
+        return n > m_max_size ? m_max_size : (int)n;
     }
 
     int max_size()
@@ -62,75 +78,209 @@ public:
         return m_max_size;
     }
 
-    /**
-     *  往队尾添加元素，需要将所有消费队列元素的线程唤醒
-     *  队列放入元素相当于生产者生产一个元素
-    */
-   bool push(const T& item)
-   {
-        std::unique_lock<std::mutex> lock(producerMutex);
-        producerQueue.push(item);
-        m_size.fetch_add(1, std::memory_order_seq_cst);
-        not_empty.notify_one();
+    /* 非阻塞放入，队列满时返回false */
+    bool try_push(const T& item)
+    {
+        if(!enqueue(item))
+            return false;
+        m_not_empty.notify(1);
         return true;
-   }
+    }
 
-    bool pop(T &item)
+    bool try_push(T&& item)
     {
-        std::unique_lock<std::mutex> lock(consumerMutex);
-        if(consumerQueue.empty() && swapQueue() == 0) {
+        if(!enqueue(std::move(item)))
             return false;
+        m_not_empty.notify(1);
+        return true;
+    }
+
+    /* 阻塞放入，队列满时等待消费者取走元素，队列关闭时返回false */
+    bool push(const T& item)
+    {
+        while(!enqueue(item))
+        {
+            if(!wait_not_full())
+                return false;
         }
-        item = consumerQueue.front();
-        consumerQueue.pop();
-        m_size.fetch_add(-1, std::memory_order_seq_cst);
+        m_not_empty.notify(1);
         return true;
     }
 
-    // 增加了超时处理
-    bool pop(T &item, std::chrono::milliseconds timeout) {
-        std::unique_lock<std::mutex> lock(consumerMutex);
-        if(consumerQueue.empty() && swapQueue(timeout) == 0) {
+    /* 批量非阻塞放入，返回实际放入的数量，只唤醒一次消费者 */
+    int push_batch(const T* items, int n)
+    {
+        int i = 0;
+        while(i < n && enqueue(items[i]))
+            ++i;
+        if(i > 0)
+            m_not_empty.notify(i);
+        return i;
+    }
+
+    /* 非阻塞取出，队列空时返回false */
+    bool try_pop(T &item)
+    {
+        if(!dequeue(item))
             return false;
+        m_not_full.notify(1);
+        return true;
+    }
+
+    /* 阻塞取出，队列关闭且为空时返回false */
+    bool pop(T &item)
+    {
+        while(!dequeue(item))
+        {
+            if(!wait_not_empty(NULL))
+                return false;
         }
-        item = consumerQueue.front();
-        consumerQueue.pop();
-        m_size.fetch_add(-1, std::memory_order_seq_cst);
+        m_not_full.notify(1);
         return true;
     }
 
-    // 交换消费者队列与生产者队列
-    int swapQueue() {
-        std::unique_lock<std::mutex> lock(producerMutex);
-        not_empty.wait(lock, [this] { return !producerQueue.empty() || nonblock; });
-        std::swap(producerQueue, consumerQueue);
-        return consumerQueue.size();
+    // 增加了超时处理
+    bool pop(T &item, std::chrono::milliseconds timeout)
+    {
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + timeout;
+        while(!dequeue(item))
+        {
+            std::chrono::nanoseconds left = deadline - std::chrono::steady_clock::now();
+            if(left.count() <= 0)
+                return false;
+
+            struct timespec ts;
+            ts.tv_sec = left.count() / 1000000000;
+            ts.tv_nsec = left.count() % 1000000000;
+            if(!wait_not_empty(&ts))
+                return false;
+        }
+        m_not_full.notify(1);
+        return true;
     }
 
-    // 增加了超时返回
-    int swapQueue(std::chrono::milliseconds timeout){
-        std::unique_lock<std::mutex> lock(producerQueue);
-        not_empty.wait_for(lock, timeout, [this] { return !producerQueue.empty() || nonblock; });
-        std::swap(producerQueue, consumerQueue);
-        return consumerQueue.size();
+    /* 批量非阻塞取出，返回实际取出的数量 */
+    int pop_batch(T* items, int max)
+    {
+        int i = 0;
+        while(i < max && dequeue(items[i]))
+            ++i;
+        if(i > 0)
+            m_not_full.notify(i);
+        return i;
     }
 
 private:
-    // 互斥锁，实现线程安全访问队列
-    std::mutex producerMutex;       // 生产者互斥锁
-    std::mutex consumerMutex;       // 消费者互斥锁
-    std::condition_variable not_empty;  // 条件变量
+    struct cell
+    {
+        std::atomic<size_t> seq;    // 槽位序号: 等于pos时可写，等于pos+1时可读
+        T data;
+    };
 
-    bool nonblock;      // 是否启用工作队列
+    template<typename U>
+    bool enqueue(U&& item)
+    {
+        size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        cell *c;
+        while(true)
+        {
+            c = &m_cells[pos % m_max_size];
+            size_t seq = c->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if(diff == 0)
+            {
+                if(m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if(diff < 0)
+            {
+                // 槽位还未被消费，队列已满
+                return false;
+            }
+            else
+            {
+                pos = m_enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        c->data = std::forward<U>(item);
+        c->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
 
-    std::queue<T> producerQueue;    // 生产者队列
-    std::queue<T> consumerQueue;    // 消费者队列
+    bool dequeue(T &item)
+    {
+        size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        cell *c;
+        while(true)
+        {
+            c = &m_cells[pos % m_max_size];
+            size_t seq = c->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if(diff == 0)
+            {
+                if(m_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if(diff < 0)
+            {
+                // 槽位还未被写入，队列为空
+                return false;
+            }
+            else
+            {
+                pos = m_dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        item = std::move(c->data);
+        c->seq.store(pos + m_max_size, std::memory_order_release);
+        return true;
+    }
 
-    // 队列最大容量
-    int m_max_size;
-    // 队列中的元素, 使用原子序列
-    std::atomic<int> m_size;
-    
+    // 等待队列非空，队列关闭或超时返回false
+    bool wait_not_empty(const struct timespec *timeout)
+    {
+        uint32_t epoch = m_not_empty.prepare_wait();
+        if(!empty())
+        {
+            m_not_empty.cancel_wait();
+            return true;
+        }
+        if(m_closed.load())
+        {
+            m_not_empty.cancel_wait();
+            return false;
+        }
+        m_not_empty.wait(epoch, timeout);
+        return !m_closed.load() || !empty();
+    }
+
+    // 等待队列非满，队列关闭返回false
+    bool wait_not_full()
+    {
+        uint32_t epoch = m_not_full.prepare_wait();
+        if(!full())
+        {
+            m_not_full.cancel_wait();
+            return true;
+        }
+        if(m_closed.load())
+        {
+            m_not_full.cancel_wait();
+            return false;
+        }
+        m_not_full.wait(epoch);
+        return !m_closed.load();
+    }
+
+private:
+    // 生产者与消费者位置分属不同缓存行，避免伪共享
+    alignas(64) std::atomic<size_t> m_enqueue_pos;
+    alignas(64) std::atomic<size_t> m_dequeue_pos;
+    alignas(64) std::unique_ptr<cell[]> m_cells;
+    int m_max_size;                 // 队列最大容量
+    std::atomic<bool> m_closed;     // 队列是否关闭
+    parker m_not_empty;             // 消费者等待
+    parker m_not_full;              // 生产者等待
 };
 
 #endif
@@ -1,41 +1,161 @@
 #include <string.h>
 #include <time.h>
+#include <errno.h>
+#include <unistd.h>
 #include <sys/time.h>
+#include <sys/uio.h>
+#include <stdint.h>
 #include <stdarg.h>
 #include "log.h"
+#include "../metrics/alloc_profile.h"
 #include <pthread.h>
 
-Log::Log()
+/* 线程日志缓冲区：所属线程写入、写线程读出的单生产者单消费者环形缓冲区 */
+struct log_buffer
 {
+    char *ring;                             // 环形缓冲区，大小为2的幂，同步模式下为空
+    size_t mask;
+    alignas(64) std::atomic<size_t> head;   // 写入位置，只由所属线程推进
+    alignas(64) std::atomic<size_t> tail;   // 落盘位置，只由写线程推进
+    std::atomic<bool> closed;               // 所属线程已退出，写完后由写线程释放
+    char *line;                             // 单条日志的格式化缓冲区
+    time_t sec;                             // 时间前缀对应的秒
+    struct tm tm;
+    char prefix[32];                        // 格式化好的 "年-月-日 时:分:秒."
+    int prefix_len;
+
+    log_buffer(size_t ring_size, int line_size)
+        : ring(ring_size ? new char[ring_size] : NULL), mask(ring_size - 1),
+          head(0), tail(0), closed(false), line(new char[line_size]), sec(-1), prefix_len(0)
+    {
+    }
+    ~log_buffer()
+    {
+        delete[] ring;
+        delete[] line;
+    }
+};
+
+/* 线程退出时交给写线程回收缓冲区，同步模式的缓冲区未登记，直接释放 */
+struct log_buffer_holder
+{
+    log_buffer *buf;
+
+    log_buffer_holder() : buf(NULL) {}
+    ~log_buffer_holder()
+    {
+        if(buf && buf->ring)
+            buf->closed.store(true, std::memory_order_release);
+        else
+            delete buf;
+    }
+};
+
+static thread_local log_buffer_holder t_buffer[Log::MAX_INSTANCES];
+
+static const char *level_name[] = { "[debug]: ", "[info]: ", "[warn]: ", "[error]: " };
+static const int level_len[] = { 9, 8, 8, 9 };
+
+// 写入全部数据，写失败时丢弃本批日志
+static void write_all(int fd, struct iovec *iov, int cnt)
+{
+    while(cnt > 0)
+    {
+        ssize_t n = writev(fd, iov, cnt);
+        if(n < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            return;
+        }
+        while(cnt > 0 && (size_t)n >= iov->iov_len)
+        {
+            n -= iov->iov_len;
+            ++iov;
+            --cnt;
+        }
+        if(cnt > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+// 追加一条二进制记录
+static void put_record(std::string &out, char type, const void *payload, uint32_t len)
+{
+    out += type;
+    out.append((const char *)&len, 4);
+    out.append((const char *)payload, len);
+}
+
+// 统计环形缓冲区 [tail, head) 中的二进制记录条数
+static long long count_records(const char *ring, size_t mask, size_t tail, size_t head)
+{
+    long long n = 0;
+    while(tail < head)
+    {
+        uint32_t len;
+        char *p = (char *)&len;
+        for(int i = 0; i < 4; ++i)
+            p[i] = ring[(tail + 1 + i) & mask];
+        tail += LOG_RECORD_HEAD + len;
+        ++n;
+    }
+    return n;
+}
+
+Log::Log(int slot) : m_slot(slot), m_mutex(slot ? "access_log" : "log"), m_parker(slot ? "access_log_writer" : "log_writer"), m_stop(false), m_level(LOG_MIN_LEVEL), m_dropped(0), m_opened(false), m_format_num(0), m_format_lock("log_format")
+{
+    for(int i = 0; i < LOG_MODULE_NUM; ++i)
+        m_module_level[i] = -1;
+    update_levels();
     m_count = 0;
     m_is_async = false;
+    m_fp = NULL;
+    m_log_buf_size = 8192;
+    m_ring_size = 0;
+    m_reported = 0;
+    m_binary = false;
+    m_formats_written = 0;
+    m_header_pending = true;
 }
 
 Log::~Log()
 {
+    if(m_writer.joinable())
+    {
+        m_stop.store(true);
+        m_parker.notify(1);
+        m_writer.join();
+    }
     if(m_fp != NULL)
     {
         fclose(m_fp);
     }
+    m_archiver.stop();
 }
 
-// 异步写日志需要阻塞队列，同步则不需要
-bool Log::init(const char* file_name, int close_log, int log_buf_size, int split_line, int max_queue_size)
+// 异步写日志需要后台写线程，同步则不需要
+bool Log::init(const char* file_name, int close_log, int log_buf_size, int split_line, int max_queue_size, bool binary,
+               int compress_level, long long max_total_size, int max_days)
 {
+    m_binary = binary;
+
     // 如果设置了max_queue_size, 则设置为异步
     if(max_queue_size >= 1)
     {
+        // 按平均每条日志128字节估算每个线程缓冲区的大小
         m_is_async = true;
-        m_log_queue = new block_queue<std::string>(max_queue_size);
-        pthread_t tid;
-        // fluseh_log_thread 回调函数，让写线程执行写函数命令
-        pthread_create(&tid, NULL, flush_log_thread, NULL);
+        m_ring_size = MIN_BUFFER_SIZE;
+        while(m_ring_size < (size_t)max_queue_size * 128)
+            m_ring_size <<= 1;
     }
 
-    m_close_log = m_close_log;
-    m_log_buf_size = log_buf_size;
-    m_buf = new char[m_log_buf_size];
-    memset(m_buf, '\0', m_log_buf_size);
+    m_close_log = close_log;
+    // 至少容纳 LOG_MAX_ARGS 个数值参数的二进制记录
+    m_log_buf_size = log_buf_size > 512 ? log_buf_size : 512;
     m_split_lines = split_line;
 
     time_t t = time(NULL);
@@ -47,126 +167,583 @@ bool Log::init(const char* file_name, int close_log, int log_buf_size, int split
 
     if(p == NULL)
     {
-        snprintf(log_full_name, 255, "%d_%02d_%02d_%s", my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday, file_name);
+        snprintf(log_name, sizeof(log_name), "%s", file_name);
+        dir_name[0] = '\0';
     }else {
-        strcpy(log_name, p + 1);
-        strncpy(dir_name, file_name, p - file_name + 1);
-        snprintf(log_full_name, 255, "%s%d_%02d_%02d_%s", dir_name, my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday, log_name);
+        snprintf(log_name, sizeof(log_name), "%s", p + 1);
+        snprintf(dir_name, sizeof(dir_name), "%.*s", (int)(p - file_name + 1), file_name);
     }
 
     // 更新当前日期
     m_today = my_tm.tm_mday;
 
-    m_fp = fopen(log_full_name, "a");
+    // 按切分文件大小预分配，平均每条日志按128字节估算
+    // 启动时先把当天的日志文件交给整理线程，整理上次运行留下的文件时不会压缩或删除它
+    long long prealloc = (long long)split_line * 128;
+    log_file_name(log_full_name, my_tm, 0);
+    m_archiver.start(dir_name, log_name, log_full_name, compress_level, max_total_size, max_days,
+                     prealloc < MAX_PREALLOC ? prealloc : MAX_PREALLOC);
+
+    m_fp = m_archiver.open(log_full_name);
     if(m_fp == NULL)
     {
         return false;
     }
+    log_file_name(log_full_name, my_tm, 1);
+    m_archiver.prepare(log_full_name);
 
+    // 关闭日志时不会调用init，没有硬编码 m_close_log 的模块也不会写入未打开的文件
+    m_opened = true;
+    update_levels();
+
+    if(m_is_async)
+    {
+        // 写线程负责把各线程缓冲区中的日志写入文件
+        m_writer = std::thread(&Log::async_write_log, this);
+    }
     return true;
 }
 
+log_buffer *Log::local_buffer()
+{
+    log_buffer *buf = t_buffer[m_slot].buf;
+    if(buf)
+        return buf;
+
+    buf = new log_buffer(m_is_async ? m_ring_size : 0, m_log_buf_size);
+    t_buffer[m_slot].buf = buf;
+    if(m_is_async)
+    {
+        m_mutex.lock();
+        m_buffers.push_back(buf);
+        m_mutex.unlock();
+    }
+    return buf;
+}
+
 // 写日志函数
-void Log::write_log(int level, const char *format, ...)
+void Log::write_log(int level, int id, const char *format, ...)
 {
+    alloc_scope alloc(ALLOC_LOG);
     struct timeval now = {0, 0};
     gettimeofday(&now, NULL);
-    time_t t = now.tv_sec;
-    struct tm *sys_tm = localtime(&t);
-    struct tm my_tm = *sys_tm;
-    char s[16] = {0};
+
+    // 格式化到当前线程的缓冲区，不需要加锁
+    log_buffer *buf = local_buffer();
+    char *line = buf->line;
+
+    // 二进制格式只保存格式ID、时间戳与原始参数
+    if(m_binary && id >= 0)
+    {
+        va_list valst;
+        va_start(valst, format);
+        int len = encode_record(line, m_log_buf_size, id, now.tv_sec * 1000000LL + now.tv_usec, valst);
+        va_end(valst);
+
+        if(m_is_async)
+        {
+            append(buf, line, len);
+            return;
+        }
+
+        if(now.tv_sec != buf->sec)
+        {
+            buf->sec = now.tv_sec;
+            localtime_r(&buf->sec, &buf->tm);
+        }
+        std::string formats;
+        m_mutex.lock();
+        split_file(buf->tm, 1);
+        pending_formats(formats);
+        fwrite(formats.data(), 1, formats.size(), m_fp);
+        fwrite(line, 1, len, m_fp);
+        fflush(m_fp);
+        m_mutex.unlock();
+        return;
+    }
+
+    // 秒数变化时才重新计算日期并格式化前缀
+    if(now.tv_sec != buf->sec)
+    {
+        buf->sec = now.tv_sec;
+        localtime_r(&buf->sec, &buf->tm);
+        buf->prefix_len = snprintf(buf->prefix, sizeof(buf->prefix), "%d-%02d-%02d %02d:%02d:%02d.",
+                                   buf->tm.tm_year + 1900, buf->tm.tm_mon + 1, buf->tm.tm_mday,
+                                   buf->tm.tm_hour, buf->tm.tm_min, buf->tm.tm_sec);
+    }
+
+    // 写入具体时间内容格式
+    int n = buf->prefix_len;
+    memcpy(line, buf->prefix, n);
+    long us = now.tv_usec;
+    for(int i = 5; i >= 0; --i, us /= 10)
+        line[n + i] = '0' + us % 10;
+    n += 6;
+    line[n++] = ' ';
 
     // 选择写入等级
-    switch(level)
+    if(level < 0 || level > 3)
+        level = 1;
+    memcpy(line + n, level_name[level], level_len[level]);
+    n += level_len[level];
+
+    va_list valst;
+    va_start(valst, format);
+
+    // 具体时间格式 + 写入内容，超出缓冲区的部分截断
+    int m = vsnprintf(line + n, m_log_buf_size - n - 1, format, valst);
+    if(m < 0)
+        m = 0;
+    else if(m > m_log_buf_size - n - 2)
+        m = m_log_buf_size - n - 2;
+    line[n + m] = '\n';
+    line[n + m + 1] = '\0';
+
+    va_end(valst);
+
+    if(m_is_async)
     {
-        case 0:
-            strcpy(s, "[debug]:");
-            break;
-        
-        case 1:
-            strcpy(s, "[info]:");
-            break;
-        
-        case 2:
-            strcpy(s, "[warn]:");
-            break;
-        
-        case 3:
-            strcpy(s, "[error]:");
-            break;
-        
-        default:
-            strcpy(s, "[info]:");
-            break;
+        append(buf, line, n + m + 1);
+        return;
     }
 
-    // 写入一个日志，对当天日志写入数量 m_count++
     m_mutex.lock();
-    m_count++;
+    split_file(buf->tm, 1);
+    fputs(line, m_fp);
+    fflush(m_fp);
+    m_mutex.unlock();
+}
 
-    // 判断写入哪天的日志，当天日志数量超出则，新建一个日志文件
-    if(m_today != my_tm.tm_mday || m_count % m_split_lines == 0)
+int Log::register_format(int level, int module, const char *format)
+{
+    m_format_lock.lock();
+    int id = m_format_num.load(std::memory_order_relaxed);
+    if(id >= MAX_FORMATS)
     {
-        char new_log[256] = {0};
-        // 将缓冲区为写入剩余内容写入以前日志
-        fflush(m_fp);
-        fclose(m_fp);
-        char tail[16] = {0};
+        // 超出上限的调用点按文本格式写入
+        m_format_lock.unlock();
+        return -1;
+    }
+
+    log_format_def &def = m_formats[id];
+    def.format = format;
+    def.level = level;
+    def.module = module;
+    def.nargs = log_parse_format(format, def.types);
+    m_format_num.store(id + 1, std::memory_order_release);
+    m_format_lock.unlock();
+    return id;
+}
+
+int Log::encode_record(char *out, int size, int id, long long ts, va_list ap)
+{
+    const log_format_def &def = m_formats[id];
+    char *p = out + LOG_RECORD_HEAD;
+    char *end = out + size;
+    uint32_t uid = id;
+    memcpy(p, &uid, 4);
+    memcpy(p + 4, &ts, 8);
+    p += 12;
 
-        snprintf(tail, 16, "%d_%02d_%02d", my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday);
+    if(LOG_ARGS_TEXT == def.nargs)
+    {
+        // 不支持的格式说明，写入格式化后的文本
+        long room = end - p - 2 < 65535 ? end - p - 2 : 65535;
+        int n = vsnprintf(p + 2, room, def.format, ap);
+        if(n < 0)
+            n = 0;
+        else if(n > room - 1)
+            n = room - 1;
+        uint16_t len = n;
+        memcpy(p, &len, 2);
+        p += 2 + n;
+    }
 
-        if(m_today != my_tm.tm_mday)
+    for(int i = 0; LOG_ARGS_TEXT != def.nargs && i < def.nargs; ++i)
+    {
+        int64_t v = 0;
+        switch(def.types[i])
         {
-            snprintf(new_log, 255, "%s%s%s", dir_name, tail, log_name);
-            m_today = my_tm.tm_mday;
-            m_count = 0;
-        }else {
-            snprintf(new_log, 255, "%s%s%s.%lld", dir_name, tail, log_name, m_count / m_split_lines);
+            case LOG_ARG_INT:
+                v = va_arg(ap, int);
+                break;
+            case LOG_ARG_LONG:
+                v = va_arg(ap, long);
+                break;
+            case LOG_ARG_LLONG:
+                v = va_arg(ap, long long);
+                break;
+            case LOG_ARG_PTR:
+                v = (int64_t)(intptr_t)va_arg(ap, void *);
+                break;
+            case LOG_ARG_DOUBLE:
+            {
+                double d = va_arg(ap, double);
+                memcpy(&v, &d, 8);
+                break;
+            }
+            case LOG_ARG_STR:
+            {
+                // 为后面的参数预留空间，字符串过长时截断
+                const char *s = va_arg(ap, const char *);
+                if(!s)
+                    s = "(null)";
+                long room = end - p - 2 - 8 * (def.nargs - i - 1);
+                long n = strlen(s);
+                if(n > room)
+                    n = room > 0 ? room : 0;
+                if(n > 65535)
+                    n = 65535;
+                uint16_t len = n;
+                memcpy(p, &len, 2);
+                memcpy(p + 2, s, n);
+                p += 2 + n;
+                continue;
+            }
         }
-        // 打开新的日志文件
-        m_fp = fopen(new_log, "a");
+        memcpy(p, &v, 8);
+        p += 8;
     }
 
-    m_mutex.unlock();
+    out[0] = 'R';
+    uint32_t len = p - out - LOG_RECORD_HEAD;
+    memcpy(out + 1, &len, 4);
+    return p - out;
+}
 
-    va_list valst;
-    va_start(valst, format);
+void Log::pending_formats(std::string &out)
+{
+    if(m_header_pending)
+    {
+        char head[7];
+        memcpy(head, LOG_BINARY_MAGIC, 6);
+        head[6] = LOG_BINARY_VERSION;
+        put_record(out, 'H', head, 7);
+        m_formats_written = 0;
+        m_header_pending = false;
+    }
 
-    std::string log_str;
-    m_mutex.lock();
+    int num = m_format_num.load(std::memory_order_acquire);
+    for(; m_formats_written < num; ++m_formats_written)
+    {
+        const log_format_def &def = m_formats[m_formats_written];
+        std::string payload;
+        uint32_t id = m_formats_written;
+        payload.append((const char *)&id, 4);
+        payload += def.level;
+        payload += def.module;
+        payload += (char)def.nargs;
+        if(LOG_ARGS_TEXT != def.nargs)
+            payload.append(def.types, def.nargs);
+        payload += def.format;
+        put_record(out, 'F', payload.data(), payload.size());
+    }
+}
 
-    // 写入具体时间内容格式
-    int n = snprintf(m_buf, 48, "%d-%02d-%02d %02d:%02d:%02d.%06ld %s ", 
-    my_tm.tm_yday + 1900, my_tm.tm_mon + 1, my_tm.tm_mday,
-    my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec, now.tv_sec, s);
+// 追加到环形缓冲区，空间不足时丢弃
+void Log::append(log_buffer *buf, const char *line, int len)
+{
+    size_t cap = buf->mask + 1;
+    size_t head = buf->head.load(std::memory_order_relaxed);
+    size_t used = head - buf->tail.load(std::memory_order_acquire);
+    if(used + len > cap)
+    {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
 
-    // 具体时间格式 + 写入内容
-    int m = vsnprintf(m_buf + n, m_log_buf_size - n - 1, format, valst);
-    m_buf[n + m] = '\n';
-    m_buf[n + m + 1] = '\0';
-    log_str = m_buf;
+    size_t off = head & buf->mask;
+    size_t first = cap - off < (size_t)len ? cap - off : len;
+    memcpy(buf->ring + off, line, first);
+    memcpy(buf->ring, line + first, len - first);
+    buf->head.store(head + len, std::memory_order_release);
 
+    // 缓冲区刚超过一半时唤醒写线程，其余情况等待定时刷新
+    if(used < cap / 2 && used + len >= cap / 2)
+        m_parker.notify(1);
+}
+
+void Log::async_write_log()
+{
+    alloc_scope alloc(ALLOC_LOG);
+    while(true)
+    {
+        // 先登记再写入，写入期间的唤醒不会丢失
+        uint32_t epoch = m_parker.prepare_wait();
+        flush_buffers();
+        if(m_stop.load())
+        {
+            m_parker.cancel_wait();
+            break;
+        }
+
+        struct timespec ts;
+        ts.tv_sec = 0;
+        ts.tv_nsec = FLUSH_INTERVAL_MS * 1000000L;
+        m_parker.wait(epoch, &ts);
+    }
+    // 退出前写完剩余日志
+    flush_buffers();
+}
+
+void Log::flush_buffers()
+{
+    m_mutex.lock();
+    std::vector<log_buffer *> bufs(m_buffers);
     m_mutex.unlock();
 
-    if(m_is_async && !m_log_queue->full())
+    time_t t = time(NULL);
+    struct tm my_tm;
+    localtime_r(&t, &my_tm);
+
+    // 每组缓冲区用一次writev写入
+    const size_t GROUP = 64;
+    std::vector<log_buffer *> drained;
+    for(size_t begin = 0; begin < bufs.size(); begin += GROUP)
+    {
+        size_t end = begin + GROUP < bufs.size() ? begin + GROUP : bufs.size();
+        struct iovec iov[2 * GROUP + 1];
+        size_t heads[GROUP];
+        int cnt = 1;
+        long long lines = 0;
+        for(size_t i = begin; i < end; ++i)
+        {
+            log_buffer *buf = bufs[i];
+            // 先读退出标志再读写入位置，所属线程退出前写入的日志都能看到
+            if(buf->closed.load(std::memory_order_acquire))
+                drained.push_back(buf);
+
+            size_t head = buf->head.load(std::memory_order_acquire);
+            size_t tail = buf->tail.load(std::memory_order_relaxed);
+            heads[i - begin] = head;
+            if(head == tail)
+                continue;
+
+            if(m_binary)
+                lines += count_records(buf->ring, buf->mask, tail, head);
+
+            size_t cap = buf->mask + 1;
+            size_t off = tail & buf->mask;
+            size_t len = head - tail;
+            size_t first = cap - off < len ? cap - off : len;
+            iov[cnt].iov_base = buf->ring + off;
+            iov[cnt++].iov_len = first;
+            if(len > first)
+            {
+                iov[cnt].iov_base = buf->ring;
+                iov[cnt++].iov_len = len - first;
+            }
+        }
+        if(1 == cnt)
+            continue;
+
+        for(int i = 1; i < cnt && !m_binary; ++i)
+        {
+            const char *p = (const char *)iov[i].iov_base;
+            const char *last = p + iov[i].iov_len;
+            while((p = (const char *)memchr(p, '\n', last - p)) != NULL)
+            {
+                ++lines;
+                ++p;
+            }
+        }
+
+        // 二进制格式先写入本批记录用到的格式定义，格式在记录写入缓冲区之前已注册
+        split_file(my_tm, lines);
+        std::string formats;
+        if(m_binary)
+            pending_formats(formats);
+        iov[0].iov_base = (void *)formats.data();
+        iov[0].iov_len = formats.size();
+        write_all(fileno(m_fp), iov, cnt);
+        for(size_t i = begin; i < end; ++i)
+            bufs[i]->tail.store(heads[i - begin], std::memory_order_release);
+    }
+
+    long long dropped = m_dropped.load(std::memory_order_relaxed);
+    if(dropped != m_reported)
     {
-        m_log_queue->push(log_str);
+        char msg[128];
+        int len;
+        if(m_binary)
+        {
+            int64_t payload[2] = { (int64_t)t * 1000000, dropped - m_reported };
+            msg[0] = 'D';
+            uint32_t plen = sizeof(payload);
+            memcpy(msg + 1, &plen, 4);
+            memcpy(msg + LOG_RECORD_HEAD, payload, sizeof(payload));
+            len = LOG_RECORD_HEAD + sizeof(payload);
+        }
+        else
+        {
+            len = snprintf(msg, sizeof(msg), "%d-%02d-%02d %02d:%02d:%02d [warn]: log buffer full, %lld lines dropped\n",
+                           my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday,
+                           my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec, dropped - m_reported);
+        }
+        struct iovec iov = { msg, (size_t)len };
+        split_file(my_tm, 1);
+        std::string formats;
+        if(m_binary)
+            pending_formats(formats);
+        struct iovec iovs[2] = { { (void *)formats.data(), formats.size() }, iov };
+        write_all(fileno(m_fp), iovs, 2);
+        m_reported = dropped;
     }
-    else {
+
+    // 回收已退出线程的缓冲区
+    if(!drained.empty())
+    {
         m_mutex.lock();
-        fputs(log_str.c_str(), m_fp);
+        for(size_t i = 0; i < drained.size(); ++i)
+        {
+            for(size_t j = 0; j < m_buffers.size(); ++j)
+            {
+                if(m_buffers[j] == drained[i])
+                {
+                    m_buffers[j] = m_buffers.back();
+                    m_buffers.pop_back();
+                    break;
+                }
+            }
+            delete drained[i];
+        }
         m_mutex.unlock();
     }
+}
+
+void Log::log_file_name(char *out, const struct tm &my_tm, long long index)
+{
+    int n = snprintf(out, 256, "%s%d_%02d_%02d_%s", dir_name, my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday, log_name);
+    if(index > 0 && n < 256)
+        snprintf(out + n, 256 - n, ".%lld", index);
+}
+
+// 判断写入哪天的日志，当天日志数量超出则，新建一个日志文件
+// 同步模式下由m_mutex保护，异步模式下只在写线程调用
+void Log::split_file(const struct tm &my_tm, long long lines)
+{
+    long long before = m_count;
+    m_count += lines;
+    if(m_today == my_tm.tm_mday && before / m_split_lines == m_count / m_split_lines)
+        return;
+
+    char new_log[256] = {0};
+    long long index = 0;
+    if(m_today != my_tm.tm_mday)
+    {
+        m_today = my_tm.tm_mday;
+        m_count = 0;
+    }else {
+        index = m_count / m_split_lines;
+    }
+    log_file_name(new_log, my_tm, index);
 
-    va_end(valst);
+    // 新文件通常已由整理线程打开，旧文件交给整理线程关闭，这里不做关闭与创建文件的磁盘操作
+    FILE *fp = m_archiver.open(new_log);
+    if(fp == NULL)
+        return;
+    if(!m_is_async)
+        fflush(m_fp);
+    m_archiver.retire(m_fp);
+    m_fp = fp;
+    m_header_pending = true;
+
+    log_file_name(new_log, my_tm, index + 1);
+    m_archiver.prepare(new_log);
+}
+
+static const char *module_name[] = { "server", "http", "timer", "pool", "sql" };
+static const char *level_text[] = { "debug", "info", "warn", "error", "off" };
+
+static int parse_level(const char *str, size_t len)
+{
+    for(int i = LOG_LEVEL_DEBUG; i <= LOG_LEVEL_OFF; ++i)
+    {
+        if(strlen(level_text[i]) == len && 0 == strncasecmp(str, level_text[i], len))
+            return i;
+    }
+    return -1;
+}
+
+void Log::update_levels()
+{
+    for(int i = 0; i < LOG_MODULE_NUM; ++i)
+    {
+        int level = m_module_level[i] >= 0 ? m_module_level[i] : m_level;
+        m_effective[i].store(m_opened ? level : LOG_LEVEL_OFF, std::memory_order_relaxed);
+    }
+}
+
+void Log::set_level(int level)
+{
+    if(level < LOG_LEVEL_DEBUG)
+        level = LOG_LEVEL_DEBUG;
+    if(level > LOG_LEVEL_OFF)
+        level = LOG_LEVEL_OFF;
+
+    m_mutex.lock();
+    m_level = level;
+    update_levels();
+    m_mutex.unlock();
+}
+
+bool Log::set_levels(const char *spec)
+{
+    int level = m_level;
+    int module_level[LOG_MODULE_NUM];
+    for(int i = 0; i < LOG_MODULE_NUM; ++i)
+        module_level[i] = m_module_level[i];
+
+    // 逗号分隔，不带模块名的项设置全局级别
+    const char *p = spec;
+    while(*p)
+    {
+        const char *end = strchr(p, ',');
+        if(!end)
+            end = p + strlen(p);
+        const char *eq = (const char *)memchr(p, '=', end - p);
+        if(!eq)
+        {
+            level = parse_level(p, end - p);
+            if(level < 0)
+                return false;
+        }
+        else
+        {
+            int module = -1;
+            for(int i = 0; i < LOG_MODULE_NUM; ++i)
+            {
+                if(strlen(module_name[i]) == (size_t)(eq - p) && 0 == strncasecmp(p, module_name[i], eq - p))
+                    module = i;
+            }
+            int l = parse_level(eq + 1, end - eq - 1);
+            if(module < 0 || l < 0)
+                return false;
+            module_level[module] = l;
+        }
+        p = *end ? end + 1 : end;
+    }
+
+    m_mutex.lock();
+    m_level = level;
+    for(int i = 0; i < LOG_MODULE_NUM; ++i)
+        m_module_level[i] = module_level[i];
+    update_levels();
+    m_mutex.unlock();
+    return true;
 }
 
 void Log::flush(void)
 {
+    if(m_is_async)
+    {
+        // 唤醒写线程尽快写入
+        m_parker.notify(1);
+        return;
+    }
+
     m_mutex.lock();
     // 强制刷新写入流缓冲区中
     fflush(m_fp);
     m_mutex.unlock();
 }
-
-
@@ -3,76 +3,171 @@
 
 /**
  *   同步/异步日志系统
- *   1. 日志模块： 实现同步/异步的日志写入
- *   2. 阻塞队列模块： 主要解决异步日志写入的准备
+ *   1. 同步模式： 写日志的线程直接写入文件并刷新
+ *   2. 异步模式： 每个线程把日志追加到自己预分配的环形缓冲区，不加锁；
+ *                后台写线程定时或在缓冲区过半时收集所有线程的缓冲区，用一次writev批量写入文件
+ *                缓冲区满时丢弃日志并计数，由写线程写入一条丢弃统计
+ *   3. 每个线程缓存格式化好的日期前缀，秒数变化时才重新格式化
+ *   4. 日志级别：编译期最低级别 LOG_MIN_LEVEL 以下的调用在编译时移除；
+ *                运行时按模块(http、timer、pool、sql)设置级别，低于级别的调用只有一次判断，参数不会被求值
+ *   5. 二进制格式：每个调用点的格式串首次执行时注册一个ID，记录中只保存ID、时间戳和原始参数，
+ *                不做格式化，由 log_decode 工具还原为文本或JSON，格式见 log_format.h
+ *   6. 按天或行数切分的文件由整理线程提前打开，切换下来的文件由整理线程关闭、压缩并按保留策略删除，见 log_archive.h
 */
 
 #include <stdio.h>
 #include <iostream>
 #include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
 #include <stdarg.h>
 #include <pthread.h>
-#include "block_queue.h"
+#include "../lock/locker.h"
+#include "log_format.h"
+#include "log_archive.h"
+
+struct log_buffer;          // 线程日志缓冲区
+
+// 编译期最低日志级别，release构建设为2(warn)，debug/info日志不会编译进程序
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL 0
+#endif
+
+enum LOG_LEVEL
+{
+    LOG_LEVEL_DEBUG = 0,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_OFF
+};
+
+enum LOG_MODULE
+{
+    LOG_MODULE_SERVER = 0,
+    LOG_MODULE_HTTP,
+    LOG_MODULE_TIMER,
+    LOG_MODULE_POOL,
+    LOG_MODULE_SQL,
+    LOG_MODULE_NUM
+};
+
+// 日志所属模块，与m_close_log一样由宏引用，类中定义同名静态成员即可覆盖
+static const int m_log_module = LOG_MODULE_SERVER;
 
 /*
-*   使用单例模式，确保整个程序只有一个Log实例
+*   使用单例模式，程序日志与访问日志各有一个Log实例，写入不同的文件
 */
 
 class Log
 {
 public:
+    static const int MAX_INSTANCES = 2;         // Log实例数量，每个线程为每个实例保留一个缓冲区
+
     // C++11特性：对静态局部变量的多线程访问不用加锁，编译器会确保静态局部变量实例化只有一个线程能够进行，其他线程无法进行, 保证了静态局部变量初始化的原子性
     static Log* get_instance()
     {
-        static Log instance;
+        static Log instance(0);
         return &instance;
     }
-
-    static void *flush_log_thread(void *args)
+    // 访问日志，由 access_log 写入
+    static Log* get_access_instance()
     {
-        Log::get_instance()->async_write_log();
+        static Log instance(1);
+        return &instance;
     }
 
-    // 初始化日志类：日志文件、日志缓冲区大小、最大行数以及最长日志条队列
-    bool init(const char *file_name, int close_log, int log_buf_size = 8192, int split_line = 5000000, int max_queue_size = 0);
-    // 写日志
-    void write_log(int level, const char *format, ...);
+    // 初始化日志类：日志文件、单条日志最大长度、最大行数、异步缓冲区可容纳的日志条数(为0时同步写入)、是否使用二进制格式
+    // 以及切换下来的文件的压缩级别(0不压缩)、所有日志文件的总大小上限与保留天数(0不限制)
+    bool init(const char *file_name, int close_log, int log_buf_size = 8192, int split_line = 5000000, int max_queue_size = 0,
+              bool binary = false, int compress_level = 0, long long max_total_size = 0, int max_days = 0);
+    // 注册调用点的格式串，返回格式ID，由日志宏在每个调用点首次执行时调用
+    int register_format(int level, int module, const char *format);
+    // 写日志，id 为 register_format 返回的格式ID
+    void write_log(int level, int id, const char *format, ...);
 
     void flush(void);
+    // 设置全局日志级别，未单独设置级别的模块随之变化，可在运行中调用
+    void set_level(int level);
+    int level() { return m_level; }
+    // 按配置设置级别，如 "info" 或 "warn,http=error,sql=info"，格式错误时返回false且不做修改
+    bool set_levels(const char *spec);
+    bool enabled(int level, int module = LOG_MODULE_SERVER)
+    {
+        return level >= m_effective[module].load(std::memory_order_relaxed);
+    }
+    long long dropped() { return m_dropped.load(std::memory_order_relaxed); }  // 异步模式下丢弃的日志条数
 
 private:
-    Log();
+    explicit Log(int slot);
     virtual ~Log();
-    void *async_write_log()
-    {
-        std::string single_log;
-        // 从阻塞队列中取出一条日志
-        while(m_log_queue->pop(single_log))
-        {
-            m_mutex.lock();
-            fputs(single_log.c_str(), m_fp);
-            m_mutex.unlock();
-        }
-    }
+    log_buffer *local_buffer();                 // 当前线程的缓冲区，首次调用时创建
+    void append(log_buffer *buf, const char *line, int len);
+    void async_write_log();                     // 后台写线程
+    void flush_buffers();                       // 把所有线程缓冲区中的日志写入文件
+    void split_file(const struct tm &my_tm, long long lines);   // 按天或行数切换日志文件
+    void log_file_name(char *out, const struct tm &my_tm, long long index);     // 第index个切分文件的文件名
+    void update_levels();                       // 重新计算各模块生效的级别
+    int encode_record(char *out, int size, int id, long long ts, va_list ap);   // 编码一条二进制记录
+    void pending_formats(std::string &out);     // 文件头与尚未写入当前文件的格式定义
 
 private:
+    static const int FLUSH_INTERVAL_MS = 100;   // 写线程的最长刷新间隔
+    static const int MIN_BUFFER_SIZE = 64 * 1024;   // 每个线程缓冲区的最小字节数
+    static const int MAX_FORMATS = 4096;        // 最多注册的格式串数量
+    static const long long MAX_PREALLOC = 8LL * 1024 * 1024;    // 每个文件预分配空间的上限，异常退出时残留的预分配不会过大
+
+    struct log_format_def
+    {
+        const char *format;                     // 调用点的格式串，为字符串常量
+        char level;
+        char module;
+        unsigned char nargs;                    // 参数个数，LOG_ARGS_TEXT 表示记录中为格式化后的文本
+        char types[LOG_MAX_ARGS];               // 参数类型
+    };
+
+    int m_slot;             // 实例编号，对应线程缓冲区的下标
     char dir_name[128];     // 路径名
     char log_name[128];     // log文件名
     int m_split_lines;      // 日志最大行数
     int m_log_buf_size;     // 日志缓冲区大小
+    size_t m_ring_size;     // 异步模式下每个线程缓冲区的字节数
     long long m_count;      // 日志行数记录
     int m_today;            // 因为日志按天分类，因此记录每天的号数
     FILE *m_fp;             // 日志文件指针
-    char *m_buf;
-    block_queue<std::string> *m_log_queue;  // 阻塞队列
     bool m_is_async;        // 是否同步
-    locker m_mutex;
+    locker m_mutex;         // 同步写入与缓冲区登记
     int m_close_log;        // 关闭日志
+
+    std::vector<log_buffer *> m_buffers;        // 已登记的线程缓冲区
+    std::thread m_writer;                       // 后台写线程
+    parker m_parker;                            // 写线程休眠器
+    std::atomic<bool> m_stop;
+    int m_level;                                // 全局日志级别
+    int m_module_level[LOG_MODULE_NUM];         // 模块级别，-1表示跟随全局级别
+    std::atomic<int> m_effective[LOG_MODULE_NUM];   // 各模块生效的级别
+    std::atomic<long long> m_dropped;           // 缓冲区满时丢弃的日志条数
+    long long m_reported;                       // 已写入统计的丢弃条数
+
+    bool m_binary;                              // 是否使用二进制格式
+    bool m_opened;                              // 日志文件已打开，之前所有级别都视为关闭
+    log_format_def m_formats[MAX_FORMATS];      // 已注册的格式串，下标为格式ID
+    std::atomic<int> m_format_num;              // 已注册的格式串数量
+    locker m_format_lock;                       // 注册格式串
+    int m_formats_written;                      // 已写入当前文件的格式定义数量
+    bool m_header_pending;                      // 新文件还未写入文件头
+    log_archiver m_archiver;                    // 提前打开、关闭与压缩日志文件
 };
 
-#define LOG_DEBUG(format, ...) if(0 == m_close_log) {Log::get_instance()->write_log(0, format, ##__VA_ARGS__); Log::get_instance()->flush(); }
-#define LOG_INFO(format, ...) if(0 == m_close_log) {Log::get_instance()->write_log(1, format, ##__VA_ARGS__); Log::get_instance()->flush(); }
-#define LOG_WARN(format, ...) if(0 == m_close_log) {Log::get_instance()->write_log(2, format, ##__VA_ARGS__); Log::get_instance()->flush(); }
-#define LOG_ERROR(format, ...) if(0 == m_close_log) {Log::get_instance()->write_log(3, format, ##__VA_ARGS__); Log::get_instance()->flush(); }
+// 每个调用点用静态变量保存格式ID，只在首次执行时注册
+#define LOG_BASE(level, format, ...) if(LOG_MIN_LEVEL <= level && 0 == m_close_log && Log::get_instance()->enabled(level, m_log_module)) { \
+    static const int log_format_id = Log::get_instance()->register_format(level, m_log_module, format); \
+    Log::get_instance()->write_log(level, log_format_id, format, ##__VA_ARGS__); }
+
+#define LOG_DEBUG(format, ...) LOG_BASE(0, format, ##__VA_ARGS__)
+#define LOG_INFO(format, ...) LOG_BASE(1, format, ##__VA_ARGS__)
+#define LOG_WARN(format, ...) LOG_BASE(2, format, ##__VA_ARGS__)
+#define LOG_ERROR(format, ...) LOG_BASE(3, format, ##__VA_ARGS__)
 
 #endif
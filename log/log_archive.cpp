@@ -0,0 +1,353 @@
+#include "log_archive.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <pthread.h>
+#include <sched.h>
+#include <algorithm>
+#include <zlib.h>
+
+log_archiver::log_archiver() : m_level(0), m_max_bytes(0), m_max_days(0), m_prealloc(0),
+                               m_lock("log_archive"), m_cond("log_archive"), m_stop(false), m_dirty(false), m_spare(NULL)
+{
+}
+
+log_archiver::~log_archiver()
+{
+    stop();
+}
+
+void log_archiver::start(const char *dir, const char *name, const char *active, int level, long long max_bytes, int max_days, long long prealloc)
+{
+    m_dir = dir[0] ? dir : "./";
+    m_name = name;
+    m_level = level < 0 ? 0 : (level > 9 ? 9 : level);
+    m_max_bytes = max_bytes;
+    m_max_days = max_days;
+    m_prealloc = prealloc;
+    // 启动时整理上次运行留下的文件，整理线程启动前先标记正在写入的文件
+    m_active = active;
+    m_dirty = true;
+    m_thread = std::thread(&log_archiver::run, this);
+}
+
+FILE *log_archiver::open(const char *path)
+{
+    FILE *fp = NULL;
+    FILE *unused = NULL;
+    // 先标记为正在写入，整理线程不会把新建的空文件删除
+    m_lock.lock();
+    std::string prev = m_active;
+    m_active = path;
+    if(m_spare && m_spare_path == path)
+        fp = m_spare;
+    else
+        unused = m_spare;
+    m_spare = NULL;
+    m_spare_path.clear();
+    if(unused)
+    {
+        // 日期变化时提前打开的文件用不上，空文件在整理时删除
+        m_retired.push_back(unused);
+        m_dirty = true;
+        m_cond.signal();
+    }
+    m_lock.unlock();
+
+    if(!fp)
+    {
+        fp = fopen(path, "a");
+        if(!fp)
+        {
+            // 继续写原来的文件
+            m_lock.lock();
+            m_active = prev;
+            m_lock.unlock();
+        }
+    }
+    return fp;
+}
+
+void log_archiver::prepare(const char *path)
+{
+    if(!m_thread.joinable())
+        return;
+    m_lock.lock();
+    m_want = path;
+    m_cond.signal();
+    m_lock.unlock();
+}
+
+void log_archiver::retire(FILE *fp)
+{
+    if(!m_thread.joinable())
+    {
+        close_file(fp);
+        return;
+    }
+    m_lock.lock();
+    m_retired.push_back(fp);
+    m_dirty = true;
+    m_cond.signal();
+    m_lock.unlock();
+}
+
+void log_archiver::stop()
+{
+    if(!m_thread.joinable())
+        return;
+    m_lock.lock();
+    m_stop = true;
+    m_cond.signal();
+    m_lock.unlock();
+    m_thread.join();
+
+    for(size_t i = 0; i < m_retired.size(); ++i)
+        close_file(m_retired[i]);
+    m_retired.clear();
+    if(m_spare)
+    {
+        close_file(m_spare);
+        m_spare = NULL;
+        struct stat st;
+        if(0 == stat(m_spare_path.c_str(), &st) && 0 == st.st_size)
+            unlink(m_spare_path.c_str());
+    }
+}
+
+// 关闭文件，释放超出文件大小的预分配空间
+void log_archiver::close_file(FILE *fp)
+{
+    fflush(fp);
+    struct stat st;
+    if(0 == fstat(fileno(fp), &st))
+        ftruncate(fileno(fp), st.st_size);
+    fclose(fp);
+}
+
+void log_archiver::run()
+{
+    // 整理线程只在CPU空闲时运行，被唤醒时不会抢占请求线程；不支持时降低优先级
+    struct sched_param param = { 0 };
+    if(pthread_setschedparam(pthread_self(), SCHED_IDLE, &param) != 0)
+        setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+
+    m_lock.lock();
+    while(!m_stop)
+    {
+        if(!m_want.empty())
+        {
+            m_lock.unlock();
+            open_spare();
+            m_lock.lock();
+            continue;
+        }
+
+        if(m_dirty)
+        {
+            std::vector<FILE *> retired;
+            retired.swap(m_retired);
+            m_dirty = false;
+            m_lock.unlock();
+
+            for(size_t i = 0; i < retired.size(); ++i)
+                close_file(retired[i]);
+            sweep();
+
+            m_lock.lock();
+            continue;
+        }
+
+        m_cond.wait(m_lock);
+    }
+    m_lock.unlock();
+}
+
+// 打开并预分配下一个文件，在压缩文件的间隙也会调用，切换文件时尽量不用等待
+void log_archiver::open_spare()
+{
+    m_lock.lock();
+    std::string path;
+    path.swap(m_want);
+    m_lock.unlock();
+    if(path.empty())
+        return;
+
+    FILE *fp = fopen(path.c_str(), "a");
+    if(fp && m_prealloc > 0)
+        fallocate(fileno(fp), FALLOC_FL_KEEP_SIZE, 0, m_prealloc);
+
+    m_lock.lock();
+    if(m_spare)
+    {
+        m_retired.push_back(m_spare);
+        m_dirty = true;
+    }
+    m_spare = fp;
+    m_spare_path = fp ? path : std::string();
+    m_lock.unlock();
+}
+
+// 文件名为 年_月_日_日志名[.序号][.gz]
+bool log_archiver::match(const char *file, bool &compressed)
+{
+    static const char pattern[] = "dddd_dd_dd_";
+    size_t len = strlen(file);
+    size_t head = sizeof(pattern) - 1;
+    if(len < head + m_name.size())
+        return false;
+    for(size_t i = 0; i < head; ++i)
+    {
+        if('d' == pattern[i] ? (file[i] < '0' || file[i] > '9') : file[i] != pattern[i])
+            return false;
+    }
+    if(0 != strncmp(file + head, m_name.c_str(), m_name.size()))
+        return false;
+
+    const char *p = file + head + m_name.size();
+    compressed = len >= 3 && 0 == strcmp(file + len - 3, ".gz");
+    const char *end = file + len - (compressed ? 3 : 0);
+    if(p == end)
+        return true;
+    if('.' != *p++ || p == end)
+        return false;
+    for(; p < end; ++p)
+    {
+        if(*p < '0' || *p > '9')
+            return false;
+    }
+    return true;
+}
+
+static bool gzip_file(const char *path, int level)
+{
+    int fd = ::open(path, O_RDONLY);
+    if(fd < 0)
+        return false;
+
+    // 已存在同名压缩文件(同一天重启后再次切分)时追加为新的gzip成员，gzip工具与 log_decode 都能连续读取
+    std::string gz_path = std::string(path) + ".gz";
+    // 压缩级别已在 start 中限制为 0-9，模式串中只占一位数字
+    char mode[] = { 'a', 'b', (char)('0' + level), '\0' };
+    gzFile gz = gzopen(gz_path.c_str(), mode);
+    if(!gz)
+    {
+        close(fd);
+        return false;
+    }
+    gzbuffer(gz, 256 * 1024);
+
+    bool ok = true;
+    std::vector<char> buf(256 * 1024);
+    ssize_t n;
+    while((n = read(fd, &buf[0], buf.size())) > 0)
+    {
+        if(gzwrite(gz, &buf[0], n) != n)
+        {
+            ok = false;
+            break;
+        }
+    }
+    if(n < 0)
+        ok = false;
+    close(fd);
+    if(gzclose(gz) != Z_OK)
+        ok = false;
+    if(ok)
+        unlink(path);
+    return ok;
+}
+
+void log_archiver::sweep()
+{
+    struct log_file
+    {
+        std::string path;
+        time_t mtime;
+        long long size;
+        bool busy;
+    };
+
+    DIR *dir = opendir(m_dir.c_str());
+    if(!dir)
+        return;
+
+    std::vector<log_file> files;
+    struct dirent *ent;
+    while((ent = readdir(dir)) != NULL)
+    {
+        bool compressed;
+        if(!match(ent->d_name, compressed))
+            continue;
+
+        log_file f;
+        f.path = m_dir + ent->d_name;
+        struct stat st;
+        if(0 != stat(f.path.c_str(), &st) || !S_ISREG(st.st_mode))
+            continue;
+        // 压缩的间隙会打开新文件，每次都重新取正在使用的文件
+        m_lock.lock();
+        f.busy = f.path == m_active || f.path == m_spare_path;
+        m_lock.unlock();
+
+        if(!f.busy && !compressed)
+        {
+            // 空文件是没用上的预先打开的文件，异常退出时还带着预分配的空间
+            if(0 == st.st_size)
+            {
+                unlink(f.path.c_str());
+                continue;
+            }
+            // 异常退出时未关闭的文件，释放超出文件大小的预分配空间
+            if((long long)st.st_blocks * 512 > (long long)st.st_size + st.st_blksize)
+                truncate(f.path.c_str(), st.st_size);
+            open_spare();
+            if(m_level > 0 && gzip_file(f.path.c_str(), m_level))
+            {
+                f.path += ".gz";
+                if(0 != stat(f.path.c_str(), &st))
+                    continue;
+            }
+        }
+        f.mtime = st.st_mtime;
+        f.size = st.st_size;
+        files.push_back(f);
+    }
+    closedir(dir);
+
+    if(0 == m_max_bytes && 0 == m_max_days)
+        return;
+
+    // 同一个.gz可能被追加过，按路径去重
+    std::sort(files.begin(), files.end(), [](const log_file &a, const log_file &b) {
+        return a.path < b.path;
+    });
+    files.erase(std::unique(files.begin(), files.end(), [](const log_file &a, const log_file &b) {
+        return a.path == b.path;
+    }), files.end());
+
+    // 从最旧的文件开始删除
+    std::sort(files.begin(), files.end(), [](const log_file &a, const log_file &b) {
+        return a.mtime < b.mtime;
+    });
+    long long total = 0;
+    for(size_t i = 0; i < files.size(); ++i)
+        total += files[i].size;
+
+    time_t expire = time(NULL) - (time_t)m_max_days * 86400;
+    for(size_t i = 0; i < files.size(); ++i)
+    {
+        const log_file &f = files[i];
+        bool old = m_max_days > 0 && f.mtime < expire;
+        bool over = m_max_bytes > 0 && total > m_max_bytes;
+        if(f.busy || (!old && !over))
+            continue;
+        if(0 == unlink(f.path.c_str()))
+            total -= f.size;
+    }
+}
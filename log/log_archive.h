@@ -0,0 +1,62 @@
+#ifndef _LOG_ARCHIVE_H
+#define _LOG_ARCHIVE_H
+
+/**
+ *      日志文件整理线程
+ *   1. 提前打开下一个切分文件并用 fallocate 预分配空间，切换文件时只交换文件指针
+ *   2. 切换下来的文件在整理线程中关闭，并用 zlib 压缩为 .gz，已存在同名 .gz 时追加为新的gzip成员
+ *   3. 按总大小与保留天数删除最旧的日志文件
+ *   整理线程以 SCHED_IDLE 运行，切换文件的线程(异步模式的写线程或同步模式的请求线程)不做文件关闭与压缩
+*/
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include "../lock/locker.h"
+
+class log_archiver
+{
+public:
+    log_archiver();
+    ~log_archiver();
+
+    // 日志目录、文件名(不含日期前缀)、首个要写入的文件、压缩级别(0不压缩)、总大小上限与保留天数(0不限制)、预分配字节数
+    void start(const char *dir, const char *name, const char *active, int level, long long max_bytes, int max_days, long long prealloc);
+    // 打开新的日志文件，已提前打开时直接返回
+    FILE *open(const char *path);
+    // 让整理线程提前打开下一个文件
+    void prepare(const char *path);
+    // 交给整理线程关闭，之后压缩并执行保留策略
+    void retire(FILE *fp);
+    // 关闭待关闭的文件并退出整理线程，不再压缩
+    void stop();
+
+private:
+    void run();
+    void open_spare();                  // 打开需要提前打开的文件
+    void sweep();                       // 压缩已关闭的日志并删除超出保留范围的文件
+    bool match(const char *file, bool &compressed);     // 是否为本日志的文件
+    void close_file(FILE *fp);
+
+private:
+    std::string m_dir;
+    std::string m_name;
+    int m_level;
+    long long m_max_bytes;
+    int m_max_days;
+    long long m_prealloc;
+
+    locker m_lock;
+    cond m_cond;
+    std::thread m_thread;
+    bool m_stop;
+    bool m_dirty;                       // 有文件关闭，需要整理
+    std::vector<FILE *> m_retired;      // 待关闭的文件
+    std::string m_active;               // 正在写入的文件
+    std::string m_want;                 // 需要提前打开的文件
+    std::string m_spare_path;
+    FILE *m_spare;                      // 已提前打开的文件
+};
+
+#endif
@@ -0,0 +1,332 @@
+/**
+ *      二进制日志还原工具
+ *   按 log_format.h 中的记录格式读取 -f 1 写出的日志，还原为与文本日志相同的行，或用 -j 输出JSON行
+ *   文件末尾不完整的记录(写入中或进程异常退出)会被忽略，可以直接读取整理线程压缩后的 .gz 文件
+ *
+ *   用法: ./log_decode [-j] 日志文件...
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <zlib.h>
+#include "log_format.h"
+
+static const char *level_text[] = { "debug", "info", "warn", "error" };
+static const char *module_text[] = { "server", "http", "timer", "pool", "sql" };
+
+struct format_def
+{
+    int level;
+    int module;
+    int nargs;
+    std::string types;
+    std::string format;
+};
+
+struct arg_value
+{
+    char type;
+    long long i;
+    double d;
+    std::string s;
+};
+
+static bool g_json = false;
+
+template<typename T>
+static void append_spec(std::string &out, const std::string &spec, const int *stars, int nstars, T v)
+{
+    char tmp[512];
+    int n;
+    if(0 == nstars)
+        n = snprintf(tmp, sizeof(tmp), spec.c_str(), v);
+    else if(1 == nstars)
+        n = snprintf(tmp, sizeof(tmp), spec.c_str(), stars[0], v);
+    else
+        n = snprintf(tmp, sizeof(tmp), spec.c_str(), stars[0], stars[1], v);
+    if(n > 0)
+        out.append(tmp, n < (int)sizeof(tmp) ? n : sizeof(tmp) - 1);
+}
+
+// 按格式串把参数还原为日志正文
+static std::string render(const format_def &def, const std::vector<arg_value> &args)
+{
+    std::string out;
+    size_t next = 0;
+    for(const char *p = def.format.c_str(); *p; )
+    {
+        if('%' != *p)
+        {
+            out += *p++;
+            continue;
+        }
+
+        const char *start = p;
+        char types[3];
+        int n;
+        const char *end = log_parse_spec(p + 1, types, n);
+        if(!end || next + n > args.size())
+        {
+            out += *p++;
+            continue;
+        }
+        p = end;
+        if(0 == n)
+        {
+            out += '%';
+            continue;
+        }
+
+        std::string spec(start, end);
+        int stars[2] = {0, 0};
+        for(int i = 0; i < n - 1; ++i)
+            stars[i] = (int)args[next++].i;
+        const arg_value &v = args[next++];
+        switch(v.type)
+        {
+            case LOG_ARG_INT:
+                append_spec(out, spec, stars, n - 1, (int)v.i);
+                break;
+            case LOG_ARG_LONG:
+                append_spec(out, spec, stars, n - 1, (long)v.i);
+                break;
+            case LOG_ARG_LLONG:
+                append_spec(out, spec, stars, n - 1, v.i);
+                break;
+            case LOG_ARG_DOUBLE:
+                append_spec(out, spec, stars, n - 1, v.d);
+                break;
+            case LOG_ARG_PTR:
+                append_spec(out, spec, stars, n - 1, (void *)(intptr_t)v.i);
+                break;
+            case LOG_ARG_STR:
+                // 字符串可能超过临时缓冲区，不带宽度时直接追加
+                if(spec.size() == 2)
+                    out += v.s;
+                else
+                    append_spec(out, spec, stars, n - 1, v.s.c_str());
+                break;
+        }
+    }
+    return out;
+}
+
+static void json_string(const std::string &s)
+{
+    putchar('"');
+    for(size_t i = 0; i < s.size(); ++i)
+    {
+        unsigned char c = s[i];
+        if('"' == c || '\\' == c)
+            printf("\\%c", c);
+        else if('\n' == c)
+            printf("\\n");
+        else if('\r' == c)
+            printf("\\r");
+        else if('\t' == c)
+            printf("\\t");
+        else if(c < 0x20)
+            printf("\\u%04x", c);
+        else
+            putchar(c);
+    }
+    putchar('"');
+}
+
+static void print_line(long long ts, int level, int module, const std::string &msg)
+{
+    if(g_json)
+    {
+        printf("{\"ts\":%lld.%06lld,\"level\":\"%s\",\"module\":\"%s\",\"msg\":", ts / 1000000, ts % 1000000,
+               level >= 0 && level < 4 ? level_text[level] : "unknown",
+               module >= 0 && module < 5 ? module_text[module] : "unknown");
+        json_string(msg);
+        printf("}\n");
+        return;
+    }
+
+    time_t t = ts / 1000000;
+    struct tm my_tm;
+    localtime_r(&t, &my_tm);
+    printf("%d-%02d-%02d %02d:%02d:%02d.%06lld [%s]: %s", my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday,
+           my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec, ts % 1000000,
+           level >= 0 && level < 4 ? level_text[level] : "unknown", msg.c_str());
+    putchar('\n');
+}
+
+static bool decode_record(const std::vector<format_def *> &defs, const char *p, uint32_t len)
+{
+    if(len < 12)
+        return false;
+    uint32_t id;
+    long long ts;
+    memcpy(&id, p, 4);
+    memcpy(&ts, p + 4, 8);
+    if(id >= defs.size() || !defs[id])
+    {
+        print_line(ts, 2, 0, "log_decode: unknown format id " + std::to_string(id));
+        return true;
+    }
+
+    const format_def &def = *defs[id];
+    const char *q = p + 12;
+    const char *end = p + len;
+    std::vector<arg_value> args;
+    if(LOG_ARGS_TEXT == def.nargs)
+    {
+        uint16_t n;
+        if(end - q < 2)
+            return false;
+        memcpy(&n, q, 2);
+        if(end - q - 2 < n)
+            return false;
+        print_line(ts, def.level, def.module, std::string(q + 2, n));
+        return true;
+    }
+
+    for(int i = 0; i < def.nargs; ++i)
+    {
+        arg_value v;
+        v.type = def.types[i];
+        v.i = 0;
+        v.d = 0;
+        if(LOG_ARG_STR == v.type)
+        {
+            uint16_t n;
+            if(end - q < 2)
+                return false;
+            memcpy(&n, q, 2);
+            if(end - q - 2 < n)
+                return false;
+            v.s.assign(q + 2, n);
+            q += 2 + n;
+        }
+        else
+        {
+            if(end - q < 8)
+                return false;
+            if(LOG_ARG_DOUBLE == v.type)
+                memcpy(&v.d, q, 8);
+            else
+                memcpy(&v.i, q, 8);
+            q += 8;
+        }
+        args.push_back(v);
+    }
+    print_line(ts, def.level, def.module, render(def, args));
+    return true;
+}
+
+static int decode_file(const char *name)
+{
+    // gzread 同样可以读取未压缩的文件
+    gzFile fp = gzopen(name, "rb");
+    if(!fp)
+    {
+        fprintf(stderr, "open %s failed\n", name);
+        return 1;
+    }
+    std::string data;
+    char chunk[65536];
+    int n;
+    while((n = gzread(fp, chunk, sizeof(chunk))) > 0)
+        data.append(chunk, n);
+    gzclose(fp);
+
+    std::vector<format_def *> defs;
+    size_t pos = 0;
+    int ret = 0;
+    while(pos + LOG_RECORD_HEAD <= data.size())
+    {
+        char type = data[pos];
+        uint32_t len;
+        memcpy(&len, data.data() + pos + 1, 4);
+        if(data.size() - pos - LOG_RECORD_HEAD < len)
+            break;
+        const char *p = data.data() + pos + LOG_RECORD_HEAD;
+        pos += LOG_RECORD_HEAD + len;
+
+        if('H' == type)
+        {
+            // 每次打开文件都会写入文件头，之后的格式ID重新计数
+            if(len < 7 || memcmp(p, LOG_BINARY_MAGIC, 6) != 0 || p[6] != LOG_BINARY_VERSION)
+            {
+                fprintf(stderr, "%s: unsupported log header\n", name);
+                ret = 1;
+                break;
+            }
+            for(size_t i = 0; i < defs.size(); ++i)
+                delete defs[i];
+            defs.clear();
+        }
+        else if('F' == type && len >= 7)
+        {
+            uint32_t id;
+            memcpy(&id, p, 4);
+            format_def *def = new format_def;
+            def->level = p[4];
+            def->module = p[5];
+            def->nargs = (unsigned char)p[6];
+            size_t ntypes = LOG_ARGS_TEXT == def->nargs ? 0 : def->nargs;
+            if(len < 7 + ntypes)
+            {
+                delete def;
+                continue;
+            }
+            def->types.assign(p + 7, ntypes);
+            def->format.assign(p + 7 + ntypes, len - 7 - ntypes);
+            if(id >= defs.size())
+                defs.resize(id + 1, NULL);
+            delete defs[id];
+            defs[id] = def;
+        }
+        else if('R' == type)
+        {
+            if(!decode_record(defs, p, len))
+                fprintf(stderr, "%s: corrupt record at offset %zu\n", name, pos - len - LOG_RECORD_HEAD);
+        }
+        else if('D' == type && len >= 16)
+        {
+            long long ts, dropped;
+            memcpy(&ts, p, 8);
+            memcpy(&dropped, p + 8, 8);
+            print_line(ts, 2, 0, "log buffer full, " + std::to_string(dropped) + " lines dropped");
+        }
+    }
+    if(pos < data.size() && 0 == ret)
+        fprintf(stderr, "%s: %zu trailing bytes ignored\n", name, data.size() - pos);
+
+    for(size_t i = 0; i < defs.size(); ++i)
+        delete defs[i];
+    return ret;
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    while((opt = getopt(argc, argv, "j")) != -1)
+    {
+        switch(opt)
+        {
+        case 'j': g_json = true; break;
+        default:
+            fprintf(stderr, "usage: %s [-j] file...\n", argv[0]);
+            return 1;
+        }
+    }
+    if(optind >= argc)
+    {
+        fprintf(stderr, "usage: %s [-j] file...\n", argv[0]);
+        return 1;
+    }
+
+    int ret = 0;
+    for(int i = optind; i < argc; ++i)
+        ret |= decode_file(argv[i]);
+    return ret;
+}
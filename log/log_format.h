@@ -0,0 +1,118 @@
+#ifndef _LOG_FORMAT_H
+#define _LOG_FORMAT_H
+
+/**
+ *   二进制日志格式，日志写入与 log_decode 工具共用
+ *   文件由记录组成，每条记录为 类型(1字节) + 负载长度(4字节) + 负载，整数按本机字节序：
+ *      'H' 文件头    "WSBLOG" + 版本号(1字节)，之后的格式ID都从头开始计
+ *      'F' 格式定义  ID(4) 级别(1) 模块(1) 参数个数(1) 参数类型(每个1字节) 格式串
+ *                   参数个数为 LOG_ARGS_TEXT 时，记录中只有一个已格式化好的字符串
+ *      'R' 日志记录  ID(4) 时间戳us(8) 参数：整数、浮点数、指针各8字节，字符串为 长度(2) + 内容
+ *      'D' 丢弃统计  时间戳us(8) 丢弃条数(8)
+*/
+
+#include <stdint.h>
+#include <string.h>
+
+#define LOG_BINARY_MAGIC "WSBLOG"
+#define LOG_BINARY_VERSION 1
+
+enum LOG_ARG_TYPE
+{
+    LOG_ARG_INT = 'i',          // int及更短的整数
+    LOG_ARG_LONG = 'l',         // long、size_t
+    LOG_ARG_LLONG = 'L',        // long long
+    LOG_ARG_DOUBLE = 'd',
+    LOG_ARG_STR = 's',
+    LOG_ARG_PTR = 'p'
+};
+
+static const int LOG_MAX_ARGS = 32;
+static const int LOG_ARGS_TEXT = 255;
+static const int LOG_RECORD_HEAD = 5;       // 类型 + 负载长度
+
+/*
+ *  解析一个转换说明，p 指向'%'之后，返回说明结束的位置，types 中依次写入该说明消耗的参数类型
+ *  n 返回参数个数，%% 的 n 为0；遇到不支持的说明返回NULL
+*/
+inline const char *log_parse_spec(const char *p, char *types, int &n)
+{
+    n = 0;
+    if('%' == *p)
+        return p + 1;
+
+    while(*p && strchr("-+ #0'", *p))
+        ++p;
+    if('*' == *p)
+    {
+        types[n++] = LOG_ARG_INT;
+        ++p;
+    }
+    while(*p >= '0' && *p <= '9')
+        ++p;
+    if('.' == *p)
+    {
+        ++p;
+        if('*' == *p)
+        {
+            types[n++] = LOG_ARG_INT;
+            ++p;
+        }
+        while(*p >= '0' && *p <= '9')
+            ++p;
+    }
+
+    char len = LOG_ARG_INT;
+    if('h' == *p)
+    {
+        p += 'h' == p[1] ? 2 : 1;
+    }
+    else if('l' == *p)
+    {
+        len = 'l' == p[1] ? LOG_ARG_LLONG : LOG_ARG_LONG;
+        p += 'l' == p[1] ? 2 : 1;
+    }
+    else if('q' == *p || 'j' == *p)
+    {
+        len = LOG_ARG_LLONG;
+        ++p;
+    }
+    else if('z' == *p || 't' == *p)
+    {
+        len = LOG_ARG_LONG;
+        ++p;
+    }
+
+    if(*p && strchr("diouxXc", *p))
+        types[n++] = len;
+    else if(*p && strchr("fFeEgGaA", *p) && LOG_ARG_INT == len)
+        types[n++] = LOG_ARG_DOUBLE;
+    else if('s' == *p && LOG_ARG_INT == len)
+        types[n++] = LOG_ARG_STR;
+    else if('p' == *p)
+        types[n++] = LOG_ARG_PTR;
+    else
+        return NULL;
+    return p + 1;
+}
+
+// 解析整个格式串的参数类型，返回参数个数，不支持时返回 LOG_ARGS_TEXT
+inline int log_parse_format(const char *format, char *types)
+{
+    int nargs = 0;
+    for(const char *p = format; *p; )
+    {
+        if('%' != *p++)
+            continue;
+        char spec[3];
+        int n;
+        p = log_parse_spec(p, spec, n);
+        if(!p || nargs + n > LOG_MAX_ARGS)
+            return LOG_ARGS_TEXT;
+        memcpy(types + nargs, spec, n);
+        nargs += n;
+    }
+    return nargs;
+}
+
+#endif
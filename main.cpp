@@ -16,8 +16,12 @@ int main(int argc, char *argv[])
 
     //初始化
     server.init(config.PORT, user, passwd, databasename, config.LOGWrite, 
-                config.OPT_LINGER, config.TRIGMode,  config.sql_num,  config.thread_num, 
-                config.close_log, config.actor_model);
+                config.OPT_LINGER, config.TRIGMode,  config.sql_num,  config.thread_num, config.max_thread_num,
+                config.close_log, config.actor_model, config.store_mode,
+                config.reactor_cpus, config.worker_cpus, config.nic_name, config.perf_mode, config.log_level,
+                config.log_format, config.log_compress, config.log_keep_mb, config.log_keep_days,
+                config.access_sample, config.access_slow_ms, config.access_rate, config.capture_file,
+                config.trace_interval, config.trace_slow_ms, config.cache_max_age);
     // 日志
     server.log_write();
 
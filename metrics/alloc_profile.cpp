@@ -0,0 +1,63 @@
+#include "alloc_profile.h"
+
+#ifdef ALLOC_PROFILE
+
+#include <stdlib.h>
+#include <new>
+
+/* 替换 glibc 的分配函数，统计后转给 glibc 的实现，free 不需要替换 */
+extern "C"
+{
+void *__libc_malloc(size_t n);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *p, size_t n);
+void __libc_free(void *p);
+
+void *malloc(size_t n) noexcept
+{
+    alloc_profile::record(n);
+    return __libc_malloc(n);
+}
+
+void *calloc(size_t n, size_t size) noexcept
+{
+    alloc_profile::record(n * size);
+    return __libc_calloc(n, size);
+}
+
+// 缩小或原地扩大也记一次，调用方无法区分
+void *realloc(void *p, size_t n) noexcept
+{
+    alloc_profile::record(n);
+    return __libc_realloc(p, n);
+}
+}
+
+// libstdc++ 的 operator new 内部调用 malloc，直接调用 glibc 实现以免重复计数
+static void *new_impl(size_t n)
+{
+    alloc_profile::record(n);
+    void *p = __libc_malloc(n ? n : 1);
+    if(!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+static void *new_nothrow(size_t n) noexcept
+{
+    alloc_profile::record(n);
+    return __libc_malloc(n ? n : 1);
+}
+
+void *operator new(size_t n) { return new_impl(n); }
+void *operator new[](size_t n) { return new_impl(n); }
+void *operator new(size_t n, const std::nothrow_t &) noexcept { return new_nothrow(n); }
+void *operator new[](size_t n, const std::nothrow_t &) noexcept { return new_nothrow(n); }
+void operator delete(void *p) noexcept { __libc_free(p); }
+void operator delete[](void *p) noexcept { __libc_free(p); }
+void operator delete(void *p, size_t) noexcept { __libc_free(p); }
+void operator delete[](void *p, size_t) noexcept { __libc_free(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept { __libc_free(p); }
+void operator delete[](void *p, const std::nothrow_t &) noexcept { __libc_free(p); }
+
+#endif
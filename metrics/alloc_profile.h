@@ -0,0 +1,168 @@
+#ifndef _ALLOC_PROFILE_H
+#define _ALLOC_PROFILE_H
+
+/**
+ *      内存分配统计
+ *   以 ALLOC_PROFILE 宏编译(make ALLOC_PROFILE=1)时，alloc_profile.cpp 替换 malloc/calloc/realloc 与 operator new，
+ *   每次分配按次数与字节数记录两处：
+ *      1. 线程当前子系统，由 alloc_scope 在作用域内设置，未设置时为 other
+ *      2. 线程当前请求，由 alloc_request 在 http_conn 读取、处理、发送期间设置，请求结束时按类型汇总
+ *   计数放在每个线程独占的槽中，槽用完后其余线程共用最后一个槽；记录时不分配内存、不加锁
+ *   释放不计数，统计的是分配次数而不是占用量
+ *   未定义该宏时 alloc_scope 与 alloc_request 不做任何事
+ *   统计结果由 /metrics 以 webserver_alloc_* 与 webserver_request_alloc* 指标输出，
+ *   ./bench/alloc_check.sh 检查静态请求的平均分配次数
+*/
+
+#include <stddef.h>
+#include <atomic>
+
+enum ALLOC_SUBSYSTEM
+{
+    ALLOC_OTHER = 0,
+    ALLOC_HTTP,             // 请求的读取、解析、处理与发送
+    ALLOC_LOG,              // 程序日志与访问日志
+    ALLOC_TIMER,            // 定时器
+    ALLOC_POOL,             // 线程池调度
+    ALLOC_STORE,            // 用户存储
+    ALLOC_SQL,              // 数据库连接池
+    ALLOC_METRICS,          // 运行指标与追踪输出
+    ALLOC_NUM
+};
+
+enum ALLOC_REQUEST_KIND
+{
+    ALLOC_REQ_CACHED = 0,   // 事件循环直接写回的缓存请求
+    ALLOC_REQ_STATIC,       // 工作线程处理的静态文件请求
+    ALLOC_REQ_CGI,          // 登录与注册
+    ALLOC_REQ_ADMIN,        // /metrics 与 /trace
+    ALLOC_REQ_NUM
+};
+
+// 一个请求的分配计数，只由当前处理该请求的线程修改
+struct alloc_counter
+{
+    long long count;
+    long long bytes;
+};
+
+struct alignas(64) alloc_slot
+{
+    std::atomic<long long> count[ALLOC_NUM];
+    std::atomic<long long> bytes[ALLOC_NUM];
+    std::atomic<long long> requests[ALLOC_REQ_NUM];
+    std::atomic<long long> req_count[ALLOC_REQ_NUM];
+    std::atomic<long long> req_bytes[ALLOC_REQ_NUM];
+    std::atomic<long long> req_max[ALLOC_REQ_NUM];     // 单个请求的最大分配次数
+};
+
+class alloc_profile
+{
+public:
+    static const int MAX_THREADS = 256;
+
+    static void record(size_t n)
+    {
+        alloc_slot *s = slot();
+        int sub = current();
+        s->count[sub].fetch_add(1, std::memory_order_relaxed);
+        s->bytes[sub].fetch_add(n, std::memory_order_relaxed);
+        alloc_counter *r = request();
+        if(r)
+        {
+            ++r->count;
+            r->bytes += n;
+        }
+    }
+
+    // 请求结束时调用
+    static void request_done(int kind, const alloc_counter &c)
+    {
+        alloc_slot *s = slot();
+        s->requests[kind].fetch_add(1, std::memory_order_relaxed);
+        s->req_count[kind].fetch_add(c.count, std::memory_order_relaxed);
+        s->req_bytes[kind].fetch_add(c.bytes, std::memory_order_relaxed);
+        long long cur = s->req_max[kind].load(std::memory_order_relaxed);
+        while(c.count > cur && !s->req_max[kind].compare_exchange_weak(cur, c.count, std::memory_order_relaxed))
+            ;
+    }
+
+    // 已分配的槽，只增不减
+    static alloc_slot *slots()
+    {
+        static alloc_slot table[MAX_THREADS];
+        return table;
+    }
+    static int slot_count()
+    {
+        int n = next_slot().load(std::memory_order_relaxed);
+        return n < MAX_THREADS ? n : MAX_THREADS;
+    }
+
+    static int &current()
+    {
+        static thread_local int sub = ALLOC_OTHER;
+        return sub;
+    }
+    static alloc_counter *&request()
+    {
+        static thread_local alloc_counter *r = NULL;
+        return r;
+    }
+
+private:
+    static alloc_slot *slot()
+    {
+        static thread_local alloc_slot *s = NULL;
+        if(!s)
+        {
+            int i = next_slot().fetch_add(1, std::memory_order_relaxed);
+            s = &slots()[i < MAX_THREADS ? i : MAX_THREADS - 1];
+        }
+        return s;
+    }
+    static std::atomic<int> &next_slot()
+    {
+        static std::atomic<int> n(0);
+        return n;
+    }
+};
+
+#ifdef ALLOC_PROFILE
+// 在作用域内设置线程当前子系统，退出时恢复
+class alloc_scope
+{
+public:
+    explicit alloc_scope(int sub) : m_prev(alloc_profile::current()) { alloc_profile::current() = sub; }
+    ~alloc_scope() { alloc_profile::current() = m_prev; }
+
+private:
+    int m_prev;
+};
+
+// 在作用域内把分配记到请求上，子系统设为 http，内层的 alloc_scope 只改变子系统
+class alloc_request
+{
+public:
+    explicit alloc_request(alloc_counter &c) : m_prev(alloc_profile::request()), m_scope(ALLOC_HTTP) { alloc_profile::request() = &c; }
+    ~alloc_request() { alloc_profile::request() = m_prev; }
+
+private:
+    alloc_counter *m_prev;
+    alloc_scope m_scope;
+};
+#else
+class alloc_scope
+{
+public:
+    explicit alloc_scope(int) {}
+};
+
+class alloc_request
+{
+public:
+    explicit alloc_request(alloc_counter &) {}
+};
+#endif
+
+#endif
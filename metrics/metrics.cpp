@@ -0,0 +1,326 @@
+#include "metrics.h"
+#include "alloc_profile.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <algorithm>
+
+thread_local metrics_shard *metrics::t_shard = NULL;
+
+static const char *stage_name[] = { "accept", "read", "queue", "parse", "handler", "db", "write", "total" };
+
+static const struct
+{
+    const char *name;
+    const char *help;
+} counter_info[] = {
+    { "webserver_connections_accepted_total", "Accepted connections." },
+    { "webserver_requests_total", "Completed requests." },
+    { "webserver_request_errors_total", "Requests answered with status >= 400." },
+    { "webserver_response_bytes_total", "Bytes sent in responses." },
+    { "webserver_cache_hits_total", "Requests served from the file cache on the event loop." },
+    { "webserver_requests_shed_total", "Requests answered with 503 because their lane queue was full." },
+};
+
+static const struct
+{
+    const char *name;
+    const char *help;
+} level_info[] = {
+    { "webserver_pool_busy_threads", "Worker threads currently handling a request." },
+};
+
+// 直方图输出的边界(us)
+static const long long bucket_bounds[] = {
+    10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+    100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000
+};
+
+static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+#ifdef LOCK_PROFILE
+static const struct
+{
+    const char *name;
+    const char *help;
+    const char *type;
+    std::atomic<long long> lock_stats::*field;
+    bool seconds;                       // 按纳秒记录，输出为秒
+    bool mutex_only;                    // 只有互斥锁统计
+} lock_info[] = {
+    { "webserver_lock_acquires_total", "Lock acquisitions, semaphore waits or sleeps.", "counter", &lock_stats::acquires, false, false },
+    { "webserver_lock_contended_total", "Acquisitions that had to wait.", "counter", &lock_stats::contended, false, false },
+    { "webserver_lock_wait_seconds_total", "Time spent waiting to acquire.", "counter", &lock_stats::wait_ns, true, false },
+    { "webserver_lock_wait_max_seconds", "Longest single wait.", "gauge", &lock_stats::wait_max_ns, true, false },
+    { "webserver_lock_hold_seconds_total", "Time mutexes were held.", "counter", &lock_stats::hold_ns, true, true },
+    { "webserver_lock_hold_max_seconds", "Longest single hold of a mutex.", "gauge", &lock_stats::hold_max_ns, true, true },
+};
+#endif
+
+#ifdef ALLOC_PROFILE
+static const char *alloc_subsystem_name[] = { "other", "http", "log", "timer", "pool", "store", "sql", "metrics" };
+static const char *alloc_kind_name[] = { "cached", "static", "cgi", "admin" };
+
+static const struct
+{
+    const char *name;
+    const char *help;
+    const char *type;
+    std::atomic<long long> (alloc_slot::*field)[ALLOC_REQ_NUM];
+} alloc_request_info[] = {
+    { "webserver_alloc_requests_total", "Requests finished while allocation profiling.", "counter", &alloc_slot::requests },
+    { "webserver_request_allocs_total", "Allocations made while handling requests.", "counter", &alloc_slot::req_count },
+    { "webserver_request_alloc_bytes_total", "Bytes allocated while handling requests.", "counter", &alloc_slot::req_bytes },
+    { "webserver_request_allocs_max", "Most allocations made by a single request.", "gauge", &alloc_slot::req_max },
+};
+#endif
+
+metrics_shard::metrics_shard() : next(NULL)
+{
+    for(int i = 0; i < COUNTER_NUM; ++i)
+        counters[i].store(0, std::memory_order_relaxed);
+    for(int i = 0; i < LEVEL_NUM; ++i)
+        levels[i].store(0, std::memory_order_relaxed);
+    for(int i = 0; i < STAGE_NUM; ++i)
+    {
+        sum[i].store(0, std::memory_order_relaxed);
+        for(int j = 0; j < BUCKETS; ++j)
+            hist[i][j].store(0, std::memory_order_relaxed);
+    }
+}
+
+/* 线程退出时归还分片 */
+struct metrics_holder
+{
+    metrics_shard *shard;
+
+    metrics_holder() : shard(NULL) {}
+    ~metrics_holder()
+    {
+        if(shard)
+            metrics::get_instance()->release(shard);
+    }
+};
+
+static thread_local metrics_holder t_holder;
+
+long long metrics::bucket_upper(int index)
+{
+    if(index < metrics_shard::SUB)
+        return index;
+    int shift = index / metrics_shard::SUB - 1;
+    long long lower = (long long)(metrics_shard::SUB + index % metrics_shard::SUB) << shift;
+    return lower + (1LL << shift) - 1;
+}
+
+metrics_shard *metrics::acquire()
+{
+    m_lock.lock();
+    metrics_shard *s = m_free;
+    if(s)
+    {
+        m_free = s->next;
+        s->next = NULL;
+    }
+    else
+    {
+        s = new metrics_shard;
+        m_shards.push_back(s);
+    }
+    m_lock.unlock();
+
+    t_shard = s;
+    t_holder.shard = s;
+    return s;
+}
+
+void metrics::release(metrics_shard *shard)
+{
+    t_shard = NULL;
+    m_lock.lock();
+    shard->next = m_free;
+    m_free = shard;
+    m_lock.unlock();
+}
+
+void metrics::add_gauge(const char *name, const char *help, std::function<double()> fn)
+{
+    gauge g;
+    g.name = name;
+    g.help = help;
+    g.fn = fn;
+    m_lock.lock();
+    m_gauges.push_back(g);
+    m_lock.unlock();
+}
+
+static void append(std::string &out, const char *format, ...) __attribute__((format(printf, 2, 3)));
+static void append(std::string &out, const char *format, ...)
+{
+    char buf[256];
+    va_list ap;
+    va_start(ap, format);
+    int n = vsnprintf(buf, sizeof(buf), format, ap);
+    va_end(ap);
+    if(n > 0)
+        out.append(buf, n < (int)sizeof(buf) ? n : sizeof(buf) - 1);
+}
+
+std::string metrics::render()
+{
+    alloc_scope scope(ALLOC_METRICS);
+
+    // 汇总各线程分片，各项之间不是同一时刻的快照
+    long long counters[COUNTER_NUM] = {0};
+    long long levels[LEVEL_NUM] = {0};
+    long long sum[STAGE_NUM] = {0};
+    std::vector<long long> hist(STAGE_NUM * metrics_shard::BUCKETS, 0);
+    std::vector<gauge> gauges;
+
+    m_lock.lock();
+    for(size_t k = 0; k < m_shards.size(); ++k)
+    {
+        const metrics_shard *s = m_shards[k];
+        for(int i = 0; i < COUNTER_NUM; ++i)
+            counters[i] += s->counters[i].load(std::memory_order_relaxed);
+        for(int i = 0; i < LEVEL_NUM; ++i)
+            levels[i] += s->levels[i].load(std::memory_order_relaxed);
+        for(int i = 0; i < STAGE_NUM; ++i)
+        {
+            sum[i] += s->sum[i].load(std::memory_order_relaxed);
+            for(int j = 0; j < metrics_shard::BUCKETS; ++j)
+                hist[i * metrics_shard::BUCKETS + j] += s->hist[i][j].load(std::memory_order_relaxed);
+        }
+    }
+    gauges = m_gauges;
+    m_lock.unlock();
+
+    std::string out;
+    out.reserve(16 * 1024);
+    for(int i = 0; i < COUNTER_NUM; ++i)
+    {
+        append(out, "# HELP %s %s\n# TYPE %s counter\n", counter_info[i].name, counter_info[i].help, counter_info[i].name);
+        append(out, "%s %lld\n", counter_info[i].name, counters[i]);
+    }
+    for(int i = 0; i < LEVEL_NUM; ++i)
+    {
+        append(out, "# HELP %s %s\n# TYPE %s gauge\n", level_info[i].name, level_info[i].help, level_info[i].name);
+        append(out, "%s %lld\n", level_info[i].name, levels[i]);
+    }
+    for(size_t i = 0; i < gauges.size(); ++i)
+    {
+        append(out, "# HELP %s %s\n# TYPE %s gauge\n", gauges[i].name.c_str(), gauges[i].help.c_str(), gauges[i].name.c_str());
+        append(out, "%s %.17g\n", gauges[i].name.c_str(), gauges[i].fn());
+    }
+
+    // 边界落在HDR桶中间时，该桶整体计入更大的边界
+    const char *hname = "webserver_stage_duration_seconds";
+    append(out, "# HELP %s Time spent in each request stage.\n# TYPE %s histogram\n", hname, hname);
+    for(int i = 0; i < STAGE_NUM; ++i)
+    {
+        const long long *h = &hist[i * metrics_shard::BUCKETS];
+        long long total = 0;
+        int j = 0;
+        for(size_t b = 0; b < sizeof(bucket_bounds) / sizeof(bucket_bounds[0]); ++b)
+        {
+            for(; j < metrics_shard::BUCKETS && bucket_upper(j) <= bucket_bounds[b]; ++j)
+                total += h[j];
+            append(out, "%s_bucket{stage=\"%s\",le=\"%g\"} %lld\n", hname, stage_name[i], bucket_bounds[b] / 1e6, total);
+        }
+        for(; j < metrics_shard::BUCKETS; ++j)
+            total += h[j];
+        append(out, "%s_bucket{stage=\"%s\",le=\"+Inf\"} %lld\n", hname, stage_name[i], total);
+        append(out, "%s_sum{stage=\"%s\"} %.6f\n", hname, stage_name[i], sum[i] / 1e6);
+        append(out, "%s_count{stage=\"%s\"} %lld\n", hname, stage_name[i], total);
+    }
+
+    // HDR桶直接给出的分位数，值为所在桶的上界
+    const char *qname = "webserver_stage_duration_quantile_seconds";
+    append(out, "# HELP %s Stage duration quantiles from the HDR histogram.\n# TYPE %s gauge\n", qname, qname);
+    for(int i = 0; i < STAGE_NUM; ++i)
+    {
+        const long long *h = &hist[i * metrics_shard::BUCKETS];
+        long long total = 0;
+        for(int j = 0; j < metrics_shard::BUCKETS; ++j)
+            total += h[j];
+        if(0 == total)
+            continue;
+        for(size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); ++q)
+        {
+            long long rank = (long long)(quantiles[q] * total);
+            if(rank >= total)
+                rank = total - 1;
+            long long seen = 0;
+            int j = 0;
+            for(; j < metrics_shard::BUCKETS; ++j)
+            {
+                seen += h[j];
+                if(seen > rank)
+                    break;
+            }
+            append(out, "%s{stage=\"%s\",quantile=\"%g\"} %g\n", qname, stage_name[i], quantiles[q], bucket_upper(j) / 1e6);
+        }
+    }
+
+#ifdef LOCK_PROFILE
+    // 锁竞争统计，同名的锁已合并，没有获取过的不输出
+    lock_stats *locks = lock_profile::stats();
+    int nlocks = lock_profile::count().load(std::memory_order_acquire);
+    for(size_t m = 0; m < sizeof(lock_info) / sizeof(lock_info[0]); ++m)
+    {
+        append(out, "# HELP %s %s\n# TYPE %s %s\n", lock_info[m].name, lock_info[m].help, lock_info[m].name, lock_info[m].type);
+        for(int i = 0; i < nlocks; ++i)
+        {
+            if(0 == locks[i].acquires.load(std::memory_order_relaxed) ||
+               (lock_info[m].mutex_only && strcmp(locks[i].kind, "mutex") != 0))
+                continue;
+            long long v = (locks[i].*lock_info[m].field).load(std::memory_order_relaxed);
+            if(lock_info[m].seconds)
+                append(out, "%s{lock=\"%s\",kind=\"%s\"} %.9f\n", lock_info[m].name, locks[i].name, locks[i].kind, v / 1e9);
+            else
+                append(out, "%s{lock=\"%s\",kind=\"%s\"} %lld\n", lock_info[m].name, locks[i].name, locks[i].kind, v);
+        }
+    }
+#endif
+
+#ifdef ALLOC_PROFILE
+    // 分配统计，各线程槽求和，单个请求的最大值取各槽最大
+    alloc_slot *slots = alloc_profile::slots();
+    int nslots = alloc_profile::slot_count();
+    long long alloc_count[ALLOC_NUM] = {0}, alloc_bytes[ALLOC_NUM] = {0};
+    long long alloc_req[sizeof(alloc_request_info) / sizeof(alloc_request_info[0])][ALLOC_REQ_NUM] = {{0}};
+    for(int k = 0; k < nslots; ++k)
+    {
+        for(int i = 0; i < ALLOC_NUM; ++i)
+        {
+            alloc_count[i] += slots[k].count[i].load(std::memory_order_relaxed);
+            alloc_bytes[i] += slots[k].bytes[i].load(std::memory_order_relaxed);
+        }
+        for(size_t m = 0; m < sizeof(alloc_request_info) / sizeof(alloc_request_info[0]); ++m)
+        {
+            for(int i = 0; i < ALLOC_REQ_NUM; ++i)
+            {
+                long long v = (slots[k].*alloc_request_info[m].field)[i].load(std::memory_order_relaxed);
+                if(&alloc_slot::req_max == alloc_request_info[m].field)
+                    alloc_req[m][i] = std::max(alloc_req[m][i], v);
+                else
+                    alloc_req[m][i] += v;
+            }
+        }
+    }
+    append(out, "# HELP webserver_alloc_total Allocations by subsystem.\n# TYPE webserver_alloc_total counter\n");
+    for(int i = 0; i < ALLOC_NUM; ++i)
+        append(out, "webserver_alloc_total{subsystem=\"%s\"} %lld\n", alloc_subsystem_name[i], alloc_count[i]);
+    append(out, "# HELP webserver_alloc_bytes_total Bytes allocated by subsystem.\n# TYPE webserver_alloc_bytes_total counter\n");
+    for(int i = 0; i < ALLOC_NUM; ++i)
+        append(out, "webserver_alloc_bytes_total{subsystem=\"%s\"} %lld\n", alloc_subsystem_name[i], alloc_bytes[i]);
+    for(size_t m = 0; m < sizeof(alloc_request_info) / sizeof(alloc_request_info[0]); ++m)
+    {
+        append(out, "# HELP %s %s\n# TYPE %s %s\n", alloc_request_info[m].name, alloc_request_info[m].help,
+               alloc_request_info[m].name, alloc_request_info[m].type);
+        for(int i = 0; i < ALLOC_REQ_NUM; ++i)
+            append(out, "%s{kind=\"%s\"} %lld\n", alloc_request_info[m].name, alloc_kind_name[i], alloc_req[m][i]);
+    }
+#endif
+    return out;
+}
@@ -0,0 +1,143 @@
+#ifndef _METRICS_H
+#define _METRICS_H
+
+/**
+ *      运行指标
+ *   1. 计数器与各阶段耗时直方图按线程分片，每个分片独占缓存行，只由所属线程写入，
+ *      写入为不加锁的 relaxed 读加写，没有原子读改写，/metrics 请求时汇总所有分片
+ *   2. 直方图为HDR式的对数线性分桶：每个2的幂区间分为8个子桶，相对误差不超过12.5%，
+ *      按微秒记录，上限约19小时
+ *   3. 连接数、队列长度等全局计量由各模块注册读取函数，输出时调用
+ *   输出为 Prometheus 文本格式，由 /metrics 路由返回
+*/
+
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <functional>
+#include "../lock/locker.h"
+
+enum METRIC_STAGE
+{
+    STAGE_ACCEPT = 0,       // 接受连接并初始化
+    STAGE_READ,             // 读取请求 read_once
+    STAGE_QUEUE,            // 在线程池中排队
+    STAGE_PARSE,            // 解析请求 process_read，不含 do_request
+    STAGE_HANDLER,          // 处理请求 do_request
+    STAGE_DB,               // 访问用户存储
+    STAGE_WRITE,            // 发送响应，一个响应多次 write 的耗时之和
+    STAGE_TOTAL,            // 开始读取请求到响应发送完成
+    STAGE_NUM
+};
+
+enum METRIC_COUNTER
+{
+    COUNTER_ACCEPTED = 0,   // 接受的连接数
+    COUNTER_REQUESTS,       // 完成的请求数
+    COUNTER_ERRORS,         // 状态码>=400的请求数
+    COUNTER_BYTES_SENT,     // 发送的字节数
+    COUNTER_CACHE_HITS,     // 事件循环直接写回的缓存请求数
+    COUNTER_SHED,           // 车道已满回复503的请求数
+    COUNTER_NUM
+};
+
+enum METRIC_LEVEL
+{
+    LEVEL_POOL_BUSY = 0,    // 正在处理请求的工作线程数，各线程分别增减
+    LEVEL_NUM
+};
+
+struct alignas(64) metrics_shard
+{
+    static const int SUB_BITS = 3;
+    static const int SUB = 1 << SUB_BITS;
+    static const int BUCKETS = 34 * SUB;        // 覆盖到 2^36 us
+
+    std::atomic<long long> counters[COUNTER_NUM];
+    std::atomic<long long> levels[LEVEL_NUM];
+    std::atomic<long long> sum[STAGE_NUM];      // 各阶段耗时之和(us)
+    std::atomic<long long> hist[STAGE_NUM][BUCKETS];
+    metrics_shard *next;                        // 线程退出后放入空闲链表，由新线程复用，计数不清零
+
+    metrics_shard();
+};
+
+class metrics
+{
+public:
+    static metrics *get_instance()
+    {
+        static metrics instance;
+        return &instance;
+    }
+
+    static void count(int counter, long long n = 1)
+    {
+        std::atomic<long long> &c = local()->counters[counter];
+        c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    static void level(int level, long long delta)
+    {
+        std::atomic<long long> &c = local()->levels[level];
+        c.store(c.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    }
+    static void observe(int stage, long long us)
+    {
+        if(us < 0)
+            us = 0;
+        metrics_shard *s = local();
+        std::atomic<long long> &b = s->hist[stage][bucket_of(us)];
+        b.store(b.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        s->sum[stage].store(s->sum[stage].load(std::memory_order_relaxed) + us, std::memory_order_relaxed);
+    }
+    static long long now_us()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+    }
+
+    static int bucket_of(long long us)
+    {
+        if(us < metrics_shard::SUB)
+            return us;
+        int shift = 63 - __builtin_clzll(us) - metrics_shard::SUB_BITS;
+        int index = (shift + 1) * metrics_shard::SUB + ((us >> shift) & (metrics_shard::SUB - 1));
+        return index < metrics_shard::BUCKETS ? index : metrics_shard::BUCKETS - 1;
+    }
+    static long long bucket_upper(int index);           // 桶中的最大值(us)
+
+    // 注册全局计量，输出时调用 fn 取值
+    void add_gauge(const char *name, const char *help, std::function<double()> fn);
+    // Prometheus 文本格式
+    std::string render();
+
+private:
+    metrics() : m_lock("metrics"), m_free(NULL) {}
+    static metrics_shard *local()
+    {
+        metrics_shard *s = t_shard;
+        return s ? s : get_instance()->acquire();
+    }
+    metrics_shard *acquire();                   // 为当前线程分配分片
+    void release(metrics_shard *shard);         // 线程退出时调用
+    friend struct metrics_holder;
+
+private:
+    struct gauge
+    {
+        std::string name;
+        std::string help;
+        std::function<double()> fn;
+    };
+
+    static thread_local metrics_shard *t_shard;
+    locker m_lock;
+    std::vector<metrics_shard *> m_shards;      // 所有分片，只增不减
+    metrics_shard *m_free;                      // 已退出线程的分片
+    std::vector<gauge> m_gauges;
+};
+
+#endif
@@ -0,0 +1,206 @@
+#include "trace.h"
+#include "alloc_profile.h"
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <algorithm>
+
+thread_local uint64_t tracer::t_current = 0;
+thread_local trace_ring *tracer::t_ring = NULL;
+thread_local uint32_t tracer::t_seed = 0;
+
+/* 线程退出时归还缓冲区 */
+struct trace_holder
+{
+    trace_ring *ring;
+
+    trace_holder() : ring(NULL) {}
+    ~trace_holder()
+    {
+        if(ring)
+            tracer::get_instance()->release(ring);
+    }
+};
+
+static thread_local trace_holder t_holder;
+
+bool tracer::init(int interval, int slow_ms)
+{
+    m_interval = interval > 0 ? interval : 0;
+    m_slow_us = slow_ms > 0 ? slow_ms * 1000LL : 0;
+    if(0 == m_interval || 0 == m_slow_us)
+        return true;
+
+    m_slow_fp = fopen("./TraceSlow.json", "a");
+    if(!m_slow_fp)
+        return false;
+    if(0 == ftell(m_slow_fp))
+        fputs("[\n", m_slow_fp);
+    fflush(m_slow_fp);
+    return true;
+}
+
+tracer::~tracer()
+{
+    if(m_slow_fp)
+        fclose(m_slow_fp);
+}
+
+uint64_t tracer::sample()
+{
+    // 随机抽样，按固定间隔抽样会与周期性的请求序列同步，总是抽到同一类请求
+    uint32_t x = t_seed ? t_seed : ((uint32_t)(uintptr_t)&t_seed | 1);
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    t_seed = x;
+    if(x % m_interval)
+        return 0;
+    return m_next_id.fetch_add(1, std::memory_order_relaxed);
+}
+
+trace_ring *tracer::acquire()
+{
+    m_lock.lock();
+    trace_ring *r = m_free;
+    if(r)
+    {
+        m_free = r->next;
+        r->next = NULL;
+    }
+    else
+    {
+        r = new trace_ring;
+        m_rings.push_back(r);
+    }
+    m_lock.unlock();
+
+    // 复用的缓冲区保留旧线程的记录，只更新线程信息
+    r->lock.lock();
+    r->tid = syscall(SYS_gettid);
+    pthread_getname_np(pthread_self(), r->thread_name, sizeof(r->thread_name));
+    r->lock.unlock();
+
+    t_ring = r;
+    t_holder.ring = r;
+    return r;
+}
+
+void tracer::release(trace_ring *ring)
+{
+    t_ring = NULL;
+    m_lock.lock();
+    ring->next = m_free;
+    m_free = ring;
+    m_lock.unlock();
+}
+
+void tracer::record(uint64_t id, const char *name, long long start, long long dur)
+{
+    trace_ring *r = t_ring ? t_ring : acquire();
+    r->lock.lock();
+    trace_event &e = r->events[r->head & (trace_ring::SIZE - 1)];
+    e.id = id;
+    e.name = name;
+    e.start = start;
+    e.dur = dur < 0 ? 0 : dur;
+    ++r->head;
+    r->lock.unlock();
+}
+
+static void append_event(std::string &out, const trace_event &e, int pid, int tid)
+{
+    char buf[256];
+    int n = snprintf(buf, sizeof(buf),
+                     "{\"name\":\"%s\",\"cat\":\"request\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,"
+                     "\"pid\":%d,\"tid\":%d,\"args\":{\"req\":%llu}}",
+                     e.name, e.start, e.dur, pid, tid, (unsigned long long)e.id);
+    if(n > 0)
+        out.append(buf, n < (int)sizeof(buf) ? n : sizeof(buf) - 1);
+}
+
+// 复制缓冲区中的记录与线程信息，id 非0时只取该请求的记录
+static int copy_ring(trace_ring *r, uint64_t id, std::vector<trace_event> &events, char *name)
+{
+    r->lock.lock();
+    int tid = r->tid;
+    if(name)
+        strcpy(name, r->thread_name);
+    unsigned long long first = r->head > (unsigned long long)trace_ring::SIZE ? r->head - trace_ring::SIZE : 0;
+    for(unsigned long long i = first; i < r->head; ++i)
+    {
+        const trace_event &e = r->events[i & (trace_ring::SIZE - 1)];
+        if(0 == id || e.id == id)
+            events.push_back(e);
+    }
+    r->lock.unlock();
+    return tid;
+}
+
+void tracer::finish(uint64_t id, long long total_us)
+{
+    if(0 == m_slow_us || total_us < m_slow_us || !m_slow_fp)
+        return;
+
+    alloc_scope scope(ALLOC_METRICS);
+    m_lock.lock();
+    std::vector<trace_ring *> rings = m_rings;
+    m_lock.unlock();
+
+    // 一个请求的各阶段可能分布在事件循环与工作线程上
+    std::string out;
+    int pid = getpid();
+    for(size_t k = 0; k < rings.size(); ++k)
+    {
+        std::vector<trace_event> events;
+        int tid = copy_ring(rings[k], id, events, NULL);
+        for(size_t i = 0; i < events.size(); ++i)
+        {
+            append_event(out, events[i], pid, tid);
+            out += ",\n";
+        }
+    }
+
+    m_lock.lock();
+    fwrite(out.data(), 1, out.size(), m_slow_fp);
+    fflush(m_slow_fp);
+    m_lock.unlock();
+}
+
+std::string tracer::render()
+{
+    alloc_scope scope(ALLOC_METRICS);
+    m_lock.lock();
+    std::vector<trace_ring *> rings = m_rings;
+    m_lock.unlock();
+
+    std::string out;
+    out.reserve(64 * 1024);
+    out += "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    int pid = getpid();
+    bool first = true;
+    for(size_t k = 0; k < rings.size(); ++k)
+    {
+        std::vector<trace_event> events;
+        char name[sizeof(rings[k]->thread_name)];
+        int tid = copy_ring(rings[k], 0, events, name);
+        if(events.empty())
+            continue;
+
+        std::replace(name, name + strlen(name), '"', '\'');
+        std::replace(name, name + strlen(name), '\\', '/');
+        char buf[160];
+        snprintf(buf, sizeof(buf), "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s-%d\"}}",
+                 first ? "\n" : ",\n", pid, tid, name, tid);
+        out += buf;
+        first = false;
+        for(size_t i = 0; i < events.size(); ++i)
+        {
+            out += ",\n";
+            append_event(out, events[i], pid, tid);
+        }
+    }
+    out += "\n]}\n";
+    return out;
+}
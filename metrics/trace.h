@@ -0,0 +1,142 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+/**
+ *      请求追踪
+ *   1. 平均每 interval 个请求随机抽取一个并分配请求编号，未抽中或未开启时编号为0，各埋点只判断编号
+ *   2. 记录 阶段名、开始时间、耗时 到当前线程的环形缓冲区，写满后覆盖最旧的记录
+ *      缓冲区由互斥锁保护，只有被抽中的请求才会加锁，读取时几乎没有竞争
+ *   3. http_conn 持有请求编号，线程池与 do_request 按编号记录各阶段；
+ *      do_request 执行期间把编号设为线程当前编号，数据库连接池、用户存储用 trace_span 记录到当前编号下
+ *   4. 输出为 Chrome trace-event JSON，可载入 chrome://tracing 或 Perfetto：
+ *      GET /trace 返回各线程缓冲区中的全部记录；
+ *      总耗时超过慢请求阈值的请求，其全部记录追加到 TraceSlow.json (JSON数组格式，末尾不闭合)
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "../lock/locker.h"
+
+struct trace_event
+{
+    uint64_t id;            // 请求编号
+    const char *name;       // 阶段名，必须是字符串常量
+    long long start;        // 开始时间(us)
+    long long dur;          // 耗时(us)
+};
+
+struct trace_ring
+{
+    static const int SIZE = 4096;       // 必须是2的幂
+
+    trace_event events[SIZE];
+    unsigned long long head;            // 累计写入的记录数
+    int tid;
+    char thread_name[16];
+    locker lock;
+    trace_ring *next;                   // 线程退出后放入空闲链表，由新线程复用
+
+    trace_ring() : head(0), tid(0), lock("trace_ring"), next(NULL) { thread_name[0] = '\0'; }
+};
+
+class tracer
+{
+public:
+    static tracer *get_instance()
+    {
+        static tracer instance;
+        return &instance;
+    }
+
+    // interval 抽样间隔，0为关闭；slow_ms 慢请求阈值，0为不输出慢请求
+    bool init(int interval, int slow_ms);
+    bool enabled() { return m_interval > 0; }
+
+    // 开始一个请求，返回请求编号，未抽中返回0
+    static uint64_t begin()
+    {
+        tracer *t = get_instance();
+        return t->m_interval > 0 ? t->sample() : 0;
+    }
+    static void span(uint64_t id, const char *name, long long start, long long end)
+    {
+        if(id)
+            get_instance()->record(id, name, start, end - start);
+    }
+    // 请求结束，总耗时超过慢请求阈值时输出该请求的全部记录
+    static void end(uint64_t id, long long total_us)
+    {
+        if(id)
+            get_instance()->finish(id, total_us);
+    }
+
+    static uint64_t current() { return t_current; }
+    static void set_current(uint64_t id) { t_current = id; }
+
+    static long long now_us()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+    }
+
+    // 所有线程缓冲区中的记录，Chrome trace-event JSON 对象格式
+    std::string render();
+
+private:
+    tracer() : m_interval(0), m_slow_us(0), m_next_id(1), m_lock("trace"), m_free(NULL), m_slow_fp(NULL) {}
+    ~tracer();
+    uint64_t sample();
+    void record(uint64_t id, const char *name, long long start, long long dur);
+    void finish(uint64_t id, long long total_us);
+    trace_ring *acquire();                  // 为当前线程分配缓冲区
+    void release(trace_ring *ring);         // 线程退出时调用
+    friend struct trace_holder;
+
+private:
+    static thread_local uint64_t t_current;
+    static thread_local trace_ring *t_ring;
+    static thread_local uint32_t t_seed;    // 抽样用的随机数状态
+
+    int m_interval;
+    long long m_slow_us;
+    std::atomic<uint64_t> m_next_id;
+    locker m_lock;                          // 保护缓冲区列表与慢请求文件
+    std::vector<trace_ring *> m_rings;      // 所有缓冲区，只增不减
+    trace_ring *m_free;
+    FILE *m_slow_fp;
+};
+
+// 在作用域内以线程当前请求编号记录一个阶段
+class trace_span
+{
+public:
+    explicit trace_span(const char *name) : m_id(tracer::current()), m_name(name), m_start(m_id ? tracer::now_us() : 0) {}
+    ~trace_span()
+    {
+        if(m_id)
+            tracer::span(m_id, m_name, m_start, tracer::now_us());
+    }
+
+private:
+    uint64_t m_id;
+    const char *m_name;
+    long long m_start;
+};
+
+// 在作用域内设置线程当前请求编号，退出时恢复
+class trace_scope
+{
+public:
+    explicit trace_scope(uint64_t id) : m_prev(tracer::current()) { tracer::set_current(id); }
+    ~trace_scope() { tracer::set_current(m_prev); }
+
+private:
+    uint64_t m_prev;
+};
+
+#endif
@@ -1,8 +1,11 @@
 #include "sql_connection_pool.h"
+#include "../metrics/alloc_profile.h"
 
-sqlconnection_pool::sqlconnection_pool()
+sqlconnection_pool::sqlconnection_pool() : lock("sql_pool")
 {
+    m_MaxConn = 0;
     m_CurConn = 0;
+    m_WaitConn = 0;
     m_FreeConn = 0;
 }
 
@@ -49,7 +52,7 @@ void sqlconnection_pool::init(std::string url, std::string User, std::string Pas
         ++m_FreeConn;
     }
     // 初始化连接池信号量，数量初始化跟创建的连接池一样
-    reserve = sem(m_FreeConn);
+    reserve = sem(m_FreeConn, "sql_pool_conn");
 
     m_MaxConn = m_FreeConn;
 }
@@ -60,13 +63,20 @@ MYSQL* sqlconnection_pool::GetConnection()
 {
     MYSQL* conn = NULL;
     
-    if(0 == connList.size())
+    // 连接池未初始化
+    if(0 == m_MaxConn)
         return NULL;
     
-    // 获取信号量，如果有连接则信号量减1
-    reserve.wait();
+    // 获取信号量，如果有连接则信号量减1，没有空闲连接时阻塞等待
+    ++m_WaitConn;
+    {
+        trace_span span("db_conn_wait");
+        reserve.wait();
+    }
+    --m_WaitConn;
     
     // 互斥访问 连接池链表
+    alloc_scope alloc(ALLOC_SQL);
     lock.lock();
 
     // 从连接池中取出连接
@@ -88,6 +98,7 @@ bool sqlconnection_pool::ReleaseConnection(MYSQL* con)
     if(NULL == con)
         return false;
 
+    alloc_scope alloc(ALLOC_SQL);
     lock.lock();
 
     connList.push_back(con);
@@ -112,6 +123,7 @@ void sqlconnection_pool::DestroyPool()
             MYSQL *con = *it;
             mysql_close(con);
         }
+        m_MaxConn = 0;
         m_CurConn = 0;
         m_FreeConn = 0;
         connList.clear();
@@ -129,6 +141,11 @@ int sqlconnection_pool::GetFreeConn()
     return m_FreeConn;
 }
 
+int sqlconnection_pool::GetBusyConn()
+{
+    return m_CurConn.load(std::memory_order_relaxed) + m_WaitConn.load(std::memory_order_relaxed);
+}
+
 /*  mysql连接的RAII类实现， 创建实例时自动获得mysql连接， 销毁实例时自动归还连接给连接池 */
 sqlconnectionRAII::sqlconnectionRAII(MYSQL** con, sqlconnection_pool* pool)
 {
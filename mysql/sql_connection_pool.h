@@ -15,8 +15,10 @@
 #include <string.h>
 #include <iostream>
 #include <string>
+#include <atomic>
 #include "../lock/locker.h"
 #include "../log/log.h"
+#include "../metrics/trace.h"
 
 
 class sqlconnection_pool
@@ -25,6 +27,7 @@ public:
     MYSQL* GetConnection();                     // 获取数据库连接
     bool ReleaseConnection(MYSQL* conn);        // 释放连接
     int GetFreeConn();                          // 得到空闲数据库连接数量
+    int GetBusyConn();                          // 正在使用或等待数据库连接的线程数量
     void DestroyPool();                         // 销毁连接池
 
     // 单例模式
@@ -37,7 +40,8 @@ private:
     ~sqlconnection_pool();
 
     int m_MaxConn;          // 最大连接数
-    int m_CurConn;          // 已经分配连接数
+    std::atomic<int> m_CurConn;     // 已经分配连接数
+    std::atomic<int> m_WaitConn;    // 等待连接的线程数
     int m_FreeConn;         // 空闲连接数
     locker lock;            // 互斥锁
     std::list<MYSQL*> connList;     // 连接链表
@@ -50,6 +54,7 @@ public:
     std::string m_PassWord;     // 数据库用户密码
     std::string m_Databasename; // 数据库名
     int m_close_log;            // 日志开关
+    static const int m_log_module = LOG_MODULE_SQL;
 };
 
 
@@ -0,0 +1,455 @@
+#include "kv_store.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <libgen.h>
+#include <chrono>
+
+kv_store::kv_store() : m_fd(-1), m_tail(0), m_dead_bytes(0), m_lock("kv_store"), m_stop(false), m_close_log(0)
+{
+}
+
+kv_store::~kv_store()
+{
+    close();
+}
+
+bool kv_store::open(const char *path, int close_log, int compact_interval)
+{
+    m_path = path;
+    m_close_log = close_log;
+
+    // 压缩过程中崩溃会残留临时文件，原数据文件仍然完整，直接删除
+    std::string tmp = m_path + ".compact";
+    unlink(tmp.c_str());
+
+    m_fd = ::open(m_path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if(m_fd < 0)
+    {
+        LOG_ERROR("kv_store open %s error: %d", path, errno);
+        return false;
+    }
+
+    if(!recover())
+    {
+        ::close(m_fd);
+        m_fd = -1;
+        return false;
+    }
+    LOG_INFO("kv_store open %s : %d keys, %lld bytes", path, (int)m_index.size(), (long long)m_tail);
+
+    if(compact_interval > 0)
+    {
+        m_stop = false;
+        m_compact_thread = std::thread(&kv_store::compact_loop, this, compact_interval);
+    }
+    return true;
+}
+
+void kv_store::close()
+{
+    if(m_compact_thread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_compact_mutex);
+            m_stop = true;
+        }
+        m_compact_cond.notify_all();
+        m_compact_thread.join();
+    }
+
+    m_lock.lock();
+    if(m_fd >= 0)
+    {
+        fdatasync(m_fd);
+        ::close(m_fd);
+        m_fd = -1;
+    }
+    m_index.clear();
+    m_lock.unlock();
+}
+
+/* 顺序扫描数据文件重建索引
+ * 写到文件末尾的不完整或校验失败的记录视为崩溃时的残留写入，截断丢弃；
+ * 后面还有数据的损坏记录不能确定其后记录的边界，截断会丢失之后的全部记录，拒绝打开交由人工处理 */
+bool kv_store::recover()
+{
+    off_t end = lseek(m_fd, 0, SEEK_END);
+    if(end < 0)
+        return false;
+
+    off_t offset = 0;
+    char header[HEADER_SIZE];
+    std::string body;
+    m_index.clear();
+    m_dead_bytes = 0;
+    bool torn = false;      // 损坏的记录延伸到文件末尾
+
+    while(offset < end)
+    {
+        if(offset + HEADER_SIZE > end)
+        {
+            torn = true;
+            break;
+        }
+        if(!read_all(m_fd, header, HEADER_SIZE, offset))
+            return false;
+
+        uint32_t crc, klen, vlen;
+        uint8_t type = header[4];
+        memcpy(&crc, header, 4);
+        memcpy(&klen, header + 5, 4);
+        memcpy(&vlen, header + 9, 4);
+
+        // 记录头无效时无法得到记录长度，只有其后全为0(文件扩展后数据未落盘)时才视为末尾残留
+        if((type != RECORD_PUT && type != RECORD_DEL) || klen > MAX_FIELD_SIZE || vlen > MAX_FIELD_SIZE)
+        {
+            torn = zero_tail(offset, end);
+            break;
+        }
+        off_t record_size = HEADER_SIZE + (off_t)klen + (off_t)vlen;
+        if(offset + record_size > end)
+        {
+            torn = true;
+            break;
+        }
+
+        body.resize(klen + vlen);
+        if(!read_all(m_fd, &body[0], klen + vlen, offset + HEADER_SIZE))
+            return false;
+        if(crc32(crc32(0, header + 4, HEADER_SIZE - 4), body.data(), body.size()) != crc)
+        {
+            torn = offset + record_size == end;
+            break;
+        }
+
+        std::string key(body, 0, klen);
+        auto it = m_index.find(key);
+        if(it != m_index.end())
+        {
+            m_dead_bytes += HEADER_SIZE + klen + it->second.vlen;
+        }
+
+        if(type == RECORD_PUT)
+        {
+            index_entry entry;
+            entry.offset = offset + HEADER_SIZE + klen;
+            entry.vlen = vlen;
+            m_index[key] = entry;
+        }
+        else
+        {
+            if(it != m_index.end())
+                m_index.erase(it);
+            m_dead_bytes += record_size;
+        }
+        offset += record_size;
+    }
+
+    if(offset < end)
+    {
+        if(!torn)
+        {
+            LOG_ERROR("kv_store %s: corrupt record at %lld with %lld bytes after it, refuse to open",
+                      m_path.c_str(), (long long)offset, (long long)(end - offset));
+            m_index.clear();
+            return false;
+        }
+        LOG_WARN("kv_store %s: truncate %lld bytes of torn record at %lld",
+                 m_path.c_str(), (long long)(end - offset), (long long)offset);
+        if(ftruncate(m_fd, offset) != 0)
+            return false;
+        fdatasync(m_fd);
+    }
+    m_tail = offset;
+    return true;
+}
+
+// [offset, end) 是否全为0
+bool kv_store::zero_tail(off_t offset, off_t end)
+{
+    char buf[4096];
+    while(offset < end)
+    {
+        size_t n = end - offset < (off_t)sizeof(buf) ? end - offset : sizeof(buf);
+        if(!read_all(m_fd, buf, n, offset))
+            return false;
+        for(size_t i = 0; i < n; ++i)
+        {
+            if(buf[i])
+                return false;
+        }
+        offset += n;
+    }
+    return true;
+}
+
+bool kv_store::append_record(int type, const std::string &key, const std::string &value)
+{
+    if(m_fd < 0 || key.size() > MAX_FIELD_SIZE || value.size() > MAX_FIELD_SIZE)
+        return false;
+
+    uint32_t klen = key.size(), vlen = value.size();
+    std::string record(HEADER_SIZE, '\0');
+    record[4] = (char)type;
+    memcpy(&record[5], &klen, 4);
+    memcpy(&record[9], &vlen, 4);
+    record += key;
+    record += value;
+
+    uint32_t crc = crc32(0, record.data() + 4, record.size() - 4);
+    memcpy(&record[0], &crc, 4);
+
+    // 写入失败时截断回原末尾，保证日志中不留下半条记录
+    if(!write_all(m_fd, record.data(), record.size()) || fdatasync(m_fd) != 0)
+    {
+        LOG_ERROR("kv_store append error: %d", errno);
+        if(ftruncate(m_fd, m_tail) != 0)
+            LOG_ERROR("kv_store truncate error: %d", errno);
+        return false;
+    }
+    m_tail += record.size();
+    return true;
+}
+
+bool kv_store::get(const std::string &key, std::string &value)
+{
+    m_lock.lock();
+    auto it = m_index.find(key);
+    if(it == m_index.end())
+    {
+        m_lock.unlock();
+        return false;
+    }
+    value.resize(it->second.vlen);
+    bool ret = it->second.vlen == 0 || read_all(m_fd, &value[0], it->second.vlen, it->second.offset);
+    m_lock.unlock();
+    return ret;
+}
+
+bool kv_store::put(const std::string &key, const std::string &value)
+{
+    m_lock.lock();
+    off_t value_offset = m_tail + HEADER_SIZE + key.size();
+    if(!append_record(RECORD_PUT, key, value))
+    {
+        m_lock.unlock();
+        return false;
+    }
+
+    auto it = m_index.find(key);
+    if(it != m_index.end())
+    {
+        m_dead_bytes += HEADER_SIZE + key.size() + it->second.vlen;
+    }
+    index_entry entry;
+    entry.offset = value_offset;
+    entry.vlen = value.size();
+    m_index[key] = entry;
+    m_lock.unlock();
+    return true;
+}
+
+bool kv_store::del(const std::string &key)
+{
+    m_lock.lock();
+    auto it = m_index.find(key);
+    if(it == m_index.end())
+    {
+        m_lock.unlock();
+        return false;
+    }
+    if(!append_record(RECORD_DEL, key, std::string()))
+    {
+        m_lock.unlock();
+        return false;
+    }
+    m_dead_bytes += 2 * HEADER_SIZE + 2 * key.size() + it->second.vlen;
+    m_index.erase(it);
+    m_lock.unlock();
+    return true;
+}
+
+bool kv_store::contains(const std::string &key)
+{
+    m_lock.lock();
+    bool ret = m_index.find(key) != m_index.end();
+    m_lock.unlock();
+    return ret;
+}
+
+int kv_store::size()
+{
+    m_lock.lock();
+    int ret = m_index.size();
+    m_lock.unlock();
+    return ret;
+}
+
+/* 失效数据超过阈值且占比过半时才压缩 */
+bool kv_store::need_compact()
+{
+    m_lock.lock();
+    bool ret = m_dead_bytes >= COMPACT_MIN_BYTES && m_dead_bytes * 2 >= m_tail;
+    m_lock.unlock();
+    return ret;
+}
+
+/* 将有效记录写入临时文件，落盘后原子替换原数据文件 */
+bool kv_store::compact()
+{
+    std::string tmp = m_path + ".compact";
+
+    m_lock.lock();
+    if(m_fd < 0)
+    {
+        m_lock.unlock();
+        return false;
+    }
+
+    int fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if(fd < 0)
+    {
+        m_lock.unlock();
+        LOG_ERROR("kv_store compact open %s error: %d", tmp.c_str(), errno);
+        return false;
+    }
+
+    std::unordered_map<std::string, index_entry> index;
+    index.reserve(m_index.size());
+    off_t tail = 0;
+    bool ok = true;
+    std::string record, value;
+
+    for(auto it = m_index.begin(); ok && it != m_index.end(); ++it)
+    {
+        const std::string &key = it->first;
+        uint32_t klen = key.size(), vlen = it->second.vlen;
+
+        value.resize(vlen);
+        if(vlen > 0 && !read_all(m_fd, &value[0], vlen, it->second.offset))
+        {
+            ok = false;
+            break;
+        }
+
+        record.assign(HEADER_SIZE, '\0');
+        record[4] = (char)RECORD_PUT;
+        memcpy(&record[5], &klen, 4);
+        memcpy(&record[9], &vlen, 4);
+        record += key;
+        record += value;
+        uint32_t crc = crc32(0, record.data() + 4, record.size() - 4);
+        memcpy(&record[0], &crc, 4);
+
+        ok = write_all(fd, record.data(), record.size());
+
+        index_entry entry;
+        entry.offset = tail + HEADER_SIZE + klen;
+        entry.vlen = vlen;
+        index[key] = entry;
+        tail += record.size();
+    }
+
+    ok = ok && fsync(fd) == 0 && rename(tmp.c_str(), m_path.c_str()) == 0;
+    if(!ok)
+    {
+        m_lock.unlock();
+        LOG_ERROR("kv_store compact %s error: %d", m_path.c_str(), errno);
+        ::close(fd);
+        unlink(tmp.c_str());
+        return false;
+    }
+
+    // 同步目录项，保证rename持久化
+    std::string dir = m_path;
+    int dirfd = ::open(dirname(&dir[0]), O_RDONLY | O_DIRECTORY);
+    if(dirfd >= 0)
+    {
+        fsync(dirfd);
+        ::close(dirfd);
+    }
+
+    off_t old_tail = m_tail;
+    ::close(m_fd);
+    m_fd = fd;
+    m_index.swap(index);
+    m_tail = tail;
+    m_dead_bytes = 0;
+    m_lock.unlock();
+
+    LOG_INFO("kv_store compact %s : %lld -> %lld bytes", m_path.c_str(), (long long)old_tail, (long long)tail);
+    return true;
+}
+
+void kv_store::compact_loop(int interval)
+{
+    std::unique_lock<std::mutex> lock(m_compact_mutex);
+    while(!m_stop)
+    {
+        m_compact_cond.wait_for(lock, std::chrono::seconds(interval), [this] { return m_stop; });
+        if(m_stop)
+            break;
+
+        lock.unlock();
+        if(need_compact())
+            compact();
+        lock.lock();
+    }
+}
+
+uint32_t kv_store::crc32(uint32_t crc, const char *data, size_t len)
+{
+    static uint32_t table[256];
+    static bool inited = [] {
+        for(uint32_t i = 0; i < 256; ++i)
+        {
+            uint32_t c = i;
+            for(int k = 0; k < 8; ++k)
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        return true;
+    }();
+    (void)inited;
+
+    crc = ~crc;
+    for(size_t i = 0; i < len; ++i)
+        crc = table[(crc ^ (uint8_t)data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+bool kv_store::write_all(int fd, const char *buf, size_t len)
+{
+    while(len > 0)
+    {
+        ssize_t n = ::write(fd, buf, len);
+        if(n < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            return false;
+        }
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool kv_store::read_all(int fd, char *buf, size_t len, off_t offset)
+{
+    while(len > 0)
+    {
+        ssize_t n = pread(fd, buf, len, offset);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return false;
+        buf += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
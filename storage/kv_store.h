@@ -0,0 +1,88 @@
+#ifndef _KV_STORE_H
+#define _KV_STORE_H
+
+/**
+ *      嵌入式持久化KV存储
+ *   1. 追加写日志： 所有写操作顺序追加到数据文件末尾，每条记录带CRC校验
+ *   2. 内存哈希索引： key -> value在数据文件中的偏移与长度
+ *   3. 崩溃恢复： 启动时顺序扫描数据文件重建索引，末尾不完整或校验失败的记录截断丢弃，
+ *                中间的记录损坏时拒绝打开，不丢弃其后的有效记录
+ *   4. 周期压缩： 后台线程定期检查失效数据占比，超过阈值时重写数据文件
+ *
+ *   记录格式: | crc32(4) | type(1) | klen(4) | vlen(4) | key | value |
+*/
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <string>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "../lock/locker.h"
+#include "../log/log.h"
+
+class kv_store
+{
+public:
+    kv_store();
+    ~kv_store();
+
+    // 打开数据文件并恢复索引, compact_interval 为后台压缩检查周期(秒), 0 表示不启动后台压缩
+    bool open(const char *path, int close_log, int compact_interval = 60);
+    void close();
+
+    bool get(const std::string &key, std::string &value);
+    bool put(const std::string &key, const std::string &value);
+    bool del(const std::string &key);
+    bool contains(const std::string &key);
+    int size();
+
+    // 重写数据文件，只保留有效记录
+    bool compact();
+
+private:
+    enum RECORD_TYPE
+    {
+        RECORD_PUT = 1,
+        RECORD_DEL = 2
+    };
+
+    struct index_entry
+    {
+        off_t offset;       // value 在数据文件中的偏移
+        uint32_t vlen;      // value 长度
+    };
+
+    static const int HEADER_SIZE = 13;                  // 记录头长度
+    static const uint32_t MAX_FIELD_SIZE = 1 << 20;     // key/value 最大长度
+    static const off_t COMPACT_MIN_BYTES = 1 << 20;     // 失效数据超过该值才考虑压缩
+
+    bool recover();
+    bool zero_tail(off_t offset, off_t end);            // 记录头无效时判断其后是否为未落盘的空数据
+    bool append_record(int type, const std::string &key, const std::string &value);
+    bool need_compact();
+    void compact_loop(int interval);
+
+    static uint32_t crc32(uint32_t crc, const char *data, size_t len);
+    static bool write_all(int fd, const char *buf, size_t len);
+    static bool read_all(int fd, char *buf, size_t len, off_t offset);
+
+private:
+    std::string m_path;                                     // 数据文件路径
+    int m_fd;                                               // 数据文件描述符
+    off_t m_tail;                                           // 数据文件末尾偏移
+    off_t m_dead_bytes;                                     // 失效记录占用字节数
+    std::unordered_map<std::string, index_entry> m_index;   // 内存哈希索引
+    locker m_lock;                                          // 保护索引与数据文件
+
+    std::thread m_compact_thread;                           // 后台压缩线程
+    std::mutex m_compact_mutex;
+    std::condition_variable m_compact_cond;
+    bool m_stop;
+
+    int m_close_log;
+    static const int m_log_module = LOG_MODULE_SQL;
+};
+
+#endif
@@ -0,0 +1,121 @@
+#include "user_store.h"
+#include <string.h>
+#include "../metrics/alloc_profile.h"
+
+mysql_user_store::mysql_user_store(sqlconnection_pool *connpool, int close_log)
+    : m_connpool(connpool), m_lock("user_store"), m_close_log(close_log)
+{
+}
+
+/* 从user表中读取全部用户名与密码 */
+bool mysql_user_store::init()
+{
+    MYSQL *mysql = NULL;
+    sqlconnectionRAII mysqlconn(&mysql, m_connpool);
+
+    if(mysql_query(mysql, "SELECT username,passwd FROM user"))
+    {
+        LOG_ERROR("SELECT error:%s\n", mysql_error(mysql));
+        return false;
+    }
+
+    MYSQL_RES *result = mysql_store_result(mysql);
+    if(!result)
+        return false;
+
+    m_lock.lock();
+    while(MYSQL_ROW row = mysql_fetch_row(result))
+    {
+        m_users[row[0]] = row[1];
+    }
+    m_lock.unlock();
+    mysql_free_result(result);
+    return true;
+}
+
+bool mysql_user_store::login(const char *name, const char *passwd)
+{
+    alloc_scope alloc(ALLOC_STORE);
+    m_lock.lock();
+    auto it = m_users.find(name);
+    bool ret = it != m_users.end() && it->second == passwd;
+    m_lock.unlock();
+    return ret;
+}
+
+bool mysql_user_store::regist(const char *name, const char *passwd)
+{
+    alloc_scope alloc(ALLOC_STORE);
+    // 过长的用户名或密码直接拒绝，写入数据库与内存副本的是同一字符串
+    size_t name_len = strnlen(name, MAX_FIELD_LEN + 1);
+    size_t passwd_len = strnlen(passwd, MAX_FIELD_LEN + 1);
+    if(0 == name_len || name_len > MAX_FIELD_LEN || passwd_len > MAX_FIELD_LEN)
+        return false;
+    std::string key(name, name_len);
+
+    // 在锁内检查并预留用户名，等待连接与查询时释放锁，登录不受慢查询影响
+    {
+        trace_span span("store_lock_wait");
+        m_lock.lock();
+    }
+    bool taken = m_users.find(key) != m_users.end() || !m_reserved.insert(key).second;
+    m_lock.unlock();
+    if(taken)
+        return false;
+
+    int res = 1;
+    {
+        // 只有注册需要数据库连接，在这里按需获取
+        MYSQL *mysql = NULL;
+        sqlconnectionRAII mysqlconn(&mysql, m_connpool);
+        if(mysql)
+        {
+            char esc_name[2 * MAX_FIELD_LEN + 1], esc_passwd[2 * MAX_FIELD_LEN + 1];
+            mysql_real_escape_string(mysql, esc_name, name, name_len);
+            mysql_real_escape_string(mysql, esc_passwd, passwd, passwd_len);
+
+            char sql_insert[512];
+            snprintf(sql_insert, sizeof(sql_insert), "INSERT INTO user(username, passwd) VALUES('%s', '%s')", esc_name, esc_passwd);
+
+            trace_span span("mysql_query");
+            alloc_scope sql(ALLOC_SQL);
+            res = mysql_query(mysql, sql_insert);
+        }
+    }
+
+    // 写入成功时提交到内存副本，失败时取消预留
+    m_lock.lock();
+    if(!res)
+        m_users[key] = std::string(passwd, passwd_len);
+    m_reserved.erase(key);
+    m_lock.unlock();
+    return !res;
+}
+
+kv_user_store::kv_user_store(int close_log) : m_lock("user_store"), m_close_log(close_log)
+{
+}
+
+bool kv_user_store::init(const char *path)
+{
+    return m_store.open(path, m_close_log);
+}
+
+bool kv_user_store::login(const char *name, const char *passwd)
+{
+    alloc_scope alloc(ALLOC_STORE);
+    std::string value;
+    return m_store.get(name, value) && value == passwd;
+}
+
+bool kv_user_store::regist(const char *name, const char *passwd)
+{
+    alloc_scope alloc(ALLOC_STORE);
+    {
+        trace_span span("store_lock_wait");
+        m_lock.lock();
+    }
+    bool ret = !m_store.contains(name) && m_store.put(name, passwd);
+    m_lock.unlock();
+    return ret;
+}
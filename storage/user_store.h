@@ -0,0 +1,65 @@
+#ifndef _USER_STORE_H
+#define _USER_STORE_H
+
+/**
+ *      用户凭证存储接口
+ *   登录/注册只依赖该接口，具体后端由配置选择
+ *      mysql_user_store : 启动时把user表读入内存，注册时写回MySQL
+ *      kv_user_store    : 嵌入式KV存储，单机部署无需外部数据库
+*/
+
+#include <string>
+#include <map>
+#include <set>
+#include "../lock/locker.h"
+#include "../mysql/sql_connection_pool.h"
+#include "kv_store.h"
+
+class user_store
+{
+public:
+    virtual ~user_store() {}
+
+    // 校验用户名与密码
+    virtual bool login(const char *name, const char *passwd) = 0;
+    // 注册新用户，用户已存在或写入失败返回false
+    virtual bool regist(const char *name, const char *passwd) = 0;
+};
+
+class mysql_user_store : public user_store
+{
+public:
+    mysql_user_store(sqlconnection_pool *connpool, int close_log);
+
+    bool init();
+    bool login(const char *name, const char *passwd);
+    bool regist(const char *name, const char *passwd);
+
+    static const size_t MAX_FIELD_LEN = 100;        // 用户名与密码的最大长度，超过时拒绝注册
+
+private:
+    sqlconnection_pool *m_connpool;
+    std::map<std::string, std::string> m_users;     // user表的内存副本
+    std::set<std::string> m_reserved;               // 正在写入数据库的用户名
+    locker m_lock;                                  // 保护 m_users 与 m_reserved，等待连接与查询时不持有
+    int m_close_log;
+    static const int m_log_module = LOG_MODULE_SQL;
+};
+
+class kv_user_store : public user_store
+{
+public:
+    kv_user_store(int close_log);
+
+    bool init(const char *path);
+    bool login(const char *name, const char *passwd);
+    bool regist(const char *name, const char *passwd);
+
+private:
+    kv_store m_store;
+    locker m_lock;          // 保证注册时 检查-写入 的原子性
+    int m_close_log;
+    static const int m_log_module = LOG_MODULE_SQL;
+};
+
+#endif
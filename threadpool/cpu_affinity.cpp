@@ -0,0 +1,247 @@
+#include "cpu_affinity.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <linux/mempolicy.h>
+#include <algorithm>
+
+bool parse_cpu_list(const char *str, std::vector<int> &cpus)
+{
+    cpus.clear();
+    if(!str)
+        return false;
+
+    const char *p = str;
+    while(*p)
+    {
+        char *end;
+        long first = strtol(p, &end, 10);
+        if(end == p || first < 0)
+            return false;
+        long last = first;
+        p = end;
+        if(*p == '-')
+        {
+            last = strtol(p + 1, &end, 10);
+            if(end == p + 1 || last < first)
+                return false;
+            p = end;
+        }
+        for(long cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu)
+            cpus.push_back(cpu);
+
+        while(*p == ',' || *p == ' ' || *p == '\n')
+            ++p;
+    }
+    std::sort(cpus.begin(), cpus.end());
+    cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+    return !cpus.empty();
+}
+
+bool bind_thread_cpus(const std::vector<int> &cpus)
+{
+    if(cpus.empty())
+        return false;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(size_t i = 0; i < cpus.size(); ++i)
+        CPU_SET(cpus[i], &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+/* /sys/devices/system/cpu/cpuN/ 下存在 nodeX 目录项 */
+int cpu_to_node(int cpu)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    DIR *dir = opendir(path);
+    if(!dir)
+        return 0;
+
+    int node = 0;
+    struct dirent *entry;
+    while((entry = readdir(dir)) != NULL)
+    {
+        if(strncmp(entry->d_name, "node", 4) == 0 && entry->d_name[4] >= '0' && entry->d_name[4] <= '9')
+        {
+            node = atoi(entry->d_name + 4);
+            break;
+        }
+    }
+    closedir(dir);
+    return node;
+}
+
+bool bind_memory_node(void *addr, size_t len, int node)
+{
+    if(node < 0 || node >= 64 || len == 0)
+        return false;
+
+    // mbind 要求起始地址按页对齐
+    long page = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)addr & ~(uintptr_t)(page - 1);
+    size_t length = (uintptr_t)addr + len - start;
+
+    unsigned long nodemask = 1UL << node;
+    return syscall(SYS_mbind, start, length, MPOL_PREFERRED, &nodemask, 64, MPOL_MF_MOVE) == 0;
+}
+
+/* 在 /proc/interrupts 中查找名字包含网卡名的中断，合并它们的 smp_affinity_list */
+bool nic_irq_cpus(const char *ifname, std::vector<int> &cpus)
+{
+    cpus.clear();
+    FILE *fp = fopen("/proc/interrupts", "r");
+    if(!fp)
+        return false;
+
+    char line[4096];
+    std::vector<int> irq_cpus;
+    while(fgets(line, sizeof(line), fp))
+    {
+        if(!strstr(line, ifname))
+            continue;
+
+        char *end;
+        long irq = strtol(line, &end, 10);
+        if(end == line || *end != ':')
+            continue;
+
+        char path[64], list[1024];
+        snprintf(path, sizeof(path), "/proc/irq/%ld/smp_affinity_list", irq);
+        FILE *af = fopen(path, "r");
+        if(!af)
+            continue;
+        if(fgets(list, sizeof(list), af) && parse_cpu_list(list, irq_cpus))
+            cpus.insert(cpus.end(), irq_cpus.begin(), irq_cpus.end());
+        fclose(af);
+    }
+    fclose(fp);
+
+    std::sort(cpus.begin(), cpus.end());
+    cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+    return !cpus.empty();
+}
+
+perf_monitor::perf_monitor() : m_enable(false), m_node_migrations(0), m_lock("perf_monitor"), m_close_log(0)
+{
+}
+
+perf_monitor::~perf_monitor()
+{
+    for(size_t i = 0; i < m_threads.size(); ++i)
+    {
+        if(m_threads[i].migrations_fd >= 0)
+            close(m_threads[i].migrations_fd);
+        if(m_threads[i].llc_miss_fd >= 0)
+            close(m_threads[i].llc_miss_fd);
+    }
+}
+
+perf_monitor *perf_monitor::get_instance()
+{
+    static perf_monitor instance;
+    return &instance;
+}
+
+void perf_monitor::init(bool enable, int close_log)
+{
+    m_close_log = close_log;
+    long ncpu = sysconf(_SC_NPROCESSORS_CONF);
+    m_cpu_node.resize(ncpu > 0 ? ncpu : 1);
+    for(size_t i = 0; i < m_cpu_node.size(); ++i)
+        m_cpu_node[i] = cpu_to_node(i);
+    m_enable = enable;
+}
+
+int perf_monitor::open_counter(uint32_t type, uint64_t config)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.exclude_hv = 1;
+
+    // pid = 0, cpu = -1: 统计调用线程在任意CPU上的事件
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+long long perf_monitor::read_counter(int fd)
+{
+    long long value = 0;
+    if(fd < 0 || read(fd, &value, sizeof(value)) != sizeof(value))
+        return -1;
+    return value;
+}
+
+void perf_monitor::thread_start(const char *name)
+{
+    // 线程名便于 top -H 与 /trace 输出中区分事件循环与工作线程
+    pthread_setname_np(pthread_self(), name);
+    if(!m_enable)
+        return;
+
+    thread_counters counters;
+    counters.name = name;
+    counters.migrations_fd = open_counter(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS);
+    counters.llc_miss_fd = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    if(counters.migrations_fd < 0 || counters.llc_miss_fd < 0)
+    {
+        LOG_WARN("perf_event_open for %s failed: %d", name, errno);
+    }
+
+    m_lock.lock();
+    m_threads.push_back(counters);
+    m_lock.unlock();
+    sample_node();
+}
+
+void perf_monitor::sample_node()
+{
+    static thread_local int last_node = -1;
+    int cpu = sched_getcpu();
+    if(cpu < 0 || cpu >= (int)m_cpu_node.size())
+        return;
+
+    int node = m_cpu_node[cpu];
+    if(last_node >= 0 && node != last_node)
+        m_node_migrations.fetch_add(1, std::memory_order_relaxed);
+    last_node = node;
+}
+
+void perf_monitor::report()
+{
+    if(!m_enable)
+        return;
+
+    long long total_migrations = 0, total_llc_miss = 0;
+    m_lock.lock();
+    for(size_t i = 0; i < m_threads.size(); ++i)
+    {
+        long long migrations = read_counter(m_threads[i].migrations_fd);
+        long long llc_miss = read_counter(m_threads[i].llc_miss_fd);
+        if(migrations > 0)
+            total_migrations += migrations;
+        if(llc_miss > 0)
+            total_llc_miss += llc_miss;
+        printf("{\"thread\":\"%s\",\"cpu_migrations\":%lld,\"llc_misses\":%lld}\n",
+               m_threads[i].name.c_str(), migrations, llc_miss);
+    }
+    m_lock.unlock();
+
+    long long node_migrations = m_node_migrations.load();
+    printf("{\"thread\":\"total\",\"cpu_migrations\":%lld,\"node_migrations\":%lld,\"llc_misses\":%lld}\n",
+           total_migrations, node_migrations, total_llc_miss);
+    fflush(stdout);
+    LOG_INFO("perf: cpu_migrations %lld, node_migrations %lld, llc_misses %lld",
+             total_migrations, node_migrations, total_llc_miss);
+}
@@ -0,0 +1,68 @@
+#ifndef _CPU_AFFINITY_H
+#define _CPU_AFFINITY_H
+
+/**
+ *      CPU亲和性与NUMA放置
+ *   1. 解析CPU列表(如 "0-3,8")，将线程绑定到指定CPU
+ *   2. 查询CPU所属NUMA节点，将内存迁移/绑定到指定节点
+ *   3. 根据网卡接收队列中断的亲和性得到CPU列表，使工作线程与中断处理落在同一组CPU
+ *   4. 测试模式下通过perf_event统计每个线程的CPU迁移、末级缓存未命中，以及跨节点迁移次数
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <string>
+#include <atomic>
+#include "../lock/locker.h"
+#include "../log/log.h"
+
+bool parse_cpu_list(const char *str, std::vector<int> &cpus);   // 解析CPU列表
+bool bind_thread_cpus(const std::vector<int> &cpus);            // 绑定当前线程到一组CPU
+int cpu_to_node(int cpu);                                       // CPU所属NUMA节点，未知返回0
+bool bind_memory_node(void *addr, size_t len, int node);        // 将内存绑定到NUMA节点并迁移已分配的页
+bool nic_irq_cpus(const char *ifname, std::vector<int> &cpus);  // 网卡中断所在的CPU
+
+class perf_monitor
+{
+public:
+    static perf_monitor *get_instance();
+
+    void init(bool enable, int close_log);
+    bool enabled() { return m_enable; }
+
+    // 线程启动时调用，打开当前线程的计数器
+    void thread_start(const char *name);
+    // 记录当前线程是否被调度到了其他NUMA节点，未开启时只有一次判断
+    void sample()
+    {
+        if(m_enable)
+            sample_node();
+    }
+    // 输出统计结果
+    void report();
+
+private:
+    perf_monitor();
+    ~perf_monitor();
+    void sample_node();
+    static int open_counter(uint32_t type, uint64_t config);
+    static long long read_counter(int fd);
+
+    struct thread_counters
+    {
+        std::string name;
+        int migrations_fd;      // CPU迁移次数
+        int llc_miss_fd;        // 末级缓存未命中次数
+    };
+
+    bool m_enable;
+    std::vector<thread_counters> m_threads;
+    std::vector<int> m_cpu_node;                // CPU -> NUMA节点
+    std::atomic<long long> m_node_migrations;   // 跨节点迁移次数
+    locker m_lock;
+    int m_close_log;
+    static const int m_log_module = LOG_MODULE_POOL;
+};
+
+#endif
@@ -3,133 +3,626 @@
 
 /** 
  *    线程池
+ *    工作窃取调度：
+ *       全局注入队列  事件循环提交的任务先进入全局有界队列，队列满时由事件循环施加背压
+ *       本地队列      每个工作线程一个Chase-Lev双端队列，从全局队列批量取任务放入本地
+ *       窃取          本地与全局队列都为空时，从其他工作线程的本地队列窃取，优先窃取同一NUMA节点上的线程
+ *       休眠          空闲时先自旋，再通过futex休眠，有新任务时按需唤醒
+ *    弹性伸缩：
+ *       常驻线程 thread_number 个，排队时间、队列深度超过阈值或工作线程都阻塞在数据库上时，
+ *       逐个扩容直到 max_thread_number；扩出的线程空闲超过一段时间后退出
+ *       扩容只由提交任务的事件循环线程执行
+ *    请求分道：
+ *       请求分为 静态、数据库、管理 三条车道，每条车道有独立的队列和并发配额
+ *       工作线程按车道权重做步长调度，数据库变慢时至多占用配额内的线程，静态请求不受影响
+ *       只有静态车道使用全局注入队列、本地队列和窃取
+ *       背压按车道施加：静态车道满时事件循环暂缓分发并拒绝新连接，数据库与管理车道满时只对该车道的请求回复503
 */
 #include <list>
+#include <algorithm>
 #include <cstdio>
+#include <climits>
 #include <exception>
 #include <vector>
+#include <memory>
+#include <atomic>
 #include <thread>
+#include <time.h>
 #include "../lock/locker.h"
 #include "../mysql/sql_connection_pool.h"
 #include "../log/block_queue.h"
+#include "work_steal_queue.h"
+#include "cpu_affinity.h"
+#include "../metrics/metrics.h"
+#include "../metrics/trace.h"
+#include "../metrics/alloc_profile.h"
 
+// 请求车道
+enum REQUEST_LANE
+{
+    LANE_STATIC = 0,    // 静态文件
+    LANE_DB,            // 登录、注册等需要访问数据库的请求
+    LANE_ADMIN,         // 管理接口
+    LANE_NUM
+};
 
 template<typename T>
 class threadpool
 {
 public:
-    threadpool(int m_actor_model, sqlconnection_pool *connpool, int thread_number = 8, int max_requests = 10000);
+    // cpus 非空时第i个工作线程绑定到 cpus[i % cpus.size()]
+    // max_thread_number 小于 thread_number 时不扩容
+    threadpool(int m_actor_model, sqlconnection_pool *connpool, int thread_number = 8, int max_requests = 10000, int close_log = 0,
+               const std::vector<int> &cpus = std::vector<int>(), int max_thread_number = 0);
     ~threadpool();
-    bool append(T* request, int state);
-    bool append_p(T* request);
+    // 放入请求队列，队列满时 wait 为false立即返回false，为true则阻塞等待
+    bool append(T* request, int state, bool wait = false);
+    bool append_p(T* request, bool wait = false);
+    // 批量非阻塞放入，返回实际放入的数量，一批至多唤醒 线程数 个工作线程
+    // 未放入的请求移到数组末尾 [返回值, n)
+    int append_batch(T** requests, int n);
+    // 设置车道权重和并发配额(quota 为0不限)，需在提交请求前调用
+    void set_lane(int lane, int weight, int quota);
+    // 车道队列是否已满，静态车道为全局注入队列
+    bool full(int lane = LANE_STATIC) { return LANE_STATIC == lane ? m_global.full() : m_lanes[lane].queue->full(); }
+    int lane_of(T* request);                                                // 请求所属车道
+    int size() { return m_active.load(std::memory_order_relaxed); }        // 当前工作线程数量
+    int queue_size();                                                       // 各车道请求队列长度之和
+    int lane_size(int lane) { return LANE_STATIC == lane ? m_global.size() : m_lanes[lane].queue->size(); }
+    long long queue_wait() { return m_last_wait_us.load(std::memory_order_relaxed); }  // 最近一次排队时间(us)
 
 private:
-    static void *work(threadpool<T> *arg);   // 工作线程任务
-    void run();
+    static void *work(threadpool<T> *arg, int index);   // 工作线程任务
+    void run(int index);
+    void execute(T* request, int lane);
+    bool inject(T* request, bool wait);                 // 放入所属车道并唤醒工作线程
+    bool push_lane(T* request, int lane, bool wait);
+    bool next_request(int index, long long *pass, long long &vtime, T* &request, int &lane);   // 按车道权重取任务
+    bool take_lane(int index, int lane, T* &request);
+    bool take_global(int index, T* &request);           // 从全局队列批量取任务到本地队列
+    bool steal(int index, T* &request);                 // 从其他工作线程窃取任务
+    bool has_work();
+    void maybe_grow();                                  // 按排队情况扩容
+    void start_worker(int index);
+
+    static long long now_us()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+    }
+
+    static void cpu_relax()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield");
+#endif
+    }
 
 private:
-    int m_thread_number;                            // 线程池中线程数量
+    static const int LOCAL_CAPACITY = 256;          // 本地队列容量
+    static const int GRAB_MAX = 32;                 // 一次从全局队列最多取走的任务数
+    static const int SPIN_COUNT = 128;              // 休眠前的自旋次数
+    static const int GROW_DEPTH = 4;                // 平均每个线程排队超过该值时扩容
+    static const long long GROW_WAIT_US = 20000;    // 排队时间超过该值时扩容
+    static const long long GROW_INTERVAL_US = 100000;   // 两次扩容的最小间隔
+    static const long long IDLE_RETIRE_US = 30000000;   // 扩出的线程空闲超过该值后退出
+    static const long long STRIDE_BASE = 1 << 20;       // 步长调度的基准，步长 = STRIDE_BASE / 权重
+
+    enum SLOT_STATE
+    {
+        SLOT_FREE = 0,      // 未启动
+        SLOT_RUNNING,       // 运行中
+        SLOT_EXITED         // 已退出，等待回收
+    };
+
+    struct lane_info
+    {
+        std::unique_ptr<block_queue<T *>> queue;    // 车道队列，静态车道使用全局注入队列
+        int quota;                                  // 并发上限，0为不限
+        long long stride;                           // 步长，权重越大步长越小
+        std::atomic<int> running;                   // 正在处理该车道请求的线程数
+    };
+
+    int m_thread_number;                            // 常驻线程数量
+    int m_max_thread_number;                        // 最大线程数量
     int m_max_requests;                             // 请求队列最大请求数量
-    std::vector<std::thread> m_threads;             // 线程数据
-    block_queue<T *>m_workqueue;                    // 请求队列
+    std::vector<std::thread> m_threads;             // 线程数据, 按最大线程数量分配槽位
+    std::unique_ptr<std::atomic<int>[]> m_slot_state;   // 槽位状态
+    std::atomic<int> m_active;                      // 运行中的线程数量
+    std::atomic<long long> m_last_wait_us;          // 最近一次任务的排队时间
+    long long m_last_grow_us;                       // 上次扩容时间
+    std::vector<std::unique_ptr<work_steal_queue<T *>>> m_local;    // 工作线程本地队列
+    std::vector<int> m_cpus;                        // 工作线程绑定的CPU
+    std::vector<std::vector<int>> m_steal_order;    // 每个工作线程的窃取顺序，同节点优先
+
+    block_queue<T *> m_global;                      // 全局注入队列, 容量为 max_requests
+    lane_info m_lanes[LANE_NUM];                    // 请求车道
+    std::vector<T *> m_batch, m_lane_ok, m_lane_fail;   // append_batch 整理用, 只由提交线程访问
+    parker m_parker;                                // 空闲线程休眠器
+    std::atomic<bool> m_stop;                       // 线程池停止标志
 
     sqlconnection_pool *m_connpool;                 // 数据库连接池
     int m_actor_model;                              // 同步/异步模式
-    int m_close_log = 0;                            // 日志开启
+    int m_close_log;                                // 日志开启
+    static const int m_log_module = LOG_MODULE_POOL;
 };
 
 
 template<typename T>
 /* 事件驱动模式， 数据库连接池， 线程数量， 请求队列大小 */
-threadpool<T>::threadpool(int actor_model, sqlconnection_pool* connpool, int thread_number, int max_requests)
+threadpool<T>::threadpool(int actor_model, sqlconnection_pool* connpool, int thread_number, int max_requests, int close_log,
+                          const std::vector<int> &cpus, int max_thread_number)
+    : m_active(0), m_last_wait_us(0), m_last_grow_us(0), m_cpus(cpus), m_global(max_requests, "pool_global"), m_parker("pool_idle"), m_stop(false)
 {
     if(thread_number <= 0 || max_requests <= 0)
         throw std::exception();
     
-    m_threads.reserve(thread_number);
-
-    for(int i = 0; i < thread_number; ++i)
-    {
-        m_threads[i] = std::thread(work, this);
-    }
     m_max_requests = max_requests;
     m_thread_number = thread_number;
+    m_max_thread_number = max_thread_number > thread_number ? max_thread_number : thread_number;
     m_actor_model = actor_model;
     m_connpool = connpool;
-    LOG_INFO("ThreadPool init successfull : thread_numver : %d, max_request : %d", m_thread_number, m_max_requests);
+    m_close_log = close_log;
+
+    // 默认：静态车道不限并发，数据库车道至多占用一半常驻线程，管理车道单线程
+    for(int i = 0; i < LANE_NUM; ++i)
+    {
+        m_lanes[i].running.store(0);
+        if(LANE_STATIC != i)
+            m_lanes[i].queue.reset(new block_queue<T *>(max_requests, "pool_lane"));
+    }
+    set_lane(LANE_STATIC, 4, 0);
+    set_lane(LANE_DB, 1, thread_number > 1 ? thread_number / 2 : 1);
+    set_lane(LANE_ADMIN, 2, 1);
+
+    // 本地队列必须先于线程创建，窃取时会访问所有槽位的本地队列
+    int slots = m_max_thread_number;
+    m_slot_state.reset(new std::atomic<int>[slots]);
+    for(int i = 0; i < slots; ++i)
+    {
+        m_local.emplace_back(new work_steal_queue<T *>(LOCAL_CAPACITY));
+        m_slot_state[i].store(SLOT_FREE);
+    }
+
+    // 按工作线程所在NUMA节点分组，窃取时先找同节点的线程
+    std::vector<int> node(slots, 0);
+    for(int i = 0; !m_cpus.empty() && i < slots; ++i)
+    {
+        node[i] = cpu_to_node(m_cpus[i % m_cpus.size()]);
+    }
+    m_steal_order.resize(slots);
+    for(int i = 0; i < slots; ++i)
+    {
+        for(int pass = 0; pass < 2; ++pass)
+        {
+            for(int k = 1; k < slots; ++k)
+            {
+                int victim = (i + k) % slots;
+                if((node[victim] == node[i]) == (0 == pass))
+                    m_steal_order[i].push_back(victim);
+            }
+        }
+    }
+
+    m_threads.resize(slots);
+    for(int i = 0; i < thread_number; ++i)
+    {
+        start_worker(i);
+    }
+    LOG_INFO("ThreadPool init successfull : thread_numver : %d, max_thread : %d, max_request : %d",
+             m_thread_number, m_max_thread_number, m_max_requests);
 }
 
 template<typename T>
-threadpool<T>::~threadpool() {}
+threadpool<T>::~threadpool()
+{
+    m_stop.store(true);
+    m_parker.notify(INT_MAX);
+    for(size_t i = 0; i < m_threads.size(); ++i)
+    {
+        if(m_threads[i].joinable())
+            m_threads[i].join();
+    }
+}
 
 template<typename T>
-bool threadpool<T>::append(T* request, int state)
+void threadpool<T>::set_lane(int lane, int weight, int quota)
 {
-    bool ret = request->m_state = state;
-    m_workqueue.push(request);
+    m_lanes[lane].quota = quota > 0 ? quota : 0;
+    m_lanes[lane].stride = STRIDE_BASE / (weight > 0 ? weight : 1);
+}
 
-    LOG_INFO("thread Push the client(%s)", inet_ntoa(request->get_address()->sin_addr));
-    return ret;
+template<typename T>
+int threadpool<T>::queue_size()
+{
+    int n = m_global.size();
+    for(int i = LANE_STATIC + 1; i < LANE_NUM; ++i)
+        n += m_lanes[i].queue->size();
+    return n;
+}
+
+template<typename T>
+void threadpool<T>::start_worker(int index)
+{
+    // 回收该槽位上已退出的线程
+    if(m_threads[index].joinable())
+        m_threads[index].join();
+
+    m_slot_state[index].store(SLOT_RUNNING);
+    m_active.fetch_add(1);
+    m_threads[index] = std::thread(work, this, index);
+}
+
+template<typename T>
+void threadpool<T>::maybe_grow()
+{
+    if(m_active.load(std::memory_order_relaxed) >= m_max_thread_number)
+        return;
+
+    int depth = queue_size();
+    if(0 == depth)
+        return;
+
+    long long now = now_us();
+    if(now - m_last_grow_us < GROW_INTERVAL_US)
+        return;
+
+    // 阻塞在数据库连接或查询上的线程无法处理静态请求
+    int active = m_active.load();
+    int db_busy = m_connpool ? m_connpool->GetBusyConn() : 0;
+    long long wait = m_last_wait_us.load(std::memory_order_relaxed);
+    const char *reason = NULL;
+    if(wait >= GROW_WAIT_US)
+        reason = "queue wait";
+    else if(depth >= active * GROW_DEPTH)
+        reason = "queue depth";
+    else if(db_busy >= active)
+        reason = "db blocked";
+    else
+        return;
+
+    for(int i = m_thread_number; i < m_max_thread_number; ++i)
+    {
+        if(SLOT_RUNNING == m_slot_state[i].load())
+            continue;
+
+        start_worker(i);
+        m_last_grow_us = now;
+        LOG_INFO("threadpool grow to %d threads (%s: depth %d, wait %lldus, db busy %d)",
+                 m_active.load(), reason, depth, wait, db_busy);
+        return;
+    }
+}
+
+template<typename T>
+bool threadpool<T>::append(T* request, int state, bool wait)
+{
+    request->m_state = state;
+    return inject(request, wait);
+}
+
+template<typename T>
+bool threadpool<T>::append_p(T* request, bool wait)
+{
+    return inject(request, wait);
+}
+
+template<typename T>
+int threadpool<T>::append_batch(T** requests, int n)
+{
+    // 静态请求整批放入全局队列，其他车道的请求逐个放入
+    long long now = now_us();
+    int nstatic = 0, pushed = 0;
+    m_lane_ok.clear();
+    m_lane_fail.clear();
+    for(int i = 0; i < n; ++i)
+    {
+        T* request = requests[i];
+        request->m_enqueue_time = now;
+        int lane = lane_of(request);
+        if(LANE_STATIC == lane)
+            requests[nstatic++] = request;
+        else if(m_lanes[lane].queue->try_push(request))
+            m_lane_ok.push_back(request);
+        else
+            m_lane_fail.push_back(request);
+    }
+    maybe_grow();
+
+    pushed = m_global.push_batch(requests, nstatic);
+    if(nstatic < n)
+    {
+        // 整理为 已放入的在前、未放入的在后
+        m_batch.assign(requests, requests + pushed);
+        m_batch.insert(m_batch.end(), m_lane_ok.begin(), m_lane_ok.end());
+        m_batch.insert(m_batch.end(), requests + pushed, requests + nstatic);
+        m_batch.insert(m_batch.end(), m_lane_fail.begin(), m_lane_fail.end());
+        std::copy(m_batch.begin(), m_batch.end(), requests);
+        pushed += m_lane_ok.size();
+    }
+
+    int active = m_active.load(std::memory_order_relaxed);
+    if(pushed > 0)
+        m_parker.notify(pushed < active ? pushed : active);
+    return pushed;
+}
+
+template<typename T>
+bool threadpool<T>::inject(T* request, bool wait)
+{
+    int lane = lane_of(request);
+    maybe_grow();
+    return push_lane(request, lane, wait);
 }
 
 template<typename T>
-bool threadpool<T>::append_p(T* request)
+bool threadpool<T>::push_lane(T* request, int lane, bool wait)
 {
-    bool ret = m_workqueue.push(request);
-    LOG_INFO("thread Push the client(%s)", inet_ntoa(request->get_address()->sin_addr));
+    block_queue<T *> &queue = LANE_STATIC == lane ? m_global : *m_lanes[lane].queue;
+    request->m_enqueue_time = now_us();
+    bool ret = wait ? queue.push(request) : queue.try_push(request);
+    if(ret)
+        m_parker.notify(1);
     return ret;
 }
 
 template<typename T>
-void *threadpool<T>::work(threadpool<T>* pool)
+int threadpool<T>::lane_of(T* request)
+{
+    // reactor模式下请求数据还未读入，先进入静态车道，由工作线程读入后再分道
+    if(1 == m_actor_model)
+        return LANE_STATIC;
+    return request->lane();
+}
+
+template<typename T>
+bool threadpool<T>::take_global(int index, T* &request)
+{
+    // 按线程数均分，一次多取一些放入本地队列，减少对全局队列的争用
+    int want = m_global.size() / m_active.load(std::memory_order_relaxed) + 1;
+    int room = LOCAL_CAPACITY - m_local[index]->size() + 1;
+    if(want > room)
+        want = room;
+    if(want > GRAB_MAX)
+        want = GRAB_MAX;
+
+    T* batch[GRAB_MAX];
+    int n = m_global.pop_batch(batch, want);
+    if(0 == n)
+        return false;
+
+    request = batch[0];
+    for(int i = 1; i < n; ++i)
+        m_local[index]->push(batch[i]);
+
+    // 本地队列中有可窃取的任务，唤醒一个空闲线程
+    if(n > 1)
+        m_parker.notify(1);
+    return true;
+}
+
+template<typename T>
+bool threadpool<T>::steal(int index, T* &request)
+{
+    const std::vector<int> &order = m_steal_order[index];
+    for(size_t i = 0; i < order.size(); ++i)
+    {
+        if(m_local[order[i]]->steal(request))
+            return true;
+    }
+    return false;
+}
+
+template<typename T>
+bool threadpool<T>::has_work()
+{
+    if(!m_global.empty())
+        return true;
+    for(int i = LANE_STATIC + 1; i < LANE_NUM; ++i)
+    {
+        if(!m_lanes[i].queue->empty() && (0 == m_lanes[i].quota || m_lanes[i].running.load() < m_lanes[i].quota))
+            return true;
+    }
+    for(size_t i = 0; i < m_local.size(); ++i)
+    {
+        if(!m_local[i]->empty())
+            return true;
+    }
+    return false;
+}
+
+template<typename T>
+void *threadpool<T>::work(threadpool<T>* pool, int index)
 {
-    pool->run();
+    pool->run(index);
     return pool;
 }
 
 template<typename T>
-void threadpool<T>::run()
+void threadpool<T>::run(int index)
 {
-    while(true)
+    if(!m_cpus.empty())
+    {
+        std::vector<int> cpu(1, m_cpus[index % m_cpus.size()]);
+        if(!bind_thread_cpus(cpu))
+            LOG_WARN("worker %d bind cpu %d failed", index, cpu[0]);
+    }
+    perf_monitor::get_instance()->thread_start("worker");
+    alloc_scope alloc(ALLOC_POOL);
+
+    // 扩出的线程空闲一段时间后退出，常驻线程一直运行
+    bool elastic = index >= m_thread_number;
+    long long idle_since = now_us();
+    int spins = 0;
+    long long pass[LANE_NUM] = {0}, vtime = 0;
+    while(!m_stop.load(std::memory_order_relaxed))
     {
         T* request;
-        bool ret = m_workqueue.pop(request);
-        //std::cout << ret  << std::endl;
-        if(!ret)
+        int lane;
+        if(next_request(index, pass, vtime, request, lane))
+        {
+            spins = 0;
+            metrics::level(LEVEL_POOL_BUSY, 1);
+            execute(request, lane);
+            metrics::level(LEVEL_POOL_BUSY, -1);
+            if(m_lanes[lane].quota > 0)
+                m_lanes[lane].running.fetch_sub(1);
+            if(elastic)
+                idle_since = now_us();
             continue;
-        
-        LOG_INFO( "thread Get the client(%s)", inet_ntoa(request->get_address()->sin_addr) );
-        if(1 == m_actor_model)
+        }
+
+        // 自适应休眠：先自旋等待，仍无任务再进入futex等待
+        if(++spins < SPIN_COUNT)
+        {
+            cpu_relax();
+            continue;
+        }
+        spins = 0;
+
+        if(elastic && now_us() - idle_since >= IDLE_RETIRE_US)
         {
-            // 1 表示工作线程启动reactor模式，工作线程进行 读、写和逻辑处理
-            if(0 == request->m_state)
+            // 本地队列为空时才退出，不会丢失任务
+            m_active.fetch_sub(1);
+            m_slot_state[index].store(SLOT_EXITED);
+            LOG_INFO("threadpool retire idle worker %d, %d threads left", index, m_active.load());
+            return;
+        }
+
+        uint32_t epoch = m_parker.prepare_wait();
+        if(has_work() || m_stop.load())
+        {
+            m_parker.cancel_wait();
+            continue;
+        }
+
+        if(elastic)
+        {
+            struct timespec ts;
+            ts.tv_sec = IDLE_RETIRE_US / 1000000;
+            ts.tv_nsec = 0;
+            m_parker.wait(epoch, &ts);
+        }
+        else
+        {
+            m_parker.wait(epoch);
+        }
+    }
+}
+
+template<typename T>
+bool threadpool<T>::next_request(int index, long long *pass, long long &vtime, T* &request, int &lane)
+{
+    // 步长调度：按虚拟时间从小到大尝试各车道，取到任务后该车道虚拟时间增加一个步长
+    // 空闲车道的虚拟时间不低于当前值，恢复后不会连续独占工作线程
+    int tried = 0;
+    for(int k = 0; k < LANE_NUM; ++k)
+    {
+        int best = -1;
+        for(int i = 0; i < LANE_NUM; ++i)
+        {
+            if(tried & (1 << i))
+                continue;
+            if(pass[i] < vtime)
+                pass[i] = vtime;
+            if(best < 0 || pass[i] < pass[best])
+                best = i;
+        }
+        tried |= 1 << best;
+
+        if(take_lane(index, best, request))
+        {
+            lane = best;
+            vtime = pass[best];
+            pass[best] += m_lanes[best].stride;
+            return true;
+        }
+    }
+    return false;
+}
+
+template<typename T>
+bool threadpool<T>::take_lane(int index, int lane, T* &request)
+{
+    lane_info &info = m_lanes[lane];
+    if(LANE_STATIC != lane && info.queue->empty())
+        return false;
+
+    // 先占用配额再取任务，车道满额时留在队列中
+    if(info.quota > 0 && info.running.fetch_add(1) >= info.quota)
+    {
+        info.running.fetch_sub(1);
+        return false;
+    }
+
+    bool ret;
+    if(LANE_STATIC == lane)
+        ret = m_local[index]->pop(request) || take_global(index, request) || steal(index, request);
+    else
+        ret = info.queue->try_pop(request);
+
+    if(!ret && info.quota > 0)
+        info.running.fetch_sub(1);
+    return ret;
+}
+
+template<typename T>
+void threadpool<T>::execute(T* request, int lane)
+{
+    LOG_DEBUG( "thread Get the client(%s)", inet_ntoa(request->get_address()->sin_addr) );
+    long long start = now_us();
+    long long enqueue = request->m_enqueue_time;
+    long long wait = start - enqueue;
+    request->m_queue_us += wait;
+    m_last_wait_us.store(wait, std::memory_order_relaxed);
+    metrics::observe(STAGE_QUEUE, wait);
+    perf_monitor::get_instance()->sample();
+
+    // reactor模式的新请求在读入数据时才分配追踪编号，排队记录在读入之后
+    bool reading = 1 == m_actor_model && LANE_STATIC == lane && 0 == request->m_state;
+    if(!reading)
+        tracer::span(request->m_trace_id, "queue", enqueue, start);
+    if(1 == m_actor_model)
+    {
+        // 1 表示工作线程启动reactor模式，工作线程进行 读、写和逻辑处理
+        if(LANE_STATIC != lane)
+        {
+            // 已在静态车道读入数据，转入其他车道后只做逻辑处理
+            request->process();
+        }
+        else if(0 == request->m_state)
+        {
+            // 连接有数据需要处理读
+            if(request->read_once())
             {
-                // 连接有数据需要处理读
-                if(request->read_once())
-                {
-                    request->improv = 1;
-                    sqlconnectionRAII mysqlcon(&request->mysql, m_connpool);
+                tracer::span(request->m_trace_id, "queue", enqueue, start);
+                request->improv = 1;
+                // 读入数据后才能分道，需要访问数据库的请求转入数据库车道
+                int next = request->lane();
+                if(LANE_STATIC == next || !push_lane(request, next, false))
                     request->process();
-                }else {
-                    request->improv = 1;
-                    request->timer_flag = 1;
-                }
             }else {
-                // 连接有数据需要写
-                if(request->write())
-                {
-                    request->improv = 1;
-                }else {
-                    request->improv = 1;
-                    request->timer_flag = 1;
-                }
+                request->improv = 1;
+                request->timer_flag = 1;
             }
         }else {
-            // 0 表示工作线程启动proactor模式，工作线程只进行逻辑处理
-            sqlconnectionRAII mysqlcon(&request->mysql, m_connpool);
-            //LOG_INFO("Start Proactor Process");
-            request->process();
+            // 连接有数据需要写
+            if(request->write())
+            {
+                request->improv = 1;
+            }else {
+                request->improv = 1;
+                request->timer_flag = 1;
+            }
         }
+    }else {
+        // 0 表示工作线程启动proactor模式，工作线程只进行逻辑处理
+        // 数据库连接由存储后端在注册时按需获取
+        //LOG_INFO("Start Proactor Process");
+        request->process();
     }
 }
 
@@ -0,0 +1,102 @@
+#ifndef _WORK_STEAL_QUEUE_H
+#define _WORK_STEAL_QUEUE_H
+
+/**
+ *    Chase-Lev 工作窃取双端队列
+ *    每个工作线程拥有一个：
+ *       所属线程在底部 push/pop，无需加锁
+ *       其他线程在顶部 steal，通过CAS竞争
+ *    容量固定(2的幂)，队列满时 push 失败，由调用者回退到全局队列
+*/
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+
+template<typename T>
+class work_steal_queue
+{
+public:
+    explicit work_steal_queue(int capacity = 1024) : m_top(0), m_bottom(0)
+    {
+        int cap = 1;
+        while(cap < capacity)
+            cap <<= 1;
+        m_mask = cap - 1;
+        m_buffer.reset(new std::atomic<T>[cap]);
+    }
+
+    // 所属线程调用，从底部放入
+    bool push(T item)
+    {
+        int64_t b = m_bottom.load(std::memory_order_relaxed);
+        int64_t t = m_top.load(std::memory_order_acquire);
+        if(b - t > m_mask)
+            return false;
+
+        m_buffer[b & m_mask].store(item, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // 所属线程调用，从底部取出
+    bool pop(T &item)
+    {
+        int64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+        m_bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = m_top.load(std::memory_order_relaxed);
+
+        if(t > b)
+        {
+            // 队列为空
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+
+        item = m_buffer[b & m_mask].load(std::memory_order_relaxed);
+        if(t == b)
+        {
+            // 只剩最后一个元素，与窃取者竞争
+            bool won = m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
+
+    // 任意线程调用，从顶部窃取
+    bool steal(T &item)
+    {
+        int64_t t = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = m_bottom.load(std::memory_order_acquire);
+        if(t >= b)
+            return false;
+
+        item = m_buffer[t & m_mask].load(std::memory_order_relaxed);
+        return m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+    }
+
+    bool empty()
+    {
+        return size() <= 0;
+    }
+
+    int size()
+    {
+        int64_t b = m_bottom.load(std::memory_order_relaxed);
+        int64_t t = m_top.load(std::memory_order_relaxed);
+        return b > t ? (int)(b - t) : 0;
+    }
+
+private:
+    // top 与 bottom 分属不同缓存行，避免所属线程与窃取者伪共享
+    alignas(64) std::atomic<int64_t> m_top;
+    alignas(64) std::atomic<int64_t> m_bottom;
+    alignas(64) int64_t m_mask;
+    std::unique_ptr<std::atomic<T>[]> m_buffer;
+};
+
+#endif
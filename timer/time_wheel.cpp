@@ -1,7 +1,7 @@
 #include "time_wheel.h"
 #include "../http/http_conn.h"
 
-time_wheel::time_wheel() : cur_slot(0)
+time_wheel::time_wheel() : cur_slot(0), m_count(0)
 {
     for(int i = 0; i < N; ++i)
     {
@@ -31,6 +31,12 @@ time_wheel::~time_wheel()
 
 /* 将定时器插入合适的插槽中 */
 void time_wheel::add_timer(tw_timer* timer)
+{
+    link(timer);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+void time_wheel::link(tw_timer* timer)
 {
     int slot = timer->time_slot;
     // 采用头插法将定时器插入对应的slot中
@@ -44,15 +50,15 @@ void time_wheel::add_timer(tw_timer* timer)
 /* 将定时器从slot链表中删除 */
 void time_wheel::del_timer(tw_timer* timer)
 {   
-    LOG_INFO("dele timer");
+    LOG_DEBUG("dele timer");
     if(!timer) return;
-    //LOG_INFO("Client(%s) Exit", inet_ntoa(timer->data_user->address.sin_addr));
+    LOG_DEBUG("Client(%s) Exit", inet_ntoa(timer->data_user->address.sin_addr));
     // 从链表中取出timer
     timer->prev->next = timer->next;
     timer->prev->next->prev = timer->prev;
 
+    m_count.fetch_sub(1, std::memory_order_relaxed);
     delete timer;
-    LOG_INFO("Client(%s) Exit", inet_ntoa(timer->data_user->address.sin_addr));
 }
 
 void time_wheel::adjust_timer(tw_timer* timer)
@@ -67,7 +73,7 @@ void time_wheel::adjust_timer(tw_timer* timer)
 
     timer->rotation = 0;
     timer->time_slot = slot;
-    add_timer(timer);
+    link(timer);
 }
 
 /* 心跳函数 */
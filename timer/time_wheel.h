@@ -10,6 +10,7 @@
 #include <string.h>
 #include <sys/epoll.h>
 #include <assert.h>
+#include <atomic>
 #include "../log/log.h"
 
 
@@ -48,13 +49,19 @@ public:
     void del_timer(tw_timer* timer);
     void adjust_timer(tw_timer* timer);
     void tick();
+    int size() { return m_count.load(std::memory_order_relaxed); }     // 定时器数量
+
+private:
+    void link(tw_timer* timer);             // 插入定时器所在的插槽
 
 private:
     static const int N = 128;               // 时间轮的插槽数量
     int cur_slot;                           // 当前指针指向什么插槽
     tw_timer* slot_head[N];                 // 每个插槽的头指针，方便插入与删除定时器
     tw_timer* slot_tail[N];                 // 每个插槽的尾指针，方便插入与删除定时器
+    std::atomic<int> m_count;               // 定时器数量，供 /metrics 读取
     int m_close_log = 0;
+    static const int m_log_module = LOG_MODULE_TIMER;
 };
 
 void cb_func(client_data* user_data);       //定时器回调函数
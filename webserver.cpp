@@ -16,6 +16,10 @@ WebServer::WebServer()
 
     // 定时器初始化
     users_timer = new client_data[MAX_FD];
+
+    m_pool = NULL;
+    m_userStore = NULL;
+    m_ready_num = 0;
 }
 
 WebServer::~WebServer()
@@ -28,11 +32,17 @@ WebServer::~WebServer()
     delete[] users;
     delete[] users_timer;
     delete m_pool;
+    delete m_userStore;
 }
 
 void WebServer::init(int port, std::string user, std::string passWord, std::string databaseName,
                      int log_write, int opt_linger, int trigmode, int sql_num,
-                     int thread_num, int close_log, int actor_model)
+                     int thread_num, int max_thread_num, int close_log, int actor_model, int store_mode,
+                     std::string reactor_cpus, std::string worker_cpus, std::string nic_name, int perf_mode,
+                     std::string log_level, int log_format,
+                     int log_compress, int log_keep_mb, int log_keep_days,
+                     int access_sample, int access_slow_ms, int access_rate, std::string capture_file,
+                     int trace_interval, int trace_slow_ms, int cache_max_age)
 {
     m_port = port;
     m_user = user;
@@ -40,11 +50,36 @@ void WebServer::init(int port, std::string user, std::string passWord, std::stri
     m_databaseName = databaseName;
     m_sql_num = sql_num;
     m_thread_num = thread_num;
+    m_max_thread_num = max_thread_num;
     m_log_write = log_write;
     m_OPT_LINGER = opt_linger;
     m_TRIGMode = trigmode;
     m_close_log = close_log;
     m_actormodel = actor_model;    
+    m_store_mode = store_mode;
+    m_perf_mode = perf_mode;
+    m_log_level = log_level;
+    m_log_format = log_format;
+    m_log_compress = log_compress;
+    m_log_keep_mb = log_keep_mb;
+    m_log_keep_days = log_keep_days;
+    m_access_sample = access_sample;
+    m_access_slow_ms = access_slow_ms;
+    m_access_rate = access_rate;
+    m_capture_file = capture_file;
+    m_trace_interval = trace_interval;
+    m_trace_slow_ms = trace_slow_ms;
+    m_cache_max_age = cache_max_age;
+    http_conn::m_max_age = cache_max_age > 0 ? cache_max_age : 0;
+
+    if(!reactor_cpus.empty() && !parse_cpu_list(reactor_cpus.c_str(), m_reactor_cpus))
+        printf("invalid reactor cpu list: %s\n", reactor_cpus.c_str());
+    if(!worker_cpus.empty() && !parse_cpu_list(worker_cpus.c_str(), m_worker_cpus))
+        printf("invalid worker cpu list: %s\n", worker_cpus.c_str());
+
+    // 未指定工作线程CPU时，使用网卡接收队列中断所在的CPU，请求在处理中断的CPU附近完成
+    if(m_worker_cpus.empty() && !nic_name.empty() && !nic_irq_cpus(nic_name.c_str(), m_worker_cpus))
+        printf("no irq found for nic: %s\n", nic_name.c_str());
 }
 
 void WebServer::trig_mode()
@@ -79,27 +114,105 @@ void WebServer::trig_mode()
 void WebServer::log_write()
 {
     if(0 == m_close_log) {
+        bool binary = 1 == m_log_format;
+        const char *file = binary ? "./ServerLog.bin" : "./ServerLog";
+        long long keep_bytes = m_log_keep_mb * 1024LL * 1024;
         if(1 == m_log_write)
-            Log::get_instance()->init("./ServerLog", m_close_log, 2000, 800000, 800);
+            Log::get_instance()->init(file, m_close_log, 2000, 800000, 800, binary, m_log_compress, keep_bytes, m_log_keep_days);
         else
-            Log::get_instance()->init("./ServerLog", m_close_log, 2000, 800000, 0);
+            Log::get_instance()->init(file, m_close_log, 2000, 800000, 0, binary, m_log_compress, keep_bytes, m_log_keep_days);
+
+        // 访问日志总是异步写入，不占用请求线程的磁盘I/O
+        const char *access_file = binary ? "./AccessLog.bin" : "./AccessLog";
+        if(Log::get_access_instance()->init(access_file, m_close_log, 2000, 800000, 800, binary, m_log_compress, keep_bytes, m_log_keep_days))
+            access_log::get_instance()->init(m_access_sample, m_access_slow_ms, m_access_rate);
+
+        if(!Log::get_instance()->set_levels(m_log_level.c_str()))
+            LOG_ERROR("invalid log level: %s", m_log_level.c_str());
     }
+
+    // 流量录制与请求追踪不受日志开关影响
+    if(!m_capture_file.empty() && !traffic_capture::get_instance()->init(m_capture_file.c_str()))
+        printf("open capture file failed: %s\n", m_capture_file.c_str());
+
+    if(!tracer::get_instance()->init(m_trace_interval, m_trace_slow_ms))
+        printf("open trace file failed: ./TraceSlow.json\n");
 }
 
-// sql连接池初始化
+// sql连接池与用户存储初始化
 void WebServer::sql_pool()
 {
     m_sqlconnectionPool = sqlconnection_pool::GetInstance();
-    m_sqlconnectionPool->init("localhost", m_user, m_passWord, m_databaseName, 3306, m_sql_num, m_close_log);
 
-    // 初始化数据库读取表
-    users->initmysql_result(m_sqlconnectionPool);
+    if(1 == m_store_mode)
+    {
+        // 嵌入式KV存储，不依赖MySQL
+        kv_user_store *store = new kv_user_store(m_close_log);
+        if(!store->init("./UserStore.db"))
+        {
+            LOG_ERROR("%s", "user store init failure");
+            exit(1);
+        }
+        m_userStore = store;
+    }
+    else
+    {
+        m_sqlconnectionPool->init("localhost", m_user, m_passWord, m_databaseName, 3306, m_sql_num, m_close_log);
+
+        // 初始化数据库读取表
+        mysql_user_store *store = new mysql_user_store(m_sqlconnectionPool, m_close_log);
+        store->init();
+        m_userStore = store;
+    }
+    http_conn::m_store = m_userStore;
 }
 
 // 线程池初始化
 void WebServer::thread_pool()
 {
-    m_pool = new threadpool<http_conn>(m_actormodel, m_sqlconnectionPool, m_thread_num);
+    perf_monitor::get_instance()->init(1 == m_perf_mode, m_close_log);
+    m_pool = new threadpool<http_conn>(m_actormodel, m_sqlconnectionPool, m_thread_num, 10000, m_close_log,
+                                       m_worker_cpus, m_max_thread_num);
+    // 数据库车道的并发不超过连接数，多出的线程只会阻塞在取连接上
+    if(0 == m_store_mode && m_sql_num < m_thread_num / 2)
+        m_pool->set_lane(LANE_DB, 1, m_sql_num);
+
+    // /metrics 输出时读取的全局计量
+    metrics *m = metrics::get_instance();
+    threadpool<http_conn> *pool = m_pool;
+    time_wheel *wheel = &utils.m_time_wheel;
+    m->add_gauge("webserver_open_connections", "Open client connections.",
+                 []() { return (double)http_conn::m_user_count.load(); });
+    m->add_gauge("webserver_pool_threads", "Running worker threads.",
+                 [pool]() { return (double)pool->size(); });
+    m->add_gauge("webserver_pool_queue_depth", "Requests waiting in all lanes.",
+                 [pool]() { return (double)pool->queue_size(); });
+    m->add_gauge("webserver_timers", "Connection timers in the time wheel.",
+                 [wheel]() { return (double)wheel->size(); });
+    m->add_gauge("webserver_log_dropped_lines", "Log lines dropped because the async buffer was full.",
+                 []() { return (double)(Log::get_instance()->dropped() + Log::get_access_instance()->dropped()); });
+}
+
+// 事件循环线程绑定CPU
+// 连接数据由事件循环线程读入，工作线程按节点分组就近窃取，因此把连接数据放到事件循环所在节点
+void WebServer::bind_reactor()
+{
+    if(!m_reactor_cpus.empty())
+    {
+        if(!bind_thread_cpus(m_reactor_cpus))
+        {
+            LOG_WARN("%s", "bind reactor cpu failed");
+            return;
+        }
+
+        int node = cpu_to_node(m_reactor_cpus[0]);
+        if(!bind_memory_node(users, sizeof(http_conn) * MAX_FD, node) ||
+           !bind_memory_node(users_timer, sizeof(client_data) * MAX_FD, node))
+        {
+            LOG_WARN("bind connection memory to node %d failed: %d", node, errno);
+        }
+    }
+    perf_monitor::get_instance()->thread_start("reactor");
 }
 
 
@@ -154,6 +267,8 @@ void WebServer::eventListen()
     utils.addsig(SIGPIPE, SIG_IGN);
     utils.addsig(SIGALRM, utils.sig_handler, false);
     utils.addsig(SIGTERM, utils.sig_handler, false);
+    utils.addsig(SIGUSR1, utils.sig_handler, false);
+    utils.addsig(SIGUSR2, utils.sig_handler, false);
 
     // 启动定时信号
     alarm(TIMESLOT);
@@ -174,6 +289,7 @@ void WebServer::timer(int connfd, struct sockaddr_in client_address)
     users_timer[connfd].address = client_address;
     users_timer[connfd].sockfd = connfd;
 
+    alloc_scope alloc(ALLOC_TIMER);
     tw_timer *timer = new tw_timer(0 , 3);
     timer->data_user = users_timer + connfd;
     timer->cb_func = cb_func;
@@ -188,7 +304,7 @@ void WebServer::timer(int connfd, struct sockaddr_in client_address)
 void WebServer::adjust_timer(tw_timer* timer)
 {
     utils.m_time_wheel.adjust_timer(timer);
-    LOG_INFO("Client(%s) Adjust Timer", inet_ntoa(timer->data_user->address.sin_addr));
+    LOG_DEBUG("Client(%s) Adjust Timer", inet_ntoa(timer->data_user->address.sin_addr));
 }
 
 void WebServer::deal_timer(tw_timer* timer, int sockfd)
@@ -198,7 +314,7 @@ void WebServer::deal_timer(tw_timer* timer, int sockfd)
     {
         utils.m_time_wheel.del_timer(timer);
     }
-    LOG_INFO("close fd %d", users_timer[sockfd].sockfd);
+    LOG_DEBUG("close fd %d", users_timer[sockfd].sockfd);
 }
 
 
@@ -210,6 +326,7 @@ bool WebServer::dealclientdata()
     socklen_t client_addrlen = sizeof(client_address);
     if(0 == m_LISTENTrigmode)
     {   // LT触发模式
+        long long start = metrics::now_us();
         int connfd = accept(m_listenfd, (struct sockaddr *)&client_address, &client_addrlen);
         if(connfd < 0)
         {
@@ -217,16 +334,20 @@ bool WebServer::dealclientdata()
             return false;
         }
 
-        if(http_conn::m_user_count >= MAX_FD)
+        // 连接数已满或静态车道队列已满时拒绝新连接，新连接的请求先按静态车道处理
+        if(http_conn::m_user_count >= MAX_FD || m_pool->full(LANE_STATIC))
         {
             utils.show_error(connfd, "Internal server busy");
             LOG_ERROR("%s", "Internal server busy");
             return false;
         }
         timer(connfd, client_address);
+        metrics::observe(STAGE_ACCEPT, metrics::now_us() - start);
+        metrics::count(COUNTER_ACCEPTED);
     } else {
         while(1)
         {
+            long long start = metrics::now_us();
             int connfd = accept(m_listenfd, (struct sockaddr*)&client_address, &client_addrlen);
             if(connfd < 0)
             {
@@ -234,17 +355,19 @@ bool WebServer::dealclientdata()
                 break;
             }
 
-            if(http_conn::m_user_count >= MAX_FD)
+            if(http_conn::m_user_count >= MAX_FD || m_pool->full(LANE_STATIC))
             {
                 utils.show_error(connfd, "Internal server busy");
                 LOG_ERROR("%s", "Internal server busy");
                 break;
             }
             timer(connfd, client_address);
+            metrics::observe(STAGE_ACCEPT, metrics::now_us() - start);
+            metrics::count(COUNTER_ACCEPTED);
         }
         return false;
     }
-    LOG_INFO("Accept Client(%s)", inet_ntoa(client_address.sin_addr));
+    LOG_DEBUG("Accept Client(%s)", inet_ntoa(client_address.sin_addr));
     return true;
 }
 
@@ -269,6 +392,16 @@ bool WebServer::dealwithsignal(bool &timeout, bool &stop_server)
                 case SIGTERM:
                     stop_server = true;
                     break;
+
+                // 运行中调整全局日志级别，SIGUSR1 输出更多，SIGUSR2 输出更少
+                case SIGUSR1:
+                case SIGUSR2:
+                {
+                    int level = Log::get_instance()->level() + (SIGUSR1 == signals[i] ? -1 : 1);
+                    Log::get_instance()->set_level(level);
+                    LOG_WARN("log level set to %d", Log::get_instance()->level());
+                    break;
+                }
             default:
                 break;
             }
@@ -288,31 +421,25 @@ void WebServer::dealwithread(int sockfd)
         {
             adjust_timer(timer);
         }
-        // 监测到读事件, 放入请求队列中
-        m_pool->append(users + sockfd, 0);
-
-        while(true)
-        {
-            if(1 == users[sockfd].improv)
-            {
-                if(1 == users[sockfd].timer_flag)
-                {
-                    deal_timer(timer, sockfd);
-                    users[sockfd].timer_flag = 0;
-                }
-                users[sockfd].improv = 0;
-                break;
-            }
-        }
+        // 监测到读事件, 加入本轮待分发的请求
+        users[sockfd].m_state = 0;
+        m_ready[m_ready_num++] = users + sockfd;
     }
     else {
         // proactor
         if(users[sockfd].read_once())
         {
-            LOG_INFO("Proactor deal with the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
-
-            // 若监测到读事件，则放入请求队列
-            m_pool->append_p(users + sockfd);
+            // 缓存命中的静态请求直接在事件循环上写回，其余加入本轮待分发的请求
+            bool alive = true;
+            if(!users[sockfd].serve_cached(alive))
+            {
+                m_ready[m_ready_num++] = users + sockfd;
+            }
+            else if(!alive)
+            {
+                deal_timer(timer, sockfd);
+                return;
+            }
 
             if(timer)
             {
@@ -337,27 +464,14 @@ void WebServer::dealwithwrite(int sockfd)
             adjust_timer(timer);
         }
 
-        // 将写任务放入请求队列中
-        m_pool->append(users + sockfd, 1);
-
-        while(true)
-        {
-            if(1 == users[sockfd].improv)
-            {
-                if(1 == users[sockfd].timer_flag)
-                {
-                    deal_timer(timer, sockfd);
-                    users[sockfd].timer_flag = 0;
-                }
-                users[sockfd].improv = 0;
-                break;
-            }
-        }
+        // 将写任务加入本轮待分发的请求
+        users[sockfd].m_state = 1;
+        m_ready[m_ready_num++] = users + sockfd;
     }else {
         // proactor
         if(users[sockfd].write())
         {
-            LOG_INFO("send data to the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
+            LOG_DEBUG("send data to the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
 
             if(timer)
             {
@@ -369,14 +483,80 @@ void WebServer::dealwithwrite(int sockfd)
     }
 }
 
+// 一轮epoll_wait只分发一次，减少请求队列操作与工作线程唤醒次数
+// 队列已满时不阻塞事件循环：未放入的请求留在 m_pending 中，其EPOLLONESHOT事件仍未重新注册，
+// 连接上不再读取数据，由TCP流控向客户端施加背压；事件循环照常接受连接、处理定时器与信号
+void WebServer::dispatch_ready()
+{
+    if(0 == m_ready_num && m_pending.empty())
+        return;
+
+    // 上一轮未放入的请求排在本轮之前
+    http_conn **requests = m_ready;
+    int n = m_ready_num;
+    if(!m_pending.empty())
+    {
+        m_dispatch.assign(m_pending.begin(), m_pending.end());
+        m_dispatch.insert(m_dispatch.end(), m_ready, m_ready + m_ready_num);
+        requests = m_dispatch.data();
+        n = m_dispatch.size();
+    }
+
+    int pushed = m_pool->append_batch(requests, n);
+    int waiting = m_pending.size();
+    m_pending.clear();
+    for(int i = pushed; i < n; ++i)
+    {
+        // 数据库与管理车道已满时回复503，只对该车道施加背压，不占用静态请求的分发与连接
+        if(LANE_STATIC == m_pool->lane_of(requests[i]))
+            m_pending.push_back(requests[i]);
+        else
+            reject_busy(requests[i] - users);
+    }
+    if((int)m_pending.size() > waiting)
+        LOG_WARN("request queue full, %d requests wait", (int)m_pending.size());
+
+    //reactor 等待工作线程完成本轮放入的请求的读写
+    if(1 == m_actormodel)
+    {
+        for(int i = 0; i < pushed; ++i)
+        {
+            int sockfd = requests[i] - users;
+            while(1 != users[sockfd].improv)
+                ;
+            if(1 == users[sockfd].timer_flag)
+            {
+                deal_timer(users_timer[sockfd].timer, sockfd);
+                users[sockfd].timer_flag = 0;
+            }
+            users[sockfd].improv = 0;
+        }
+    }
+    m_ready_num = 0;
+}
+
+// 车道队列已满时回复503并关闭连接
+void WebServer::reject_busy(int sockfd)
+{
+    static const char busy[] = "HTTP/1.1 503 Service Unavailable\r\nRetry-After:1\r\nContent-Length:0\r\nConnection:close\r\n\r\n";
+    send(sockfd, busy, sizeof(busy) - 1, MSG_NOSIGNAL);
+    metrics::count(COUNTER_SHED);
+    LOG_WARN("lane %d queue full, reject client(%s)", m_pool->lane_of(users + sockfd), inet_ntoa(users[sockfd].get_address()->sin_addr));
+    deal_timer(users_timer[sockfd].timer, sockfd);
+}
+
 void WebServer::eventLoop()
 {
     bool timeout = false;
     bool stop_server = false;
 
+    bind_reactor();
+
     while (!stop_server)
     {
-        int number = epoll_wait(m_epollfd, events, MAX_EVENT_NUMBER, -1);
+        // 有请求等待放入线程池时定期醒来重试
+        int number = epoll_wait(m_epollfd, events, MAX_EVENT_NUMBER, m_pending.empty() ? -1 : PENDING_RETRY_MS);
+        perf_monitor::get_instance()->sample();
         if (number < 0 && errno != EINTR)
         {
             LOG_ERROR("%s", "epoll failure");
@@ -416,7 +596,9 @@ void WebServer::eventLoop()
             {
                 dealwithwrite(sockfd);
             }
-        }                                                             
+        }
+        dispatch_ready();
+
         if (timeout)
         {
             utils.timer_handler();
@@ -424,6 +606,8 @@ void WebServer::eventLoop()
             timeout = false;
         }
     }
+
+    perf_monitor::get_instance()->report();
 }
 
 
@@ -12,15 +12,19 @@
 #include <cassert>
 #include <sys/epoll.h>
 #include <string>
+#include <vector>
 
 #include "mysql/sql_connection_pool.h"
 #include "log/log.h"
 #include "timer/time_wheel.h"
 #include "threadpool/threadpool.h"
 #include "http/http_conn.h"
+#include "storage/user_store.h"
+#include "metrics/metrics.h"
 
 const int MAX_FD = 65536;               // 最大文件描述符
 const int MAX_EVENT_NUMBER = 10000;     // 最大事件数
+const int PENDING_RETRY_MS = 1;         // 有请求等待放入线程池时 epoll_wait 的超时
 const int TIMESLOT = 5;                 // 最小Tick单位时间w
 
 /**
@@ -37,18 +41,31 @@ public:
      *          初始化服务器
      *    数据库 ： 数据库用户， 数据库用户密码， 数据库名字
      *    日志： 是否写日志， 是否保持连接， 事件触发模式， sql连接数量
-     *    线程： 线程数量， 是否关闭日志， 服务器同步/异步 模式
+     *    线程： 线程数量， 最大线程数量， 是否关闭日志， 服务器同步/异步 模式
+     *    放置： 事件循环CPU， 工作线程CPU， 网卡名， 性能计数模式
+     *    日志级别： 如 "warn,http=error"， 日志格式
+     *    日志文件： 压缩级别， 保留总大小(MB)， 保留天数
+     *    访问日志： 采样间隔， 慢请求阈值(ms)， 每秒记录条数
+     *    流量录制： 录制文件，空为不录制
+     *    请求追踪： 抽样间隔，慢请求阈值(ms)
+     *    静态文件： 缓存有效期(秒)
     */
     void init(int port, std::string user, std::string passWord, std::string databaseName,
               int log_write, int opt_linger, int trigmode, int sql_num,
-              int thread_num, int close_log, int actor_model);
+              int thread_num, int max_thread_num, int close_log, int actor_model, int store_mode,
+              std::string reactor_cpus, std::string worker_cpus, std::string nic_name, int perf_mode,
+              std::string log_level, int log_format,
+              int log_compress, int log_keep_mb, int log_keep_days,
+              int access_sample, int access_slow_ms, int access_rate, std::string capture_file,
+              int trace_interval, int trace_slow_ms, int cache_max_age);
     
     void thread_pool();     // 线程池初始化
-    void sql_pool();        // 数据库连接池初始化
+    void sql_pool();        // 数据库连接池与用户存储初始化
     void log_write();       // 日志初始化
     void trig_mode();       // 服务器触发模式设置
     void eventListen();     // 监听服务器事件
     void eventLoop();       // 服务器启动
+    void bind_reactor();    // 事件循环线程绑定CPU，连接数据迁移到所在NUMA节点
     void timer(int connfd, struct sockaddr_in client_address);           // 服务器定时器
     void adjust_timer(tw_timer *timer);
     void deal_timer(tw_timer *timer, int sockfd);
@@ -56,6 +73,8 @@ public:
     bool dealwithsignal(bool &timeout, bool &stop_server);
     void dealwithread(int sockfd);
     void dealwithwrite(int sockfd);
+    void dispatch_ready();  // 将本轮就绪的请求批量放入线程池
+    void reject_busy(int sockfd);   // 车道已满时回复503并关闭连接
 
 public:
     /* 服务器基本参数 */
@@ -63,6 +82,18 @@ public:
     char *m_root;       // 跟文件路径
     int m_log_write;    // 是否异步写日志
     int m_close_log;    // 是否启动日志
+    std::string m_log_level;    // 日志级别配置
+    int m_log_format;   // 日志格式 0文本 1二进制
+    int m_log_compress;     // 切分下来的日志压缩级别
+    int m_log_keep_mb;      // 日志保留总大小
+    int m_log_keep_days;    // 日志保留天数
+    int m_access_sample;    // 访问日志采样间隔
+    int m_access_slow_ms;   // 慢请求阈值
+    int m_access_rate;      // 访问日志限流速率
+    std::string m_capture_file;     // 流量录制文件
+    int m_trace_interval;   // 请求追踪抽样间隔
+    int m_trace_slow_ms;    // 追踪的慢请求阈值
+    int m_cache_max_age;    // 静态文件的缓存有效期
     int m_actormodel;   // 服务器 同步/异步 模式
 
     int m_pipefd[2];    // 信号管道
@@ -75,13 +106,25 @@ public:
     std::string m_passWord;                         // 数据库用户密码
     std::string m_databaseName;                     // 数据库名称
     int m_sql_num;                                  // 使用sql连接数量
+    int m_store_mode;                               // 用户存储后端, 0 MySQL, 1 嵌入式KV
+    user_store *m_userStore;                        // 用户凭证存储
 
     /* 线程池相关 */
     threadpool<http_conn> *m_pool;                  // 线程池
     int m_thread_num;                               // 线程数量
+    int m_max_thread_num;                           // 最大线程数量
+
+    /* CPU与NUMA放置 */
+    std::vector<int> m_reactor_cpus;                // 事件循环线程绑定的CPU
+    std::vector<int> m_worker_cpus;                 // 工作线程绑定的CPU
+    int m_perf_mode;                                // 性能计数模式
 
     /* epoll_event */
     epoll_event events[MAX_EVENT_NUMBER];           // event事件数量
+    http_conn *m_ready[MAX_EVENT_NUMBER];            // 本轮epoll_wait中就绪、待分发的请求
+    int m_ready_num;                                // 待分发请求数量
+    std::vector<http_conn *> m_pending;             // 线程池队列已满未能放入的请求，事件仍未重新注册，下一轮优先分发
+    std::vector<http_conn *> m_dispatch;            // 与 m_pending 合并后的本轮请求
 
     int m_listenfd;                                 // socket监听
     int m_OPT_LINGER;                               // 是否Linger